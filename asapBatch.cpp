@@ -0,0 +1,402 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "asapExecute.h"
+#include "asapSim.h"
+#include "asapBatch.h"
+#include "asapTiming.h"
+#include "asapIo.h"
+#include "get_stb.h"
+#include "asapSnap.h"
+
+/*
+ * Batch mode (-B manifest). Each line of the manifest is a job:
+ *
+ *	image [input [count]]
+ *
+ * image is run with the guest's stdin from input ('-' or none for nothing
+ * to read) and stopped after count instructions if given, else after -n's.
+ * Blank lines and lines starting with '#' are skipped. The other options
+ * apply to every job, -r included.
+ *
+ * Each image is opened once and every job using it maps it copy on write
+ * (see asapLoadFd()), so they all share its pages until they write to
+ * them. A .hex is placed from its records by each job instead (see
+ * asapVlda.cpp). The jobs are run a context each on a pool of threads. A worker
+ * starts with an even share of the jobs, does them from the front and when
+ * it runs out takes one from the back of another worker's share, so a few
+ * long jobs don't hold up the rest.
+ *
+ * Timing is always on so the block and JIT engines count instructions and
+ * keep to the budget. Once everything is done the results file has, for
+ * each job in manifest order, the line
+ *
+ *	job N IMAGE exit=S end=HOW insns=I cycles=C output=LEN
+ *
+ * followed by the LEN bytes the job wrote to stdout and stderr (the
+ * simulator's messages included) and a newline. S is what the guest gave
+ * SYSCALL_EXIT, -1 if it didn't. HOW is 'exit', 'budget' if the count ran
+ * out, 'halt' for any other end of the run or 'error' if it couldn't be
+ * started.
+ */
+
+typedef struct
+{
+	char *path;
+	int fd;					/* -1 if it couldn't be opened */
+	int err;				/* errno if it couldn't be */
+} BatchImage_t;
+
+typedef struct
+{
+	int image;				/* in images[] */
+	char *input;			/* file for the guest's stdin, NULL if none */
+	uint64_t budget;		/* instructions, 0 for -n's */
+	char *output;			/* what it wrote */
+	size_t outputLen;
+	int exitStatus;
+	const char *end;
+	uint64_t insns;
+	uint64_t cycles;
+} BatchJob_t;
+
+/* A worker's share of the jobs, those from next up to end */
+typedef struct
+{
+	pthread_mutex_t lock;
+	int next;
+	int end;
+} BatchQueue_t;
+
+typedef struct
+{
+	const BatchOpts_t *opts;
+	BatchJob_t *jobs;
+	BatchImage_t *images;
+	BatchQueue_t *queues;
+	int numQueues;
+} Batch_t;
+
+typedef struct
+{
+	Batch_t *batch;
+	int self;				/* its queue */
+} BatchWorker_t;
+
+/* Index of the image at path, opened if it hasn't been. -1 if out of memory. */
+static int findImage(BatchImage_t **images, int *numImages, const char *path)
+{
+	BatchImage_t *img;
+	int ii;
+
+	for ( ii = 0; ii < *numImages; ++ii )
+	{
+		if ( !strcmp((*images)[ii].path,path) )
+			return ii;
+	}
+	img = (BatchImage_t *)realloc(*images,(*numImages+1)*sizeof(BatchImage_t));
+	if ( !img )
+		return -1;
+	*images = img;
+	img += ii;
+	memset(img,0,sizeof(*img));
+	img->fd = -1;
+	img->path = strdup(path);
+	if ( !img->path )
+		return -1;
+	img->fd = open(path,O_RDONLY);
+	img->err = errno;
+	++*numImages;
+	return ii;
+}
+
+/* Read the manifest. Returns the number of jobs, -1 if it can't. */
+static int readManifest(const char *manifest, BatchJob_t **jobs, BatchImage_t **images, int *numImages)
+{
+	FILE *fp;
+	char line[1024], *path, *input, *count, *endp;
+	BatchJob_t *job;
+	int lineNum = 0, numJobs = 0;
+
+	fp = fopen(manifest,"r");
+	if ( !fp )
+	{
+		fprintf(stderr,"Unable to open '%s': %s\n", manifest, strerror(errno));
+		return -1;
+	}
+	while ( fgets(line,sizeof(line),fp) )
+	{
+		++lineNum;
+		path = strtok(line," \t\r\n");
+		if ( !path || path[0] == '#' )
+			continue;
+		input = strtok(NULL," \t\r\n");
+		count = input ? strtok(NULL," \t\r\n") : NULL;
+		job = (BatchJob_t *)realloc(*jobs,(numJobs+1)*sizeof(BatchJob_t));
+		if ( !job )
+			break;
+		*jobs = job;
+		job += numJobs;
+		memset(job,0,sizeof(*job));
+		job->exitStatus = -1;
+		if ( count )
+		{
+			endp = NULL;
+			job->budget = strtoull(count,&endp,0);
+			if ( !endp || *endp || !job->budget || strtok(NULL," \t\r\n") )
+			{
+				fprintf(stderr,"%s:%d: Expected image [input [count]]\n", manifest, lineNum);
+				fclose(fp);
+				return -1;
+			}
+		}
+		if ( input && strcmp(input,"-") && !(job->input = strdup(input)) )
+			break;
+		job->image = findImage(images,numImages,path);
+		if ( job->image < 0 )
+		{
+			free(job->input);
+			break;
+		}
+		++numJobs;
+	}
+	if ( !feof(fp) )
+	{
+		if ( !ferror(fp) )
+			fprintf(stderr,"%s:%d: Not enough memory for the jobs\n", manifest, lineNum);
+		else
+			fprintf(stderr,"Error reading '%s': %s\n", manifest, strerror(errno));
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return numJobs;
+}
+
+static void runJob(const Batch_t *batch, BatchJob_t *job)
+{
+	const BatchOpts_t *opts = batch->opts;
+	const BatchImage_t *img = batch->images + job->image;
+	const Asap_t *proto = opts->proto;
+	Asap_t *asap;
+	FILE *out, *in;
+	int ii;
+
+	job->end = "error";
+	out = open_memstream(&job->output,&job->outputLen);
+	if ( !out )
+		return;
+	in = fopen(job->input ? job->input : "/dev/null","r");
+	if ( !in )
+	{
+		fprintf(out,"Unable to open '%s': %s\n", job->input, strerror(errno));
+		fclose(out);
+		return;
+	}
+	asap = asapCreate();
+	if ( !asap )
+	{
+		fprintf(out,"Out of memory\n");
+		fclose(in);
+		fclose(out);
+		return;
+	}
+	asap->fin = in;
+	asap->fout = out;
+	asap->ferr = out;
+	asap->engine = proto->engine;
+	asap->traps = proto->traps;
+	asap->verbose = proto->verbose;
+	asap->stackSize = proto->stackSize;
+	asap->wholeSpace = proto->wholeSpace;
+	asap->stbFilename = proto->stbFilename;
+	asap->insnLimited = proto->insnLimited;
+	asap->insnLeft = proto->insnLeft;
+	if ( job->budget )
+	{
+		asap->insnLimited = true;
+		asap->insnLeft = job->budget;
+	}
+	timingDefaults(asap);		/* for the instruction count */
+	for ( ii = 0; ii < opts->numTimingSpecs; ++ii )
+	{
+		if ( timingOption(asap,opts->timingSpecs[ii]) )
+			goto done;
+	}
+	if ( img->fd < 0 )
+	{
+		fprintf(out,"Unable to open for read '%s': %s\n", img->path, strerror(img->err));
+		goto done;
+	}
+	if ( asapLoadFd(asap,img->fd,img->path,false) )
+		goto done;
+	for ( ii = 0; ii < opts->numIoSpecs; ++ii )
+	{
+		if ( ioOption(asap,opts->ioSpecs[ii]) )
+			goto done;
+	}
+	if ( asap->stbFilename && get_stb(asap) )
+		goto done;
+	if ( opts->errnoPtr && opts->errnoPtr < asap->memLen )
+		asap->errnoPtr = (int *)(asap->mem + opts->errnoPtr);
+	if ( opts->snapshot && snapRestore(asap,opts->snapshot) )
+		goto done;
+	simulateAsap(asap);
+	if ( asap->exitStatus != -1 )
+		job->end = "exit";
+	else if ( asap->insnLimited && !asap->insnLeft )
+		job->end = "budget";
+	else
+		job->end = "halt";
+	job->exitStatus = asap->exitStatus;
+	job->insns = asap->insns;
+	job->cycles = asap->cycles;
+done:
+	asapDestroy(asap);
+	fclose(in);
+	fclose(out);
+}
+
+/* The next job for worker self to do, -1 if there are none left anywhere */
+static int nextJob(Batch_t *batch, int self)
+{
+	BatchQueue_t *q;
+	int ii, idx = -1;
+
+	for ( ii = 0; ii < batch->numQueues && idx < 0; ++ii )
+	{
+		q = batch->queues + (self+ii)%batch->numQueues;
+		pthread_mutex_lock(&q->lock);
+		if ( q->next < q->end )
+			idx = ii ? --q->end : q->next++;	/* its own from the front, others' from the back */
+		pthread_mutex_unlock(&q->lock);
+	}
+	return idx;
+}
+
+static void *worker(void *arg)
+{
+	BatchWorker_t *wk = (BatchWorker_t *)arg;
+	int idx;
+
+	while ( (idx = nextJob(wk->batch,wk->self)) >= 0 )
+		runJob(wk->batch,wk->batch->jobs + idx);
+	return NULL;
+}
+
+static int writeResults(const char *results, const BatchJob_t *jobs, int numJobs, const BatchImage_t *images)
+{
+	const BatchJob_t *job;
+	FILE *fp = stdout;
+	int ii;
+
+	if ( results && !(fp = fopen(results,"w")) )
+	{
+		fprintf(stderr,"Unable to create '%s': %s\n", results, strerror(errno));
+		return 1;
+	}
+	for ( ii = 0, job = jobs; ii < numJobs; ++ii, ++job )
+	{
+		fprintf(fp,"job %d %s exit=%d end=%s insns=%llu cycles=%llu output=%lu\n",
+				ii+1, images[job->image].path, job->exitStatus, job->end,
+				(unsigned long long)job->insns, (unsigned long long)job->cycles,
+				(unsigned long)job->outputLen);
+		if ( job->outputLen )
+			fwrite(job->output,1,job->outputLen,fp);
+		fputc('\n',fp);
+	}
+	fflush(fp);
+	if ( ferror(fp) )
+	{
+		fprintf(stderr,"Error writing '%s': %s\n", results ? results : "stdout", strerror(errno));
+		if ( results )
+			fclose(fp);
+		return 1;
+	}
+	if ( results && fclose(fp) )
+	{
+		fprintf(stderr,"Error writing '%s': %s\n", results, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int runBatch(const char *manifest, const char *results, const BatchOpts_t *opts)
+{
+	Batch_t batch;
+	BatchJob_t *jobs = NULL;
+	BatchImage_t *images = NULL;
+	BatchWorker_t *workers = NULL;
+	pthread_t *tids = NULL;
+	int numJobs, numImages = 0, threads, started = 0, ii, sts = 1;
+
+	batch.queues = NULL;
+	numJobs = readManifest(manifest,&jobs,&images,&numImages);
+	if ( numJobs < 0 )
+		goto done;
+	threads = opts->threads;
+	if ( threads <= 0 )
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( threads > numJobs )
+		threads = numJobs;
+	if ( threads < 1 )
+		threads = 1;
+	batch.opts = opts;
+	batch.jobs = jobs;
+	batch.images = images;
+	batch.numQueues = threads;
+	batch.queues = (BatchQueue_t *)calloc(threads,sizeof(BatchQueue_t));
+	workers = (BatchWorker_t *)calloc(threads,sizeof(BatchWorker_t));
+	tids = (pthread_t *)calloc(threads,sizeof(pthread_t));
+	if ( !batch.queues || !workers || !tids )
+	{
+		fprintf(stderr,"Not enough memory for %d threads\n", threads);
+		goto done;
+	}
+	for ( ii = 0; ii < threads; ++ii )
+	{
+		pthread_mutex_init(&batch.queues[ii].lock,NULL);
+		batch.queues[ii].next = (int64_t)numJobs*ii/threads;
+		batch.queues[ii].end = (int64_t)numJobs*(ii+1)/threads;
+		workers[ii].batch = &batch;
+		workers[ii].self = ii;
+	}
+	/* The first worker is this thread */
+	for ( started = 1; started < threads; ++started )
+	{
+		if ( pthread_create(tids+started,NULL,worker,workers+started) )
+			break;
+	}
+	worker(workers);
+	for ( ii = 1; ii < started; ++ii )
+		pthread_join(tids[ii],NULL);
+	for ( ii = 0; ii < threads; ++ii )
+		pthread_mutex_destroy(&batch.queues[ii].lock);
+	sts = writeResults(results,jobs,numJobs,images);
+done:
+	for ( ii = 0; ii < numJobs; ++ii )
+	{
+		free(jobs[ii].input);
+		free(jobs[ii].output);
+	}
+	for ( ii = 0; ii < numImages; ++ii )
+	{
+		free(images[ii].path);
+		if ( images[ii].fd >= 0 )
+			close(images[ii].fd);
+	}
+	free(jobs);
+	free(images);
+	free(batch.queues);
+	free(workers);
+	free(tids);
+	return sts;
+}
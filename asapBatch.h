@@ -0,0 +1,24 @@
+#ifndef _ASAPBATCH_H_
+#define _ASAPBATCH_H_
+
+#include "asapExecute.h"
+
+/* What every job of a batch (-B) is set up with, from the command line */
+typedef struct
+{
+	const Asap_t *proto;		/* engine, traps, verbose, stackSize, wholeSpace, -n and stbFilename are taken from this */
+	const char **timingSpecs;	/* -t specs, as timingOption() takes them */
+	int numTimingSpecs;
+	const char **ioSpecs;		/* -m specs, as ioOption() takes them */
+	int numIoSpecs;
+	uint32_t errnoPtr;			/* -e, 0 if not given */
+	const char *snapshot;		/* -r, every job starts from it if not NULL */
+	int threads;				/* to run jobs on, 0 for one per core */
+} BatchOpts_t;
+
+/* Run the jobs in the manifest and write what became of them to results
+   (stdout if NULL). Returns non-zero if the manifest or results can't be
+   had. Jobs that fail say so in the results. */
+extern int runBatch(const char *manifest, const char *results, const BatchOpts_t *opts);
+
+#endif	/* _ASAPBATCH_H_ */
@@ -0,0 +1,142 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "asapExecute.h"
+#include "asapEvent.h"
+
+/*
+ * Events and the interrupt controller.
+ *
+ * Devices get things done at a given cycle count by scheduling an event.
+ * Pending events are kept in a heap on when they're due and the engines
+ * only compare cycles against nextCheck at the end of a block (or each
+ * instruction, for the reference engine) to know whether anything is due.
+ * With nothing scheduled nextCheck is UINT64_MAX and that is all it costs.
+ * Cycles are only counted with timing on, so that's needed for events.
+ *
+ * /IRQ is asserted while any bit of irqLines is set. Taking the interrupt
+ * acknowledges all of them, there being only the one level and the one
+ * vector. Setting the I bit with /IRQ asserted makes nextCheck 0 so the
+ * interrupt is taken at the next look.
+ */
+
+typedef struct Event_t
+{
+	uint64_t when;
+	EventFunc_t func;
+	void *arg;
+} Event_t;
+
+int scheduleEvent(Asap_t *asap, uint64_t when, EventFunc_t func, void *arg)
+{
+	Event_t *ev, tmp;
+	int idx, up;
+
+	if ( asap->numEvents >= asap->maxEvents )
+	{
+		idx = asap->maxEvents ? asap->maxEvents*2 : 8;
+		ev = (Event_t *)realloc(asap->events,idx*sizeof(Event_t));
+		if ( !ev )
+			return 1;
+		asap->events = ev;
+		asap->maxEvents = idx;
+	}
+	ev = asap->events;
+	idx = asap->numEvents++;
+	ev[idx].when = when;
+	ev[idx].func = func;
+	ev[idx].arg = arg;
+	for ( ; idx; idx = up )
+	{
+		up = (idx-1)/2;
+		if ( ev[up].when <= ev[idx].when )
+			break;
+		tmp = ev[up];
+		ev[up] = ev[idx];
+		ev[idx] = tmp;
+	}
+	if ( when < asap->nextCheck )
+		asap->nextCheck = when;
+	return 0;
+}
+
+/* Take the first event off the heap */
+static Event_t popEvent(Asap_t *asap)
+{
+	Event_t *ev = asap->events, top = ev[0], tmp;
+	int idx, down;
+
+	ev[0] = ev[--asap->numEvents];
+	for ( idx = 0; (down = 2*idx+1) < asap->numEvents; idx = down )
+	{
+		if ( down+1 < asap->numEvents && ev[down+1].when < ev[down].when )
+			++down;
+		if ( ev[idx].when <= ev[down].when )
+			break;
+		tmp = ev[down];
+		ev[down] = ev[idx];
+		ev[idx] = tmp;
+	}
+	return top;
+}
+
+uint64_t runEvents(Asap_t *asap)
+{
+	Event_t ev;
+
+	while ( asap->numEvents && asap->events[0].when <= asap->cycles )
+	{
+		ev = popEvent(asap);
+		ev.func(asap,ev.arg,ev.when);
+	}
+	return asap->numEvents ? asap->events[0].when : UINT64_MAX;
+}
+
+void raiseIrq(Asap_t *asap, int source)
+{
+	asap->irqLines |= 1<<source;
+	asap->nextCheck = 0;
+}
+
+void clearIrq(Asap_t *asap, int source)
+{
+	asap->irqLines &= ~(1<<source);
+}
+
+static void timerTick(Asap_t *asap, void *arg, uint64_t when)
+{
+	raiseIrq(asap,IRQ_TIMER);
+	scheduleEvent(asap,when+asap->timerPeriod,timerTick,NULL);
+}
+
+int timerStart(Asap_t *asap)
+{
+	return scheduleEvent(asap,asap->cycles+asap->timerPeriod,timerTick,NULL);
+}
+
+uint64_t timerDue(Asap_t *asap)
+{
+	int ii;
+
+	for ( ii = 0; ii < asap->numEvents; ++ii )
+	{
+		if ( asap->events[ii].func == timerTick )
+			return asap->events[ii].when;
+	}
+	return 0;
+}
+
+int eventsRestart(Asap_t *asap, uint64_t due)
+{
+	asap->numEvents = 0;
+	asap->nextCheck = 0;		/* in case /IRQ is asserted */
+	if ( !asap->timerPeriod )
+		return 0;
+	if ( !due )
+		due = asap->cycles + asap->timerPeriod;
+	return scheduleEvent(asap,due,timerTick,NULL);
+}
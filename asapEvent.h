@@ -0,0 +1,31 @@
+#ifndef _ASAPEVENT_H_
+#define _ASAPEVENT_H_
+
+#include "asapExecute.h"
+
+/* What an event does when it's due. when is the cycle it was due at. */
+typedef void (*EventFunc_t)(Asap_t *asap, void *arg, uint64_t when);
+
+/* Have func(asap,arg,when) called once cycles reaches when. Returns non-zero if it can't. */
+extern int scheduleEvent(Asap_t *asap, uint64_t when, EventFunc_t func, void *arg);
+
+/* Call the events that are due. Returns when the next one is, UINT64_MAX if none. */
+extern uint64_t runEvents(Asap_t *asap);
+
+/* Assert and deassert /IRQ for source (0-31). The interrupt is only
+   looked for at the end of a block or instruction, whichever the engine does. */
+extern void raiseIrq(Asap_t *asap, int source);
+extern void clearIrq(Asap_t *asap, int source);
+
+/* Start the periodic timer, interrupting every timerPeriod cycles */
+extern int timerStart(Asap_t *asap);
+
+/* When the timer next interrupts, 0 if it isn't running */
+extern uint64_t timerDue(Asap_t *asap);
+
+/* Forget everything scheduled and start the timer again (if there is one)
+   with its next interrupt at due, or a period from now if due is 0. For
+   when cycles has been changed under them. Returns non-zero if it can't. */
+extern int eventsRestart(Asap_t *asap, uint64_t due);
+
+#endif	/* _ASAPEVENT_H_ */
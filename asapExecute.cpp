@@ -7,6 +7,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "asapExecute.h"
@@ -14,19 +16,18 @@
 #include "qa.h"
 #include "syscalls.h"
 #include "get_stb.h"
+#include "asapJit.h"
+#include "asapGuard.h"
+#include "asapEvent.h"
+#include "asapIo.h"
+#include "asapSnap.h"
+#include "asapReplay.h"
+#include "asapHistory.h"
 
-#define CARRY		(1<<0)
-#define OVERFLOW	(1<<1)
-#define ZERO		(1<<2)
-#define NEGATIVE	(1<<3)
-#define IENABLE		(1<<4)
-#define PIENABLE	(1<<5)
-#define BSR_INC		(8)		/* Spec says this should be 4, but some real code assumes 8 */
 
-static int chkBranch(Asap_t *asap)
+static int chkBranch(uint32_t status, int condition)
 {
 	bool C,V,Z,N;
-	int status = asap->status, condition=asap->dstReg;
 	
 	C = (status&CARRY) ? 1 : 0;
 	V = (status&OVERFLOW) ? 1 : 0;
@@ -35,60 +36,92 @@ static int chkBranch(Asap_t *asap)
 	switch (condition)
 	{
 	case 0:		/* strictly positive (Z|N) == 0 */
-		asap->msg = "BSP";
 		return !(Z|N);
 	case 1:		/* minus or zero (Z|N) == 1*/
-		asap->msg = "BMZ";
 		return (Z|N);
 	case 2:		/* greater than ((N ^ V) | Z) == 0 */
-		asap->msg = "BGT";
 		return !((N^V)|Z);
 	case 3:		/* less than or equal ((N ^ V) | Z) == 1 */
-		asap->msg = "BLE";
 		return ((N^V)|Z);
 	case 4:		/* greater than or equal  (N ^ V) == 0 */
-		asap->msg = "BGT";
 		return !(N^V);
 	case 5:		/* less than  (N ^ V) == 1 */
-		asap->msg = "BLT";
 		return (N^V);
 	case 6:		/* high (~C | Z) == 0 */
-		asap->msg = "BHI";
 		return !(!C | Z);
 	case 7:		/* low or equal (~C | Z) == 1 */
-		asap->msg = "BLE";
 		return (!C | Z);
 	case 8:		/* carry clear C == 0*/
-		asap->msg = "BLO(BCC)";
 		return !C;
 	case 9:		/* carry set C == 1 */
-		asap->msg = "BCS";
 		return C;
 	case 10:	/* Plus N == 0 */
-		asap->msg = "BPL";
 		return !N;
 	case 11:	/* Minus N == 1 */
-		asap->msg = "BMI";
 		return N;
 	case 12:	/* Not equal Z == 0 */
-		asap->msg = "BNE";
 		return !Z;
 	case 13:	/* Equal Z == 1 */
-		asap->msg = "BEQ";
 		return Z;
 	case 14:	/* Overflow V == 0 */
-		asap->msg = "BVC";
 		return !V;
 	case 15:	/* Overflow V == 1 */
-		asap->msg = "BVS";
 		return V;
 	default:
 		break;
 	}
-	asap->msg = "Illegal branch";
 	return 2;
 }
 
+/* Names of branch conditions as shown in trace, indexed by condition */
+static const char * const BranchNames[16] =
+{
+	"BSP", "BMZ", "BGT", "BLE", "BGT", "BLT", "BHI", "BLE",
+	"BLO(BCC)", "BCS", "BPL", "BMI", "BNE", "BEQ", "BVC", "BVS"
+};
+
+typedef struct
+{
+	const char *opc;	/* mnemonic */
+	const char *oper;	/* operator shown in trace of ALU instructions */
+	int shiftCnt;		/* 0, 1 or 2 for byte, short or long operand of LD/ST/LEA/JSR */
+} OpText_t;
+static const OpText_t OpTexts[32] =
+{
+	{ NULL,   NULL, 0 },	/* 0x00 - illegal */
+	{ NULL,   NULL, 0 },	/* 0x01 - Bcc */
+	{ NULL,   NULL, 0 },	/* 0x02 - BSR/BRA */
+	{ "LEA",  NULL, 2 },	/* 0x03 */
+	{ "LEAS", NULL, 1 },	/* 0x04 */
+	{ "SUBR", NULL, 0 },	/* 0x05 */
+	{ "XOR",  "^",  0 },	/* 0x06 */
+	{ "XORN", "^~", 0 },	/* 0x07 */
+	{ "ADD",  "+",  0 },	/* 0x08 */
+	{ "SUB",  "-",  0 },	/* 0x09 */
+	{ "ADDC", "+",  0 },	/* 0x0A */
+	{ "SUBC", "-",  0 },	/* 0x0B */
+	{ "AND",  "&",  0 },	/* 0x0C */
+	{ "ANDN", "&~", 0 },	/* 0x0D */
+	{ "OR",   "|",  0 },	/* 0x0E */
+	{ "ORN",  "|~", 0 },	/* 0x0F */
+	{ "LD",   NULL, 2 },	/* 0x10 */
+	{ "LDS",  NULL, 1 },	/* 0x11 */
+	{ "LDUS", NULL, 1 },	/* 0x12 */
+	{ "STS",  NULL, 1 },	/* 0x13 */
+	{ "ST",   NULL, 2 },	/* 0x14 */
+	{ "LDB",  NULL, 0 },	/* 0x15 */
+	{ "LDUB", NULL, 0 },	/* 0x16 */
+	{ "STB",  NULL, 0 },	/* 0x17 */
+	{ "ASHR", ">>", 0 },	/* 0x18 */
+	{ "LSHR", ">>", 0 },	/* 0x19 */
+	{ "SHL",  "<<", 0 },	/* 0x1A */
+	{ "ROTL", "<<", 0 },	/* 0x1B */
+	{ "GETPS", NULL, 0 },	/* 0x1C */
+	{ "PUTPS", NULL, 0 },	/* 0x1D */
+	{ "JSR",  NULL, 2 },	/* 0x1E */
+	{ NULL,   NULL, 0 }		/* 0x1F - illegal */
+};
+
 const char *mkRegName(Asap_t *asap, int num, int reg)
 {
 	if ( reg == 29 )
@@ -103,24 +136,6 @@ const char *mkRegName(Asap_t *asap, int num, int reg)
 	return asap->regName[num];
 }
 
-char *mkStsTxt(Asap_t *asap, bool flag)
-{
-	if ( flag )
-	{
-		snprintf(asap->stsTxt, sizeof(asap->stsTxt), ", sts %c%c%c%c%c%c, ",
-				(asap->status&PIENABLE)	? 'P': '-',
-				(asap->status&IENABLE)	? 'I': '-',
-				(asap->status&NEGATIVE)	? 'N': '-',
-				(asap->status&OVERFLOW)	? 'V': '-',
-				(asap->status&ZERO)		? 'Z': '-',
-				(asap->status&CARRY)	? 'C': '-'
-				 );
-	}
-	else
-		asap->stsTxt[0] = 0;
-	return asap->stsTxt;
-}
-
 /* Status bits:
    0 - carry
    1 - overflow
@@ -142,90 +157,289 @@ static const BitMask_t BitMasks[] =
 	{ (uint32_t)1<<31, (uint32_t)0xFFFFFFFF } /* 2 */
 };
 
-/* shiftCnt is 0, 1 or 2 for byte, short or long */
-static void setStatus(Asap_t *asap, int shiftCnt)
+/* The status after an instruction sets the bits in stsMask from its result
+   and sources. shiftCnt is 0, 1 or 2 for byte, short or long */
+static uint32_t mkStatus(uint32_t status, uint8_t stsMask, int64_t bDst, int64_t bSrc1, int64_t bSrc2, int shiftCnt)
 {
-	bool carry = (asap->bDst & 0x100000000);	// No matter what, bit 32 of result is carry
+	bool carry = (bDst & 0x100000000);	// No matter what, bit 32 of result is carry
 	static const uint32_t Bit31 = 1<<31;
 	
-	asap->status &= ~asap->stsMask;
-	if ( (asap->stsMask & CARRY) && carry )
-		asap->status |= CARRY;
-	if ( (asap->stsMask & OVERFLOW) )
+	status &= ~stsMask;
+	if ( (stsMask & CARRY) && carry )
+		status |= CARRY;
+	if ( (stsMask & OVERFLOW) )
 	{
 				// If both sources were negative and the result was positve, it's an overflow
-		if (   (((asap->bSrc2 & asap->bSrc1) & Bit31) && !carry)
+		if (   (((bSrc2 & bSrc1) & Bit31) && !carry)
 			   // or if both sources were positive and the result was negative, it's an overflow
-			|| (!((asap->bSrc2 | asap->bSrc1) & Bit31) && carry)
+			|| (!((bSrc2 | bSrc1) & Bit31) && carry)
 		   )
-			asap->status |= OVERFLOW;
+			status |= OVERFLOW;
+	}
+	if ( (stsMask & ZERO) && !(bDst&BitMasks[shiftCnt].mask) )
+		status |= ZERO;
+	if ( (stsMask & NEGATIVE) && (bDst&BitMasks[shiftCnt].bit) )
+		status |= NEGATIVE;
+	return status;
+}
+
+/*
+ * The condition codes are worked out lazily. A .C instruction just leaves
+ * its result and sources in lazyDst, lazySrc1 and lazySrc2, and they are
+ * only made into status bits when something reads the status through
+ * getStatus(). Most of the time another .C instruction comes along first
+ * and they needn't be made at all. Everything that sets the status outright
+ * goes through putStatus(), which also notices interrupts being enabled
+ * with /IRQ asserted.
+ *
+ * With LAZY_FLAGS_CHECK defined, checkStatus is kept up to date the eager
+ * way too and every getStatus() complains if the two disagree about the
+ * status or about any of the 16 branch conditions.
+ */
+static void foldStatus(Asap_t *asap)
+{
+	asap->status = mkStatus(asap->status,asap->lazyMask,asap->lazyDst,asap->lazySrc1,asap->lazySrc2,asap->lazyShift);
+	asap->lazyMask = 0;
+#ifdef LAZY_FLAGS_CHECK
+	int cond;
+	
+	for ( cond = 0; cond < 16; ++cond )
+	{
+		if ( chkBranch(asap->status,cond) != chkBranch(asap->checkStatus,cond) )
+		{
+			fprintf(asap->ferr,"LAZY_FLAGS_CHECK: at %08X %s differs. lazy %02X, eager %02X\n",
+					asap->pcQue[0], BranchNames[cond], asap->status, asap->checkStatus);
+			++asap->lazyFlagsErrors;
+		}
+	}
+	if ( asap->status != asap->checkStatus )
+	{
+		fprintf(asap->ferr,"LAZY_FLAGS_CHECK: at %08X status differs. lazy %02X, eager %02X\n",
+				asap->pcQue[0], asap->status, asap->checkStatus);
+		++asap->lazyFlagsErrors;
 	}
-	if ( (asap->stsMask & ZERO) && !(asap->bDst&BitMasks[shiftCnt].mask) )
-		asap->status |= ZERO;
-	if ( (asap->stsMask & NEGATIVE) && (asap->bDst&BitMasks[shiftCnt].bit) )
-		asap->status |= NEGATIVE;
+#endif
+}
+
+static inline uint32_t getStatus(Asap_t *asap)
+{
+	if ( asap->lazyMask )
+		foldStatus(asap);
+	return asap->status;
+}
+
+static inline void putStatus(Asap_t *asap, uint32_t status)
+{
+	asap->status = status;
+	asap->lazyMask = 0;
+	if ( asap->irqLines && (status&IENABLE) )
+		asap->nextCheck = 0;
+#ifdef LAZY_FLAGS_CHECK
+	asap->checkStatus = status;
+#endif
+}
+
+uint32_t readStatus(Asap_t *asap)
+{
+	return getStatus(asap);
 }
 
-static void getALUargs(Asap_t *asap)
+void writeStatus(Asap_t *asap, uint32_t status)
 {
-	asap->bDst = asap->registers[asap->dstReg];
-	asap->bSrc1 = asap->registers[asap->src1Reg];
-	if ( asap->src2 >= 0xFFE0 )
-		asap->bSrc2 = asap->registers[asap->src2-0xFFE0];
+	putStatus(asap,status);
+}
+
+/* A .C instruction set the bits in stsMask */
+static inline void lazyStatus(Asap_t *asap, uint8_t stsMask, int64_t bDst, int64_t bSrc1, int64_t bSrc2, int shiftCnt)
+{
+	if ( (asap->lazyMask&~stsMask) )
+		foldStatus(asap);		/* some of what's pending isn't replaced */
+	asap->lazyMask = stsMask;
+	asap->lazyShift = shiftCnt;
+	asap->lazyDst = bDst;
+	asap->lazySrc1 = bSrc1;
+	asap->lazySrc2 = bSrc2;
+#ifdef LAZY_FLAGS_CHECK
+	asap->checkStatus = mkStatus(asap->checkStatus,stsMask,bDst,bSrc1,bSrc2,shiftCnt);
+#endif
+}
+
+char *mkStsTxt(Asap_t *asap, bool flag)
+{
+	if ( flag )
+	{
+		getStatus(asap);
+		snprintf(asap->stsTxt, sizeof(asap->stsTxt), ", sts %c%c%c%c%c%c, ",
+				(asap->status&PIENABLE)	? 'P': '-',
+				(asap->status&IENABLE)	? 'I': '-',
+				(asap->status&NEGATIVE)	? 'N': '-',
+				(asap->status&OVERFLOW)	? 'V': '-',
+				(asap->status&ZERO)		? 'Z': '-',
+				(asap->status&CARRY)	? 'C': '-'
+				 );
+	}
 	else
-		asap->bSrc2 = asap->src2;
-	return;
+		asap->stsTxt[0] = 0;
+	return asap->stsTxt;
 }
 
-/* shiftCnt is 0, 1 or 2  */
-static uint32_t getLSargs(Asap_t *asap, uint32_t instruction, int shiftCnt)
+/* shiftCnt is 0, 1 or 2 for byte, short or long */
+template <int ShiftCnt, bool Src2Reg>
+static uint32_t getLSargs(Asap_t *asap, const Decode_t *dp)
 {
 	uint32_t ans;
-	int src1, src2, src2IsReg=0;
+	int src1, src2;
 	
-	src1 = (instruction>>16)&0x1F;
-	src2 = (instruction&0xFFFF);
+	src1 = dp->src1Reg;
+	src2 = dp->src2;
 	ans = asap->registers[src1];
-	if ( src2 >= 0xFFE0 )
+	if ( Src2Reg )
+		src2 = asap->registers[src2];
+	asap->trace.src1 = ans;
+	asap->trace.src2 = src2;
+	ans += src2*(1<<ShiftCnt);
+	asap->trace.ea = ans;
+	if ( (src1 == 29 || (Src2Reg && src2 == 29)) && !asap->wholeSpace )
+	{
+		if ( ans < asap->memLen || ans > asap->memSize )
+		{
+			snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of STACK range of memory %08X-%08llX\n",
+					 ans, asap->memLen, (unsigned long long)asap->memSize);
+		}
+	}
+	return ans;
+}
+
+/* Complain unless the ShiftCnt sized access at memIdx is in memory */
+static bool chkMemIdx(Asap_t *asap, uint32_t memIdx)
+{
+	if ( memIdx > asap->memSize )
 	{
-		src2 = asap->registers[src2-0xFFE0];
-		src2IsReg = 1;
+		snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08llX\n", memIdx, (unsigned long long)asap->memSize);
+		return false;
 	}
-	ans += src2*(1<<shiftCnt);
-	if ( src1 == 29 || (src2IsReg && src2 == 29) )
+	return true;
+}
+
+/*
+ * Watchpoints. watchPages[] has the types of the watchpoints on each page
+ * of memory (counting a page as watched if an access starting on it can
+ * reach a watched byte) so loads and stores elsewhere needn't look any
+ * further. A handler that touches a watched byte returns WATCH_HIT and
+ * leaves which watchpoint it was in watchHit.
+ */
+#define WATCH_HIT	(3)
+
+static int chkWatch(Asap_t *asap, uint32_t addr, int len, uint8_t type)
+{
+	const BreakPoint_t *bp;
+	int ii;
+	
+	for ( ii = 0, bp = asap->breaks; ii < asap->numBreaks; ++ii, ++bp )
 	{
-		if ( ans < asap->memLen || ans > asap->memLen + asap->stackSize )
+		if ( bp->enabled && (bp->type&type) && addr <= bp->end && addr+len-1 >= bp->addr )
 		{
-			snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of STACK range of memory %08X-%08X\n",
-					 ans, asap->memLen, asap->memLen + asap->stackSize);
+			asap->watchHit = bp->num;
+			asap->watchAddr = addr;
+			asap->watchType = type;
+			return WATCH_HIT;
 		}
 	}
-	return ans;
+	return 0;
+}
+
+/* Wait states and watchpoints of a load or store. addr has already been
+   checked against the top of memory */
+template <uint8_t Type, int ShiftCnt>
+static inline int memAccess(Asap_t *asap, uint32_t addr)
+{
+	if ( asap->waitPages )
+		asap->cycles += asap->waitPages[addr>>WAIT_SHIFT];
+	if ( !asap->watchPages || !(asap->watchPages[addr>>WATCH_SHIFT]&Type) )
+		return 0;
+	return chkWatch(asap,addr,1<<ShiftCnt,Type);
+}
+
+/* The ROM or device region of a load or store (IO_READ or IO_WRITE) at
+   addr, NULL if it's to plain memory */
+static inline const IoRegion_t *ioRegion(Asap_t *asap, uint32_t addr, uint8_t type)
+{
+	if ( !asap->numRegions )
+		return NULL;
+	if (    addr <= asap->memSize
+		 && !(asap->ioPages && (asap->ioPages[addr>>IO_SHIFT]&type)) )
+		return NULL;
+	return findRegion(asap,addr);
+}
+
+template <int ShiftCnt>
+static inline uint32_t memRead(const uint8_t *ptr)
+{
+	if ( ShiftCnt == 2 )
+		return *(const uint32_t *)ptr;
+	if ( ShiftCnt == 1 )
+		return *(const uint16_t *)ptr;
+	return *ptr;
+}
+
+template <int ShiftCnt>
+static inline void memWrite(uint8_t *ptr, uint32_t value)
+{
+	if ( ShiftCnt == 2 )
+		*(uint32_t *)ptr = value;
+	else if ( ShiftCnt == 1 )
+		*(uint16_t *)ptr = value;
+	else
+		*ptr = value;
+}
+
+/* Finish for LEA, LEAS, the loads and the stores. Loads and LEAs have a
+   dst register to set, stores don't. */
+template <int ShiftCnt, bool CC, bool HasDst>
+static int commonLSOut(Asap_t *asap, const Decode_t *dp, int64_t bDst)
+{
+	if ( CC )
+		lazyStatus(asap,NEGATIVE|ZERO,bDst,0,0,ShiftCnt);
+	asap->result = bDst;
+	asap->trace.result = asap->result;
+	if ( HasDst && dp->dstReg )
+		asap->registers[dp->dstReg] = asap->result;
+	if ( asap->errorMsg[0] )
+		return 1;
+	return 0;
 }
 
-static void commonAluOut(Asap_t *asap, const char *opc, const char *oper )
+/*
+ * The following produce the text of the trace from the Trace_t record
+ * executeInstruction() leaves behind. None of it is done unless the text
+ * is actually going to be shown. It is always shown before the next
+ * instruction executes, so the status is what the instruction left.
+ */
+
+static void showAluText(Asap_t *asap, const Trace_t *trc, const char *opc, const char *oper)
 {
-	int src2 = asap->src2;
-	if ( asap->affectStatus )
-		setStatus(asap,2);
-	asap->result = asap->bDst & 0xFFFFFFFF;
+	int dstReg = (trc->instruction>>22)&0x1F;
+	int src1Reg = (trc->instruction>>16)&0x1F;
+	int src2 = trc->instruction&0xFFFF;
+	bool affectStatus = (trc->instruction&(1<<21)) ? true : false;
+
 	if ( src2 >= 0xFFE0 )
 	{
 		src2 -= 0xFFE0;
 		asap->showTextLen += snprintf(
 			asap->showText+asap->showTextLen,
 			sizeof(asap->showText)-asap->showTextLen,
-			"%s%s %s,%s,%s ; dst gets %08X = %08lX %s %08X%s\n",
+			"%s%s %s,%s,%s ; dst gets %08X = %08X %s %08X%s\n",
 			   opc,
-			   asap->affectStatus ? ".C":"", 
-			   mkRegName(asap, 0, asap->dstReg),
-			   mkRegName(asap, 1, asap->src1Reg),
+			   affectStatus ? ".C":"", 
+			   mkRegName(asap, 0, dstReg),
+			   mkRegName(asap, 1, src1Reg),
 			   mkRegName(asap, 2, src2),
-			   asap->result,
-			   asap->bSrc1&0xFFFFFFFF,
+			   trc->result,
+			   trc->src1,
 			   oper,
-			   asap->registers[src2],
-			   mkStsTxt(asap,asap->affectStatus)
+			   trc->src2,
+			   mkStsTxt(asap,affectStatus)
 			   );
 	}
 	else
@@ -233,111 +447,70 @@ static void commonAluOut(Asap_t *asap, const char *opc, const char *oper )
 		asap->showTextLen += snprintf(
 			asap->showText+asap->showTextLen,
 			sizeof(asap->showText)-asap->showTextLen,
-			"%s%s %s,%s,%d (%04X) ; dst gets %08X = %08lX %s %08X%s\n",
+			"%s%s %s,%s,%d (%04X) ; dst gets %08X = %08X %s %08X%s\n",
 			   opc,
-			   asap->affectStatus ? ".C":"", 
-			   mkRegName(asap, 0, asap->dstReg),
-			   mkRegName(asap, 1, asap->src1Reg),
+			   affectStatus ? ".C":"", 
+			   mkRegName(asap, 0, dstReg),
+			   mkRegName(asap, 1, src1Reg),
 			   src2,
 			   src2&0xFFFF,
-			   asap->result,
-			   asap->bSrc1&0xFFFFFFFF,
+			   trc->result,
+			   trc->src1,
 			   oper,
 			   src2,
-			   mkStsTxt(asap,asap->affectStatus)
+			   mkStsTxt(asap,affectStatus)
 			   );
 	}
-	if ( asap->dstReg )
-		asap->registers[asap->dstReg] = asap->result;
-}
-
-/* mult is 0, 1 or 2 for byte, short or long */
-/* Finish for LEA and LEAS */
-static int commonLDSOut(Asap_t *asap, int shiftCnt)
-{
-	//                           0  1  2 
-	static const int Numbs[] = { 2, 4, 8 };
-	uint32_t res = asap->result&BitMasks[shiftCnt].mask;
-	const HashEntry_t *he = shiftCnt == 2 ? findHash(asap,res) : NULL;
-	
-	if ( asap->affectStatus )
-		setStatus(asap,shiftCnt);
-	asap->showTextLen += snprintf(
-		asap->showText+asap->showTextLen,
-		sizeof(asap->showText)-asap->showTextLen,
-		"; dst gets %0*X = %08X+%08X%s  %s\n",
-		   Numbs[shiftCnt],
-		   res,
-		   asap->registers[asap->src1Reg],
-		   (asap->src2 >= 0xFFE0 ? asap->registers[asap->src2-0xFFE0]:asap->src2)*(1<<shiftCnt),
-		   mkStsTxt(asap,asap->affectStatus),
-           he ? he->name : ""
-		   );
-	if ( asap->dstReg )
-		asap->registers[asap->dstReg] = asap->result;
-	if ( asap->errorMsg[0] )
-		return 1;
-	return 0;
 }
 
-/* shiftCnt is 0, 1 or 2 for byte, short or long */
-/* Finish for LD, LDS and LDB */
-static int commonLDIndOut(Asap_t *asap, uint32_t memIdx, int shiftCnt)
+static void showSubrText(Asap_t *asap, const Trace_t *trc)
 {
-	//                           0  1  2 
-	static const int Numbs[] = { 2, 4, 8 };
-	uint32_t res = asap->result&BitMasks[shiftCnt].mask;
-	const HashEntry_t *he = shiftCnt == 2 ? findHash(asap,memIdx) : NULL;
+	int dstReg = (trc->instruction>>22)&0x1F;
+	int src1Reg = (trc->instruction>>16)&0x1F;
+	int src2 = trc->instruction&0xFFFF;
+	bool affectStatus = (trc->instruction&(1<<21)) ? true : false;
 
-	if ( asap->affectStatus )
-		setStatus(asap,shiftCnt);
-	asap->showTextLen += snprintf(
-		asap->showText+asap->showTextLen,
-		sizeof(asap->showText)-asap->showTextLen,
-		"; dst gets %0*X @%08X=%08X+%08X%s  %s\n",
-		   Numbs[shiftCnt],
-		   res,
-		   memIdx,
-		   asap->registers[asap->src1Reg],
-		   (asap->src2 >= 0xFFE0 ? asap->registers[asap->src2-0xFFE0] : asap->src2)*(1<<shiftCnt),
-		   mkStsTxt(asap,asap->affectStatus),
-		   he ? he->name : ""
-		   );
-	if ( asap->dstReg )
-		asap->registers[asap->dstReg] = asap->result;
-	if ( asap->errorMsg[0] )
-		return 1;
-	return 0;
+	if ( src2 >= 0xFFE0 )
+	{
+		src2 -= 0xFFE0;
+		asap->showTextLen += snprintf(
+			asap->showText+asap->showTextLen,
+			sizeof(asap->showText)-asap->showTextLen,
+			"SUBR%s %s,%s,%s ; dst gets %08X <- %08X-%08X%s\n",
+			   affectStatus ? ".C":"",
+			   mkRegName(asap,0,dstReg),
+			   mkRegName(asap,1,src1Reg),
+			   mkRegName(asap,2,src2),
+			   trc->result,
+			   trc->src2,
+			   trc->src1,
+			   mkStsTxt(asap,affectStatus)
+			   );
+	}
+	else
+	{
+		asap->showTextLen += snprintf(
+			asap->showText+asap->showTextLen,
+			sizeof(asap->showText)-asap->showTextLen,
+			"SUBR%s %s,%s,%d (%X) ; dst gets %08X <- %08X-%08X%s\n",
+			   affectStatus ? ".C":"", 
+			   mkRegName(asap,0,dstReg),
+			   mkRegName(asap,1,src1Reg),
+			   src2,
+			   src2,
+			   trc->result,
+			   src2,
+			   trc->src1,
+			   mkStsTxt(asap,affectStatus)
+			   );
+	}
 }
 
-static int commonSTIndOut(Asap_t *asap, uint32_t memIdx, int shiftCnt)
+static void mkInstText(Asap_t *asap, const Trace_t *trc, const char *opc, int mult)
 {
-	//                           0  1  2
-	static const int Numbs[] = { 2, 4, 8 };
-	uint32_t res = asap->result&BitMasks[shiftCnt].mask;
-	const HashEntry_t *he = shiftCnt == 2 ? findHash(asap,memIdx) : NULL;
-
-	if ( asap->affectStatus )
-		setStatus(asap,shiftCnt);
-	asap->showTextLen += snprintf(
-		asap->showText+asap->showTextLen,
-		sizeof(asap->showText)-asap->showTextLen,
-		"; %0*X -> @%08X=%08X+%08X%s  %s\n",
-		   Numbs[shiftCnt],
-		   res,
-		   memIdx,
-		   asap->registers[asap->src1Reg],
-		   (asap->src2 >= 0xFFE0 ? asap->registers[asap->src2-0xFFE0] : asap->src2)*(1<<shiftCnt),
-		   mkStsTxt(asap,asap->affectStatus),
-		   he ? he->name : ""
-		   );
-	if ( asap->errorMsg[0] )
-		return 1;
-	return 0;
-}
+	uint32_t instruction = trc->instruction;
+	bool affectStatus = (instruction&(1<<21)) ? true : false;
 
-static void mkInstText(Asap_t *asap, uint32_t instruction, const char *opc, int mult)
-{
 	if ( (instruction&0xFFFF) >= 0xFFE0 )
 	{
 		asap->showTextLen += snprintf(
@@ -345,9 +518,9 @@ static void mkInstText(Asap_t *asap, uint32_t instruction, const char *opc, int
 			sizeof(asap->showText)-asap->showTextLen,
 			"%s%s %s, %s[%s]",
 			opc,
-			asap->affectStatus ? ".C":"",
-			mkRegName(asap,0,asap->dstReg),
-			mkRegName(asap,1, asap->src1Reg),
+			affectStatus ? ".C":"",
+			mkRegName(asap,0,(instruction>>22)&0x1F),
+			mkRegName(asap,1,(instruction>>16)&0x1F),
 			mkRegName(asap,2,(instruction&0xFFFF)-0xFFE0)
 		    );
 	}
@@ -358,105 +531,379 @@ static void mkInstText(Asap_t *asap, uint32_t instruction, const char *opc, int
 				sizeof(asap->showText)-asap->showTextLen,
 				"%s%s %s, %s[%d (%04X)]",
 				opc,
-				   asap->affectStatus ? ".C":"",
-				   mkRegName(asap,0,asap->dstReg),
-				   mkRegName(asap,1,asap->src1Reg),
+				   affectStatus ? ".C":"",
+				   mkRegName(asap,0,(instruction>>22)&0x1F),
+				   mkRegName(asap,1,(instruction>>16)&0x1F),
 				   (instruction & 0xFFFF) * mult,
 				   (instruction & 0xFFFF)
 				);
 	}
 }
 
-#if 0
-static uint32_t getFileNo(const char *title, Asap_t *asap, int reg)
+/* shiftCnt is 0, 1 or 2 for byte, short or long */
+static void showLSText(Asap_t *asap, const Trace_t *trc, int opcode, int shiftCnt)
 {
-	uint32_t ptr;
-	ptr = asap->registers[reg];
-	if ( ptr > asap->memLen + asap->stackSize )
-	{
-		snprintf(asap->errorMsg, sizeof(asap->errorMsg),
-				 "%s pointer of 0x%08X is out of range of 0x00000000-0x%08X",
-				 title, ptr, asap->memLen + asap->stackSize-1 );
-		return 0;
-	}
-	return *(uint32_t *)(asap->mem+ptr);
-}
-#endif
+	//                           0  1  2 
+	static const int Numbs[] = { 2, 4, 8 };
+	uint32_t res = trc->result&BitMasks[shiftCnt].mask;
+	bool affectStatus = (trc->instruction&(1<<21)) ? true : false;
+	const HashEntry_t *he;
 
-char *getStrPtr(const char *title, Asap_t *asap, int reg)
-{
-	uint32_t ptr;
-	ptr = asap->registers[reg];
-	if ( ptr > asap->memLen + asap->stackSize )
+	mkInstText(asap,trc,OpTexts[opcode].opc,1<<shiftCnt);
+	if ( opcode == 3 || opcode == 4 )
 	{
-		snprintf(asap->errorMsg, sizeof(asap->errorMsg), "%s pointer of 0x%08X is out of range of 0x00000000-0x%08X",
-				 title, ptr, asap->memLen + asap->stackSize-1 );
-		return 0;
+		/* LEA and LEAS */
+		he = shiftCnt == 2 ? findHash(asap,res) : NULL;
+		asap->showTextLen += snprintf(
+			asap->showText+asap->showTextLen,
+			sizeof(asap->showText)-asap->showTextLen,
+			"; dst gets %0*X = %08X+%08X%s  %s\n",
+			   Numbs[shiftCnt],
+			   res,
+			   trc->src1,
+			   trc->src2*(1<<shiftCnt),
+			   mkStsTxt(asap,affectStatus),
+			   he ? he->name : ""
+			   );
+		return;
 	}
-	return (char *)(asap->mem+ptr);
+	he = shiftCnt == 2 ? findHash(asap,trc->ea) : NULL;
+	asap->showTextLen += snprintf(
+		asap->showText+asap->showTextLen,
+		sizeof(asap->showText)-asap->showTextLen,
+		(opcode == 0x13 || opcode == 0x14 || opcode == 0x17) ?
+			"; %0*X -> @%08X=%08X+%08X%s  %s\n" :
+			"; dst gets %0*X @%08X=%08X+%08X%s  %s\n",
+		   Numbs[shiftCnt],
+		   res,
+		   trc->ea,
+		   trc->src1,
+		   trc->src2*(1<<shiftCnt),
+		   mkStsTxt(asap,affectStatus),
+		   he ? he->name : ""
+		   );
 }
 
-static int doSyscall(Asap_t *asap, int call)
+#define SYM_OFFSET_WIDTH	(6)		/* room in the trace for a +0xNNN after the name */
+
+const char *mkShowText(Asap_t *asap)
 {
-	FILE *fp;
-	int len, fno, sts;
-	char *strPtr;
+	const Trace_t *trc = &asap->trace;
+	const HashEntry_t *he;
+	const StbSeg_t *seg;
+	uint32_t instruction = trc->instruction;
+	int opcode, dstReg, src2, brOffset;
 	
-	if ( asap->verbose )
-		printf("%s\n", asap->showText);
-	if ( asap->numHashes )
+	if ( (trc->flags&TRC_TEXT) )
+		return asap->showText;
+	asap->trace.flags |= TRC_TEXT;
+	getStatus(asap);
+	if ( asap->numSyms )
 	{
+		char header[64];
+		header[0] = 0;
+		he = findNearest(asap,trc->pc);
+		if ( he && he->value == trc->pc )
+			snprintf(header,sizeof(header),"%s:",he->name);
+		else if ( he )
+			snprintf(header,sizeof(header),"%s+0x%X:",he->name,trc->pc - he->value);
+		else if ( (seg = findSegment(asap,trc->pc)) && seg->name[0] )
+			snprintf(header,sizeof(header),"%s+0x%X:",seg->name,trc->pc - seg->base);
 		asap->showTextLen = snprintf(
 					asap->showText,
 					sizeof(asap->showText),
-					"%-*.*s                      ",
-					asap->longestName,
-					asap->longestName,
-					" ");
+					"%-*.*s %08X: %08X - ",
+					asap->longestName+SYM_OFFSET_WIDTH,
+					asap->longestName+SYM_OFFSET_WIDTH,
+					header,
+					trc->pc,
+					instruction);
 	}
 	else
 	{
-		strncpy( asap->showText,
-				 "                     ",
-				 sizeof(asap->showText));
-		asap->showTextLen = strlen(asap->showText);
+		asap->showTextLen = snprintf(
+					asap->showText,
+					sizeof(asap->showText),
+					"%08X: %08X - ",
+					trc->pc,
+					instruction);
 	}
-	asap->showTextLen += snprintf(
-		asap->showText+asap->showTextLen,
-		sizeof(asap->showText)-asap->showTextLen,
-		"SYSCALL %d; %s\n", call, mkStsTxt(asap,true));
-	switch (call)
+	opcode = (instruction >> 27)&0x1F;
+	dstReg = (instruction>>22)&0x1F;
+	src2 = instruction&0xFFFF;
+	brOffset = instruction & ((1 << 22) - 1);
+	if ( (brOffset&(1<<21)) )
+		brOffset |= 0xFFC00000;
+	brOffset *= 4;
+	switch (opcode)
 	{
 	default:
-	case SYSCALL_EXIT:
+	case 0:
+	case 0x1F:
 		asap->showTextLen += snprintf(
 			asap->showText+asap->showTextLen,
 			sizeof(asap->showText)-asap->showTextLen,
-			"SYSCALL_EXIT(%d): Terminated.\n", asap->registers[1]);
-		break;
-	case SYSCALL_FFLUSH:
-		fno = asap->registers[1];
-		if ( asap->verbose )
+			"Illegal opcode. r30 <- %08X, r31 <- %08X, %s"
+			,trc->pc
+			,trc->ea
+			,mkStsTxt(asap,true)
+			);
+		if ( (trc->flags&TRC_TERMINATED) )
 		{
 			asap->showTextLen += snprintf(
 				asap->showText+asap->showTextLen,
 				sizeof(asap->showText)-asap->showTextLen,
-				"fflush(%d).\n", fno);
+				"Terminated.\n");
 		}
-		else
+		if ( (trc->flags&TRC_TRAPPED) )
 		{
-			fp = NULL;
-			if ( fno == 1 )
-				fp = stdout;
-			else if ( fno == 2 )
-				fp = stderr;
-			if ( fp )
-			{
-				sts = fflush(fp);
-				asap->registers[1] = sts;
-				if ( asap->errnoPtr )
-					*asap->errnoPtr = errno;
-			}
+			asap->showTextLen += snprintf(
+				asap->showText+asap->showTextLen,
+				sizeof(asap->showText)-asap->showTextLen,
+				"Trap to %08X.\n", opcode ? SYS_VCT : ILL_VCT);
+		}
+		break;
+	case 1:
+		if ( dstReg >= 16 )
+		{
+			asap->showTextLen += snprintf(
+				asap->showText+asap->showTextLen,
+				sizeof(asap->showText)-asap->showTextLen,
+				"%s. Terminated.", "Illegal branch");
+			break;
+		}
+		asap->showTextLen += snprintf(
+			asap->showText+asap->showTextLen,
+			sizeof(asap->showText)-asap->showTextLen,
+			"%s %+d (%06X) ;%s branch to %08X, %s\n",
+			   BranchNames[dstReg],
+			   brOffset,
+			   instruction&0x3FFFFF,
+			   mkStsTxt(asap,true),
+			   trc->pc+brOffset,
+			   (trc->flags&TRC_TAKEN) ? " Taken":" Not taken");
+		break;
+	case 2:
+		he = findHash(asap,trc->ea);
+		if ( dstReg == 0 )
+		{
+			asap->showTextLen += snprintf(
+				asap->showText+asap->showTextLen,
+				sizeof(asap->showText)-asap->showTextLen,
+				"BRA %+d (%06X) (branch to %08X)  %s\n",
+				brOffset,
+				instruction&0x3FFFFF,
+				trc->ea,
+				he ? he->name:"");
+		}
+		else
+		{
+			asap->showTextLen += snprintf(
+				asap->showText+asap->showTextLen,
+				sizeof(asap->showText)-asap->showTextLen,
+				"BSR %s,%+d (%06X) ; dst gets %08X, branch to %08X  %s\n",
+				   mkRegName(asap,0,dstReg),
+				   brOffset,
+				   instruction&0x3FFFFF,
+				   trc->pc + BSR_INC,
+				   trc->ea,
+				   he ? he->name : "");
+		}
+		break;
+	case 3:
+	case 4:
+	case 0x10:
+	case 0x11:
+	case 0x12:
+	case 0x13:
+	case 0x14:
+	case 0x15:
+	case 0x16:
+	case 0x17:
+		showLSText(asap,trc,opcode,OpTexts[opcode].shiftCnt);
+		break;
+	case 5:
+		showSubrText(asap,trc);
+		break;
+	case 6:
+	case 7:
+	case 8:
+	case 9:
+	case 0x0A:
+	case 0x0B:
+	case 0x0C:
+	case 0x0D:
+	case 0x0E:
+	case 0x0F:
+	case 0x18:
+	case 0x19:
+	case 0x1A:
+	case 0x1B:
+		showAluText(asap,trc,OpTexts[opcode].opc,OpTexts[opcode].oper);
+		break;
+	case 0x1C:
+		asap->showTextLen += snprintf(
+			asap->showText+asap->showTextLen,
+			sizeof(asap->showText)-asap->showTextLen,
+			"GETPS %s  ; dst gets %02X%s\n",
+			mkRegName(asap,0,dstReg),
+			asap->status&0x3F,
+			mkStsTxt(asap,true));
+		break;
+	case 0x1D:
+		if ( src2 >= 0xFFE0 )
+		{
+			asap->showTextLen += snprintf(
+				asap->showText+asap->showTextLen,
+				sizeof(asap->showText)-asap->showTextLen,
+			    "PUTPS %s  ; PS gets %02X%s",
+				mkRegName(asap,0,dstReg),
+				asap->status,
+				mkStsTxt(asap,true));
+		}
+		else
+		{
+			asap->showTextLen += snprintf(
+				asap->showText+asap->showTextLen,
+				sizeof(asap->showText)-asap->showTextLen,
+			    "PUTPS %d    ; PS gets %02X%s\n",
+				src2,
+				src2&0x3F,
+				mkStsTxt(asap,true));
+		}
+		break;
+	case 0x1E:
+		mkInstText(asap,trc,"JSR",4);
+		he = findHash(asap,trc->ea);
+		asap->showTextLen += snprintf(
+			asap->showText+asap->showTextLen,
+			sizeof(asap->showText)-asap->showTextLen,
+			"; dst gets %08X, jump to %08X%s  %s\n",
+			   trc->pc+BSR_INC,
+			   trc->ea,
+			   mkStsTxt(asap,(instruction&(1<<21)) ? true : false),
+			   he ? he->name : ""
+			   );
+		break;
+	}
+	return asap->showText;
+}
+
+/* Forget any predecoded instructions in the len bytes written at addr (and note them for -H) */
+void codeWritten(Asap_t *asap, uint32_t addr, uint32_t len)
+{
+	uint32_t first = addr>>2, last = (addr+len-1)>>2;
+	
+	if ( asap->histDirty && !(asap->histDirty[addr>>HIST_SHIFT] && asap->histDirty[((uint64_t)addr+len-1)>>HIST_SHIFT]) )
+		historyWritten(asap,addr,len);
+	if ( first >= asap->numDecodes )
+		return;
+	if ( last >= asap->numDecodes )
+		last = asap->numDecodes-1;
+	for ( ; first <= last; ++first )
+	{
+		if ( asap->decodes[first].handler )
+		{
+			asap->decodes[first].handler = NULL;
+			asap->codeChanged = true;
+		}
+	}
+}
+
+#if 0
+static uint32_t getFileNo(const char *title, Asap_t *asap, int reg)
+{
+	uint32_t ptr;
+	ptr = asap->registers[reg];
+	if ( ptr > asap->memSize )
+	{
+		snprintf(asap->errorMsg, sizeof(asap->errorMsg),
+				 "%s pointer of 0x%08X is out of range of 0x00000000-0x%08llX",
+				 title, ptr, (unsigned long long)asap->memSize-1 );
+		return 0;
+	}
+	return *(uint32_t *)(asap->mem+ptr);
+}
+#endif
+
+char *getStrPtr(const char *title, Asap_t *asap, int reg)
+{
+	uint32_t ptr;
+	ptr = asap->registers[reg];
+	if ( ptr > asap->memSize )
+	{
+		snprintf(asap->errorMsg, sizeof(asap->errorMsg), "%s pointer of 0x%08X is out of range of 0x00000000-0x%08llX",
+				 title, ptr, (unsigned long long)asap->memSize-1 );
+		return 0;
+	}
+	return (char *)(asap->mem+ptr);
+}
+
+static int doSyscall(Asap_t *asap, int call)
+{
+	FILE *fp;
+	int len, fno, sts;
+	char *strPtr;
+	
+	if ( asap->verbose )
+		fprintf(asap->fout,"%s\n", mkShowText(asap));
+	/* The syscall replaces the instruction's trace with its own text */
+	asap->trace.flags |= TRC_TEXT;
+	if ( asap->numSyms )
+	{
+		asap->showTextLen = snprintf(
+					asap->showText,
+					sizeof(asap->showText),
+					"%-*.*s                      ",
+					asap->longestName+SYM_OFFSET_WIDTH,
+					asap->longestName+SYM_OFFSET_WIDTH,
+					" ");
+	}
+	else
+	{
+		strncpy( asap->showText,
+				 "                     ",
+				 sizeof(asap->showText));
+		asap->showTextLen = strlen(asap->showText);
+	}
+	asap->showTextLen += snprintf(
+		asap->showText+asap->showTextLen,
+		sizeof(asap->showText)-asap->showTextLen,
+		"SYSCALL %d; %s\n", call, mkStsTxt(asap,true));
+	switch (call)
+	{
+	default:
+	case SYSCALL_EXIT:
+		asap->showTextLen += snprintf(
+			asap->showText+asap->showTextLen,
+			sizeof(asap->showText)-asap->showTextLen,
+			"SYSCALL_EXIT(%d): Terminated.\n", asap->registers[1]);
+		if ( call == SYSCALL_EXIT )
+			asap->exitStatus = asap->registers[1];
+		break;
+	case SYSCALL_FFLUSH:
+		fno = asap->registers[1];
+		if ( asap->verbose )
+		{
+			asap->showTextLen += snprintf(
+				asap->showText+asap->showTextLen,
+				sizeof(asap->showText)-asap->showTextLen,
+				"fflush(%d).\n", fno);
+		}
+		else
+		{
+			fp = NULL;
+			if ( fno == 1 )
+				fp = asap->fout;
+			else if ( fno == 2 )
+				fp = asap->ferr;
+			if ( fp )
+			{
+				sts = fflush(fp);
+				asap->registers[1] = sts;
+				if ( asap->errnoPtr )
+					*asap->errnoPtr = errno;
+			}
 			else
 			{
 				asap->registers[1] = -1;
@@ -480,9 +927,9 @@ static int doSyscall(Asap_t *asap, int call)
 		{
 			fp = NULL;
 			if ( fno == 1 )
-				fp = stdout;
+				fp = asap->fout;
 			else if ( fno == 2 )
-				fp = stderr;
+				fp = asap->ferr;
 			if ( fp )
 			{
 				sts = fputs(strPtr, fp);
@@ -513,14 +960,16 @@ static int doSyscall(Asap_t *asap, int call)
 				fno,
 				fno ? "Not stdin. Ignored.":"Enter line of text:"
 				);
-			fputs(asap->showText,stdout);
+			fputs(asap->showText,asap->fout);
 			asap->showText[0] = 0;
 			asap->showTextLen = 0;
 		}
 		if ( fno == 0 )
 		{
-			fflush(stdout);
-			if ( !fgets(strPtr,len,stdin) )
+			fflush(asap->fout);
+			if ( len > 0 )
+				codeWritten(asap,strPtr-(char *)asap->mem,len);
+			if ( !inputLine(asap,strPtr,len) )
 			{
 				asap->registers[1] = 0;
 				if ( asap->errnoPtr )
@@ -552,9 +1001,9 @@ static int doSyscall(Asap_t *asap, int call)
 		{
 			fp = NULL;
 			if ( fno == 1 )
-				fp = stdout;
+				fp = asap->fout;
 			else if ( fno == 2 )
-				fp = stderr;
+				fp = asap->ferr;
 			if ( fp )
 			{
 				sts = fputc(len,fp);
@@ -581,13 +1030,13 @@ static int doSyscall(Asap_t *asap, int call)
 				fno,
 				fno ? "Not stdin. Ignored.":"Enter a character:"
 				);
-		    fputs(asap->showText,stdout);
+		    fputs(asap->showText,asap->fout);
 			asap->showText[0] = 0;
 			asap->showTextLen = 0;
 		}
 		if ( fno == 0 )
 		{
-			sts = fgetc(stdin);
+			sts = inputChar(asap,INPUT_FGETC);
 			asap->registers[1] = sts;
 			if ( asap->errnoPtr )
 				*asap->errnoPtr = errno;
@@ -603,516 +1052,1164 @@ static int doSyscall(Asap_t *asap, int call)
 	return 1;
 }
 
-static int executeInstruction(Asap_t *asap)
+/*
+ * Instruction handlers. Each is handed the predecoded instruction and
+ * returns non-zero if the simulation cannot continue.
+ */
+
+static int opIllegal(Asap_t *asap, const Decode_t *dp)
 {
-	int opcode, reg;
-	int brOffset, condition;
+	uint32_t status;
+	int reg;
 	uint16_t src2;
-	uint32_t instruction, memIdx;
-	uint32_t *mem; 
-	const HashEntry_t *he;
 	
-	mem = (uint32_t *)(asap->mem+asap->pcQue[0]);
-	instruction = *mem;
-	opcode = (instruction >> 27)&0x1F;
-	asap->dstReg = (instruction>>22)&0x1F;
-	asap->src1Reg = (instruction>>16)&0x1F;
-	asap->src2 = (instruction&0xFFFF);
-	asap->bDst = 0;
-	asap->result = 0;
-	asap->affectStatus = (instruction&(1<<21)) ? true : false;
-	asap->errorMsg[0] = 0;
-	if ( asap->numHashes )
-	{
-		char header[36];
-		header[0] = 0;
-		he = findHash(asap,asap->pcQue[0]);
-		if ( he )
-			snprintf(header,sizeof(header),"%s:",he->name);
-		asap->showTextLen = snprintf(
-					asap->showText,
-					sizeof(asap->showText),
-					"%-*.*s %08X: %08X - ",
-					asap->longestName,
-					asap->longestName,
-					header,
-					asap->pcQue[0],
-					instruction);
-	}
-	else
+	asap->registers[30] = asap->pcQue[0];
+	asap->registers[31] = asap->pcQue[1];
+	status = getStatus(asap);
+	putStatus(asap,((status&IENABLE)<<1) | (status&0xF));
+	asap->trace.ea = asap->pcQue[1];
+	src2 = (dp->instruction&0xFFFF);
+	reg = 0;
+	if ( (src2 >= 0xFFE0) )
 	{
-		asap->showTextLen = snprintf(
-					asap->showText,
-					sizeof(asap->showText),
-					"%08X: %08X - ",
-					asap->pcQue[0],
-					instruction);
+		reg = src2 - 0xFFE0;
+		src2 = 0;
 	}
-	switch (opcode)
+	else if ( src2 < 1 || src2 > 255 )
+		src2 = 0;
+	if (    asap->traps == TRAPS_EXACT
+		 || !dp->opcode
+		 || (dp->instruction > 0xF800FFE5)
+		 || (!reg && !src2)
+		 || reg > 5
+	   )
 	{
-	default:
-	case 0:
-	case 0x1F:
-		asap->registers[30] = asap->pcQue[0];
-		asap->registers[31] = asap->pcQue[1];
-		asap->status = ((asap->status&IENABLE)<<1) | (asap->status&0xF);
-		asap->showTextLen += snprintf(
-			asap->showText+asap->showTextLen,
-			sizeof(asap->showText)-asap->showTextLen,
-			"Illegal opcode. r30 <- %08X, r31 <- %08X, %s"
-			,asap->registers[30]
-			,asap->registers[31]
-			,mkStsTxt(asap,true)
-			);
-		src2 = (instruction&0xFFFF);
-		reg = 0;
-		if ( (src2 >= 0xFFE0) )
-		{
-			reg = src2 - 0xFFE0;
-			src2 = 0;
-		}
-		else if ( src2 < 1 || src2 > 255 )
-			src2 = 0;
-		if (    !opcode
-			 || (instruction > 0xF800FFE5)
-			 || (!reg && !src2)
-			 || reg > 5
-		   )
+		if ( asap->traps == TRAPS_HLE )
 		{
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-				"Terminated.\n");
+			asap->trace.flags |= TRC_TERMINATED;
 			return 1;
 		}
-		if ( reg )
-			reg = asap->registers[reg];
-		else
-			reg = src2;
-		if ( doSyscall(asap, reg) )
-			return 1;
-		break;
-	case 1:
-		/* branch? */
-		condition = chkBranch(asap);
-		if ( condition == 2 )
+		/* On to the vector, the way an interrupt goes to IRQ_VCT */
+		asap->pcQue[1] = dp->opcode ? SYS_VCT : ILL_VCT;
+		asap->pcQue[2] = asap->pcQue[1]+4;
+		asap->trace.flags |= TRC_TRAPPED;
+		return 0;
+	}
+	if ( reg )
+		reg = asap->registers[reg];
+	else
+		reg = src2;
+	return doSyscall(asap, reg);
+}
+
+/* What is done for an instruction fetched from beyond the top of memory */
+static int opBadFetch(Asap_t *asap, const Decode_t *dp)
+{
+	asap->showText[0] = 0;
+	asap->showTextLen = 0;
+	asap->trace.flags |= TRC_TEXT;
+	snprintf(asap->errorMsg,sizeof(asap->errorMsg),
+			 "Instruction fetch from %08X is out of range of memory %08llX. Terminated.",
+			 asap->pcQue[0], (unsigned long long)asap->memSize);
+	return 1;
+}
+
+static int opBcc(Asap_t *asap, const Decode_t *dp)
+{
+	int condition, brOffset;
+	
+	condition = chkBranch(getStatus(asap),dp->dstReg);
+	if ( condition == 2 )
+		return 1;
+	brOffset = dp->src2;
+	asap->trace.ea = asap->pcQue[0]+brOffset;
+	if ( condition )
+	{
+		asap->trace.flags |= TRC_TAKEN;
+		if ( !asap->wholeSpace && (asap->pcQue[0] + brOffset < 0 || asap->pcQue[0] + brOffset > asap->memLen) )
 		{
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-				"%s. Terminated.", asap->msg);
+			fprintf(asap->fout,"%s\nWould have branched to %08X which is out of memory range %08X. Terminated.\n",
+				   mkShowText(asap),
+				   asap->pcQue[0] + brOffset, asap->memLen);
+			asap->showText[0] = 0;
+			asap->showTextLen = 0;
 			return 1;
 		}
-		brOffset = instruction & ((1 << 22) - 1);
-		if ( (brOffset&(1<<21)) )
-			brOffset |= 0xFFC00000;
-		brOffset *= 4;
-		asap->affectStatus = 1;	/* allow it to show status */
-		asap->showTextLen += snprintf(
-			asap->showText+asap->showTextLen,
-			sizeof(asap->showText)-asap->showTextLen,
-			"%s %+d (%06X) ;%s branch to %08X, %s\n",
-			   asap->msg,
-			   brOffset,
-			   instruction&0x3FFFFF,
-			   mkStsTxt(asap,asap->affectStatus),
-			   asap->pcQue[0]+brOffset,
-			   condition ? " Taken":" Not taken");
-		if ( condition )
-		{
-			if ( (asap->pcQue[0] + brOffset < 0 || asap->pcQue[0] + brOffset > asap->memLen) )
-			{
-				printf("%s\nWould have branched to %08X which is out of memory range %08X. Terminated.\n",
-					   asap->showText,
-					   asap->pcQue[0] + brOffset, asap->memLen);
-				asap->showText[0] = 0;
-				asap->showTextLen = 0;
-				return 1;
-			}
-			asap->pcQue[2] = asap->pcQue[0]+brOffset;
-		}
-		break;
-	case 2:
-		/* BSR and BRA */
-		brOffset = instruction & ((1 << 22) - 1);
-		if ( (brOffset&(1<<21)) )
-			brOffset |= 0xFFC00000;
-		brOffset *= 4;
 		asap->pcQue[2] = asap->pcQue[0]+brOffset;
-		he = findHash(asap,asap->pcQue[2]);
-		if ( asap->dstReg == 0 )
-		{
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-				"BRA %+d (%06X) (branch to %08X)  %s\n",
-				brOffset,
-				instruction&0x3FFFFF,
-				asap->pcQue[2],
-				he ? he->name:"");
-		}
-		else
-		{
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-				"BSR %s,%+d (%06X) ; dst gets %08X, branch to %08X  %s\n",
-				   mkRegName(asap,0,asap->dstReg),
-				   brOffset,
-				   instruction&0x3FFFFF,
-				   asap->pcQue[0] + BSR_INC,
-				   asap->pcQue[2],
-				   he ? he->name : "");
-			asap->registers[asap->dstReg] = asap->pcQue[0]+BSR_INC;
-		}
-		if ( (asap->pcQue[0]+brOffset < 0 || asap->pcQue[0]+brOffset > asap->memLen)  )
-		{
-			printf("%s\nWould have branched to %08X which is out of memory range %08X. Terminated.\n",
-				   asap->showText,
-				   asap->pcQue[0] + brOffset, asap->memLen);
-			asap->showText[0] = 0;
-			asap->showTextLen = 0;
-			return 1;
-		}
-		break;
-	case 3:
-		asap->stsMask = NEGATIVE|ZERO;
-		asap->result = getLSargs(asap,instruction,2);
-		asap->bDst = asap->result;
-		mkInstText(asap,instruction,"LEA",4);
-		if ( commonLDSOut(asap,2) )
-			return 1;
+	}
+	return 0;
+}
+
+/* BSR and BRA */
+static int opBSR(Asap_t *asap, const Decode_t *dp)
+{
+	int brOffset = dp->src2;
+	
+	asap->pcQue[2] = asap->pcQue[0]+brOffset;
+	asap->trace.ea = asap->pcQue[2];
+	if ( dp->dstReg != 0 )
+		asap->registers[dp->dstReg] = asap->pcQue[0]+BSR_INC;
+	if ( !asap->wholeSpace && (asap->pcQue[0]+brOffset < 0 || asap->pcQue[0]+brOffset > asap->memLen)  )
+	{
+		fprintf(asap->fout,"%s\nWould have branched to %08X which is out of memory range %08X. Terminated.\n",
+			   mkShowText(asap),
+			   asap->pcQue[0] + brOffset, asap->memLen);
+		asap->showText[0] = 0;
+		asap->showTextLen = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * The rest of the handlers are templates, made once for every combination
+ * of src2 register or immediate and .C (and the width and signedness of
+ * the loads and stores) the Handlers[] table below needs. Which one it is
+ * is then known at compile time rather than tested as each executes.
+ */
+template <int ShiftCnt, bool Src2Reg, bool CC>
+static int opLEA(Asap_t *asap, const Decode_t *dp)
+{
+	return commonLSOut<ShiftCnt,CC,true>(asap,dp,getLSargs<ShiftCnt,Src2Reg>(asap,dp));
+}
+
+/* The ALU instructions, Opcode 0x05 to 0x0F and 0x18 to 0x1B */
+template <int Opcode, bool Src2Reg, bool CC>
+static int opALU(Asap_t *asap, const Decode_t *dp)
+{
+	int64_t bDst, bSrc1, bSrc2;
+	uint8_t stsMask = NEGATIVE|ZERO;
+	
+	bSrc1 = asap->registers[dp->src1Reg];
+	bSrc2 = Src2Reg ? asap->registers[dp->src2] : dp->src2;
+	asap->trace.src1 = bSrc1;
+	asap->trace.src2 = bSrc2;
+	switch (Opcode)
+	{
+	case 0x05:		/* SUBR */
+		stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
+		bSrc1 = ((~bSrc1)&0xFFFFFFFF) + 1;	/* 1's compliment lower 32 bits + imagined set carry in bit */
+		bDst = bSrc2+bSrc1;		/* so overflow and carry bit set properly */
 		break;
-	case 4:
-		asap->stsMask = NEGATIVE|ZERO;
-		asap->result = getLSargs(asap,instruction,1);
-		asap->bDst = asap->result;
-		mkInstText(asap,instruction,"LEAS",2);
-		if ( commonLDSOut(asap,1) )
-			return 1;
+	case 0x06:		/* XOR */
+		bDst = bSrc1^bSrc2;
 		break;
-	case 5:
-		asap->stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bSrc1 = ((~asap->bSrc1)&0xFFFFFFFF) + 1;	/* 1's compliment lower 32 bits + imagined set carry in bit */
-		asap->bDst = asap->bSrc2+asap->bSrc1; /* so overflow and carry bit set properly */
-		if ( asap->affectStatus )
-			setStatus(asap,2);
-		asap->result = asap->bDst & 0xFFFFFFFF;
-		if ( asap->src2 >= 0xFFE0 )
-		{
-			asap->src2 -= 0xFFE0;
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-				"SUBR%s %s,%s,%s ; dst gets %08X <- %08X-%08X%s\n",
-				   asap->affectStatus ? ".C":"",
-				   mkRegName(asap,0,asap->dstReg),
-				   mkRegName(asap,1,asap->src1Reg),
-				   mkRegName(asap,2,asap->src2),
-				   asap->result,
-				   asap->registers[asap->src2],
-				   asap->registers[asap->src1Reg],
-				   mkStsTxt(asap,asap->affectStatus)
-				   );
-		}
-		else
-		{
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-				"SUBR%s %s,%s,%d (%X) ; dst gets %08X <- %08X-%08X%s\n",
-				   asap->affectStatus ? ".C":"", 
-				   mkRegName(asap,0,asap->dstReg),
-				   mkRegName(asap,1,asap->src1Reg),
-				   asap->src2,
-				   asap->src2,
-				   asap->result,
-				   asap->src2,
-				   asap->registers[asap->src1Reg],
-				   mkStsTxt(asap,asap->affectStatus)
-				   );
-		}
-		if (asap->dstReg )
-			asap->registers[asap->dstReg] = asap->result;
+	case 0x07:		/* XORN */
+		bDst = bSrc1^~bSrc2;
 		break;
-	case 6:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1^asap->bSrc2;
-		commonAluOut(asap,"XOR","^");
+	case 0x08:		/* ADD */
+		stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
+		bDst = bSrc1+bSrc2;
 		break;
-	case 7:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1^~asap->bSrc2;
-		commonAluOut(asap,"XORN","^~");
+	case 0x09:		/* SUB */
+		stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
+		bSrc2 = ((~bSrc2)&0xFFFFFFFF)+1;	/* 1's compliment lower 32 bits + imagined set carry in */
+		bDst = bSrc1+bSrc2;
 		break;
-	case 8:
-		asap->stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1+asap->bSrc2;
-		commonAluOut(asap,"ADD","+");
+	case 0x0A:		/* ADDC */
+		stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
+		bDst = bSrc1+bSrc2+(getStatus(asap)&CARRY);
 		break;
-	case 9:
-		asap->stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bSrc2 = ((~asap->bSrc2)&0xFFFFFFFF)+1; /* 1's compliment lower 32 bits + imagined set carry in */
-		asap->bDst = asap->bSrc1+asap->bSrc2;
-		commonAluOut(asap,"SUB","-");
+	case 0x0B:		/* SUBC */
+		stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
+		bSrc2 = ((~bSrc2)&0xFFFFFFFF)+(getStatus(asap)&CARRY);	/* 1's compliment lower 32 bits + carry bit from PS */
+		bDst = bSrc1+bSrc2;
 		break;
-	case 0x0A:
-		asap->stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1+asap->bSrc2+(asap->status&CARRY);
-		commonAluOut(asap,"ADDC","+");
+	case 0x0C:		/* AND */
+		bDst = bSrc1&bSrc2;
 		break;
-	case 0x0B:
-		asap->stsMask = CARRY|OVERFLOW|NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bSrc2 = ((~asap->bSrc2)&0xFFFFFFFF)+(asap->status&CARRY); /* 1's compliment lower 32 bits + carry bit from PS */
-		asap->bDst = asap->bSrc1+asap->bSrc2;
-		commonAluOut(asap,"SUBC","-");
+	case 0x0D:		/* ANDN */
+		bDst = bSrc1&~bSrc2;
 		break;
-	case 0x0C:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1&asap->bSrc2;
-		commonAluOut(asap,"AND","&");
+	case 0x0E:		/* OR */
+	case 0x0F:		/* NOTE: ORN has always done a plain OR here */
+		bDst = bSrc1|bSrc2;
 		break;
-	case 0x0D:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1&~asap->bSrc2;
-		commonAluOut(asap,"ANDN","&~");
+	case 0x18:		/* ASHR */
+	case 0x19:		/* LSHR */
+		bDst = bSrc1 >> bSrc2;
 		break;
-	case 0x0E:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1|asap->bSrc2;
-		commonAluOut(asap,"OR","|");
+	case 0x1A:		/* SHL */
+		bDst = bSrc1 << bSrc2;
 		break;
-	case 0x0F:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1|asap->bSrc2;
-		commonAluOut(asap,"ORN","|~");
+	case 0x1B:		/* ROTL */
+		bDst = bSrc1 << bSrc2;
+		bDst |= bDst>>32;
 		break;
-	case 0x10:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,2);
-		mkInstText(asap,instruction,"LD",4);
-		if ( !asap->errorMsg[0] )
+	}
+	if ( CC )
+		lazyStatus(asap,stsMask,bDst,bSrc1,bSrc2,2);
+	asap->result = bDst & 0xFFFFFFFF;
+	asap->trace.result = asap->result;
+	if ( dp->dstReg )
+		asap->registers[dp->dstReg] = asap->result;
+	return 0;
+}
+
+/* LD, LDS, LDUS, LDB and LDUB */
+template <int ShiftCnt, bool Signed, bool Src2Reg, bool CC>
+static int opLoad(Asap_t *asap, const Decode_t *dp)
+{
+	uint32_t memIdx;
+	int64_t bDst = 0;
+	int watched = 0;
+	const IoRegion_t *rp;
+	
+	memIdx = getLSargs<ShiftCnt,Src2Reg>(asap,dp);
+	if ( !asap->errorMsg[0] && (rp = ioRegion(asap,memIdx,IO_READ)) && rp->read )
+	{
+		bDst = rp->read(asap,rp->arg,memIdx,ShiftCnt) & BitMasks[ShiftCnt].mask;
+		if ( memIdx <= asap->memSize )
+			watched = memAccess<BRK_READ,ShiftCnt>(asap,memIdx);
+	}
+	else if ( !asap->errorMsg[0] && chkMemIdx(asap,memIdx) )
+	{
+		bDst = memRead<ShiftCnt>(asap->mem + memIdx);
+		watched = memAccess<BRK_READ,ShiftCnt>(asap,memIdx);
+	}
+	if ( Signed && (bDst&BitMasks[ShiftCnt].bit) )
+		bDst |= ~BitMasks[ShiftCnt].mask;
+	if ( commonLSOut<ShiftCnt,CC,true>(asap,dp,bDst) )
+		return 1;
+	return watched;
+}
+
+/* ST, STS and STB */
+template <int ShiftCnt, bool Src2Reg, bool CC>
+static int opStore(Asap_t *asap, const Decode_t *dp)
+{
+	uint32_t memIdx;
+	int64_t bDst;
+	int watched = 0;
+	const IoRegion_t *rp;
+	
+	memIdx = getLSargs<ShiftCnt,Src2Reg>(asap,dp);
+	bDst = asap->registers[dp->dstReg];
+	if ( ShiftCnt == 0 )
+		bDst &= 0xFF;
+	if ( !asap->errorMsg[0] && (rp = ioRegion(asap,memIdx,IO_WRITE)) )
+	{
+		if ( rp->write )
+			rp->write(asap,rp->arg,memIdx,bDst,ShiftCnt);
+		else if ( asap->verbose )
+			fprintf(asap->fout,"Store to ROM at %08X ignored\n", memIdx);
+		if ( memIdx <= asap->memSize )
+			watched = memAccess<BRK_WRITE,ShiftCnt>(asap,memIdx);
+	}
+	else if ( !asap->errorMsg[0] && chkMemIdx(asap,memIdx) )
+	{
+		memWrite<ShiftCnt>(asap->mem + memIdx,bDst);
+		codeWritten(asap,memIdx,1<<ShiftCnt);
+		watched = memAccess<BRK_WRITE,ShiftCnt>(asap,memIdx);
+	}
+	if ( commonLSOut<ShiftCnt,CC,false>(asap,dp,bDst) )
+		return 1;
+	return watched;
+}
+
+static int opGETPS(Asap_t *asap, const Decode_t *dp)
+{
+	if ( dp->dstReg )
+		asap->registers[dp->dstReg] = getStatus(asap);
+	return 0;
+}
+
+static int opPUTPS(Asap_t *asap, const Decode_t *dp)
+{
+	if ( (dp->flags&DEC_SRC2REG) )
+		putStatus(asap,asap->registers[dp->src2]&0x3F);
+	else
+		putStatus(asap,dp->src2&0x3F);
+	return 0;
+}
+
+template <bool Src2Reg, bool CC>
+static int opJSR(Asap_t *asap, const Decode_t *dp)
+{
+	uint32_t memIdx, status;
+	
+	memIdx = getLSargs<2,Src2Reg>(asap,dp);
+	if ( dp->dstReg )
+		asap->registers[dp->dstReg] = asap->pcQue[0]+BSR_INC;
+	asap->pcQue[2] = memIdx;
+	if ( CC )
+	{
+		status = getStatus(asap);
+		putStatus(asap,((status&PIENABLE)>>1) | (status&0x2F));
+	}
+	if ( asap->errorMsg[0] )
+		return 1;
+	return 0;
+}
+
+/* Handlers, indexed by (opcode<<2)|(flags&(DEC_SRC2REG|DEC_CC)) */
+#define OP_1(op)			op, op, op, op
+#define OP_4(op, ...)		op<__VA_ARGS__ false,false>, op<__VA_ARGS__ true,false>, op<__VA_ARGS__ false,true>, op<__VA_ARGS__ true,true>
+
+static constexpr InstHandler_t Handlers[128] =
+{
+	OP_1(opIllegal),		/* 0x00 */
+	OP_1(opBcc),			/* 0x01 */
+	OP_1(opBSR),			/* 0x02 */
+	OP_4(opLEA,2,),			/* 0x03 LEA */
+	OP_4(opLEA,1,),			/* 0x04 LEAS */
+	OP_4(opALU,0x05,),		/* 0x05 SUBR */
+	OP_4(opALU,0x06,),		/* 0x06 XOR */
+	OP_4(opALU,0x07,),		/* 0x07 XORN */
+	OP_4(opALU,0x08,),		/* 0x08 ADD */
+	OP_4(opALU,0x09,),		/* 0x09 SUB */
+	OP_4(opALU,0x0A,),		/* 0x0A ADDC */
+	OP_4(opALU,0x0B,),		/* 0x0B SUBC */
+	OP_4(opALU,0x0C,),		/* 0x0C AND */
+	OP_4(opALU,0x0D,),		/* 0x0D ANDN */
+	OP_4(opALU,0x0E,),		/* 0x0E OR */
+	OP_4(opALU,0x0F,),		/* 0x0F ORN */
+	OP_4(opLoad,2,false,),	/* 0x10 LD */
+	OP_4(opLoad,1,true,),	/* 0x11 LDS */
+	OP_4(opLoad,1,false,),	/* 0x12 LDUS */
+	OP_4(opStore,1,),		/* 0x13 STS */
+	OP_4(opStore,2,),		/* 0x14 ST */
+	OP_4(opLoad,0,true,),	/* 0x15 LDB */
+	OP_4(opLoad,0,false,),	/* 0x16 LDUB */
+	OP_4(opStore,0,),		/* 0x17 STB */
+	OP_4(opALU,0x18,),		/* 0x18 ASHR */
+	OP_4(opALU,0x19,),		/* 0x19 LSHR */
+	OP_4(opALU,0x1A,),		/* 0x1A SHL */
+	OP_4(opALU,0x1B,),		/* 0x1B ROTL */
+	OP_1(opGETPS),			/* 0x1C */
+	OP_1(opPUTPS),			/* 0x1D */
+	OP_4(opJSR,),			/* 0x1E */
+	OP_1(opIllegal)			/* 0x1F */
+};
+
+static void decodeInstruction(Decode_t *dp, uint32_t instruction)
+{
+	int brOffset;
+	
+	dp->instruction = instruction;
+	dp->opcode = (instruction >> 27)&0x1F;
+	dp->dstReg = (instruction>>22)&0x1F;
+	dp->src1Reg = (instruction>>16)&0x1F;
+	dp->src2 = (instruction&0xFFFF);
+	dp->flags = (instruction&(1<<21)) ? DEC_CC : 0;
+	if ( dp->opcode == 1 || dp->opcode == 2 )
+	{
+		/* Branches keep their byte offset in src2 */
+		brOffset = instruction & ((1 << 22) - 1);
+		if ( (brOffset&(1<<21)) )
+			brOffset |= 0xFFC00000;
+		dp->src2 = brOffset*4;
+		dp->flags = 0;
+	}
+	else if ( dp->src2 >= 0xFFE0 )
+	{
+		dp->src2 -= 0xFFE0;
+		dp->flags |= DEC_SRC2REG;
+	}
+	dp->handler = Handlers[(dp->opcode<<2)|(dp->flags&(DEC_SRC2REG|DEC_CC))];
+}
+
+/*
+ * Breakpoints are kept out of the way of execution. The predecoded
+ * instruction at the breakpoint gets opBreak() for its handler instead of
+ * its own, so the run loop finds out about it without ever comparing pc
+ * with anything. The rest of the entry is left as it is and the real
+ * handler can still be had from Handlers[].
+ */
+#define BREAK_HIT	(2)		/* what opBreak() returns */
+
+static int opBreak(Asap_t *asap, const Decode_t *dp)
+{
+	return BREAK_HIT;
+}
+
+static InstHandler_t realHandler(const Decode_t *dp)
+{
+	return Handlers[(dp->opcode<<2)|(dp->flags&(DEC_SRC2REG|DEC_CC))];
+}
+
+static bool isBreakAt(const Asap_t *asap, uint32_t pc)
+{
+	const BreakPoint_t *bp;
+	uint32_t idx = pc>>2;
+	int ii;
+	
+	if ( !asap->breakPointSet )
+		return false;
+	if ( !(pc&3) && idx < asap->numDecodes )
+		return (asap->breakBits[idx>>5]>>(idx&31))&1;
+	/* Only instructions outside the image get this far and they're never predecoded */
+	for ( ii = 0, bp = asap->breaks; ii < asap->numBreaks; ++ii, ++bp )
+	{
+		if ( bp->enabled && bp->type == BRK_EXEC && bp->addr == pc )
+			return true;
+	}
+	return false;
+}
+
+/* Decode the instruction at pc into dp, marking it if there is a breakpoint there */
+static void decodeMarked(Asap_t *asap, Decode_t *dp, uint32_t pc)
+{
+	decodeInstruction(dp,*(uint32_t *)(asap->mem+pc));
+	if ( isBreakAt(asap,pc) )
+		dp->handler = opBreak;
+	if ( asap->timing )
+		dp->cycles = asap->opCycles[dp->opcode] + (asap->waitPages ? asap->waitPages[pc>>WAIT_SHIFT] : 0);
+}
+
+
+/* Get the predecoded instruction at pc, decoding it if it hasn't been yet. */
+static const Decode_t *getDecode(Asap_t *asap, uint32_t pc)
+{
+	Decode_t *dp;
+	
+	if ( !(pc&3) && (pc>>2) < asap->numDecodes )
+	{
+		dp = asap->decodes + (pc>>2);
+		if ( !dp->handler )
+			decodeMarked(asap,dp,pc);
+		return dp;
+	}
+	/* Not in the loaded image (or not aligned), so never cached */
+	dp = &asap->tmpDecode;
+	if ( pc > asap->memSize - 4 )
+	{
+		decodeInstruction(dp,0);
+		dp->handler = opBadFetch;
+		dp->cycles = 0;
+		return dp;
+	}
+	decodeMarked(asap,dp,pc);
+	return dp;
+}
+
+/* Do the instruction dp at pcQue[0] with handler. Returns what the handler
+   does. Hitting a watchpoint doesn't stop the instruction finishing. */
+static inline int runHandler(Asap_t *asap, const Decode_t *dp, InstHandler_t handler)
+{
+	int sts;
+	
+	asap->result = 0;
+	asap->errorMsg[0] = 0;
+	asap->trace.pc = asap->pcQue[0];
+	asap->trace.instruction = dp->instruction;
+	asap->trace.flags = 0;
+	if ( asap->timing && handler != opBreak )
+	{
+		++asap->insns;
+		asap->cycles += dp->cycles;
+	}
+	sts = handler(asap,dp);
+	if ( sts && sts != WATCH_HIT )
+		return sts;
+	asap->pcQue[0] = asap->pcQue[1];
+	asap->pcQue[1] = asap->pcQue[2];
+	asap->pcQue[2] = asap->pcQue[1]+4;
+	return sts;
+}
+
+/*
+ * Interrupts are taken in front of the instruction at pcQue[0], as if it
+ * were being fetched. As asap.doc has it, its address goes to R30 and the
+ * one after it to R31, I is copied to P and cleared and execution carries
+ * on at IRQ_VCT. It takes two cycles.
+ */
+static void takeInterrupt(Asap_t *asap)
+{
+	uint32_t status = getStatus(asap);
+	
+	if ( asap->verbose )
+		fprintf(asap->fout,"Interrupt at %08X, %llu cycles\n", asap->pcQue[0], (unsigned long long)asap->cycles);
+	asap->registers[30] = asap->pcQue[0];
+	asap->registers[31] = asap->pcQue[1];
+	putStatus(asap,((status&IENABLE)<<1) | (status&0xF));
+	asap->pcQue[0] = IRQ_VCT;
+	asap->pcQue[1] = IRQ_VCT+4;
+	asap->pcQue[2] = IRQ_VCT+8;
+	asap->irqLines = 0;		/* acknowledged */
+	if ( asap->timing )
+		asap->cycles += 2;
+}
+
+/* Once cycles reaches nextCheck: do the events that are due and take an interrupt if there is one to take */
+static void serviceEvents(Asap_t *asap)
+{
+	asap->nextCheck = runEvents(asap);
+	if ( asap->irqLines && (asap->status&IENABLE) )
+		takeInterrupt(asap);
+}
+
+/* Do the instruction at pcQue[0], breakpoint or not (or an interrupt's
+   first instruction). Watchpoints it hits are left in watchHit. */
+static int executeInstruction(Asap_t *asap)
+{
+	const Decode_t *dp;
+	int sts;
+	
+	if ( asap->cycles >= asap->nextCheck )
+		serviceEvents(asap);
+	dp = getDecode(asap,asap->pcQue[0]);
+	sts = runHandler(asap,dp,dp->handler == opBreak ? realHandler(dp) : dp->handler);
+	return sts == WATCH_HIT ? 0 : sts;
+}
+
+/* Bit n of BranchTaken[condition] is set if the branch is taken when the
+   NZVC bits of the status are n */
+uint16_t BranchTaken[16];
+static pthread_once_t branchTakenOnce = PTHREAD_ONCE_INIT;	/* any number of contexts can start at once */
+
+static void initBranchTaken(void)
+{
+	int cond, nzvc;
+	
+	for ( cond = 0; cond < 16; ++cond )
+	{
+		BranchTaken[cond] = 0;
+		for ( nzvc = 0; nzvc < 16; ++nzvc )
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				asap->bDst = *(uint32_t *)(asap->mem + memIdx);
+			if ( chkBranch(nzvc,cond) )
+				BranchTaken[cond] |= 1<<nzvc;
 		}
-		else
-			asap->bDst = 0;
-		asap->result = asap->bDst;
-		if ( commonLDIndOut(asap,memIdx,2) )
-			return 1;
-		break;
-	case 0x11:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,1);
-		mkInstText(asap,instruction,"LDS",2);
-		if ( !asap->errorMsg[0] )
+	}
+}
+
+/*
+ * Basic blocks for the block engine. A block starts where execution is
+ * sequential (pcQue[1] == pcQue[0]+4) and runs up to and including the
+ * delay slot of a BSR, BRA or JSR. Conditional branches don't end a block:
+ * if one is taken, the block is cut short after its delay slot. Blocks also
+ * end in front of illegal opcodes (syscalls), the breakpoint and the end of
+ * the image. A branch whose delay slot can't go in a block is left out too;
+ * it and its delay slot are run one at a time.
+ */
+#define BLOCK_MAX_UOPS	(64)
+#define JIT_THRESHOLD	(50)	/* times a block is run before the JIT engine translates it */
+
+typedef struct Block_t
+{
+	struct Block_t *next;	/* every block, so they can be freed */
+	uint32_t pc;			/* address of first instruction */
+	uint32_t runs;			/* times run by the JIT engine without native code */
+	JitCode_t native;		/* native code for the block, if any */
+	int numUops;
+	uint32_t *cycleSum;		/* cycleSum[n] is the cycles of the first n uops, if timing */
+	uint32_t maxCycles;		/* the most the block can take, wait states and all */
+	Decode_t *uops[1];		/* actually numUops of them */
+} Block_t;
+
+static bool isIllegal(const Decode_t *dp)
+{
+	return dp->opcode == 0 || dp->opcode == 0x1F;
+}
+
+static bool isBranch(const Decode_t *dp)
+{
+	return dp->opcode == 1 || dp->opcode == 2 || dp->opcode == 0x1E;
+}
+
+/* Get the instruction at pc (which must be in the image) decoded */
+static Decode_t *decodeAt(Asap_t *asap, uint32_t pc)
+{
+	Decode_t *dp = asap->decodes + (pc>>2);
+	
+	if ( !dp->handler )
+		decodeMarked(asap,dp,pc);
+	return dp;
+}
+
+static void flushBlocks(Asap_t *asap)
+{
+	Block_t *blk, *next;
+	
+	for ( blk = asap->blockList; blk; blk = next )
+	{
+		next = blk->next;
+		asap->blockMap[blk->pc>>2] = NULL;
+		free(blk);
+	}
+	asap->blockList = NULL;
+	asap->codeChanged = false;
+	jitFlush(asap);
+}
+
+/* Translate the block starting at pc. Returns NULL if there is no block to be had. */
+static Block_t *makeBlock(Asap_t *asap, uint32_t pc)
+{
+	Decode_t *uops[BLOCK_MAX_UOPS], *dp, *slot;
+	Block_t *blk;
+	uint32_t addr;
+	int num = 0, ii;
+	
+	if ( !asap->blockMap )
+	{
+		asap->blockMap = (Block_t **)calloc(asap->numDecodes,sizeof(Block_t *));
+		if ( !asap->blockMap )
+			return NULL;
+	}
+	for ( addr = pc; num < BLOCK_MAX_UOPS-1 && (addr>>2) < asap->numDecodes; addr += 4 )
+	{
+		if ( num && isBreakAt(asap,addr) )
+			break;
+		dp = decodeAt(asap,addr);
+		if ( isIllegal(dp) )
+			break;
+		if ( isBranch(dp) )
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				asap->bDst = *(uint16_t *)(asap->mem + memIdx);
+			if ( ((addr+4)>>2) >= asap->numDecodes || isBreakAt(asap,addr+4) )
+				break;
+			slot = decodeAt(asap,addr+4);
+			if ( isBranch(slot) || isIllegal(slot) )
+				break;
+			uops[num++] = dp;
+			uops[num++] = slot;
+			if ( dp->opcode != 1 )
+				break;
+			addr += 4;
+			continue;
 		}
-		if ( (asap->bDst&0x8000) )
-			asap->bDst |= 0xFFFF0000;
-		asap->result = asap->bDst;
-		if (commonLDIndOut(asap,memIdx,1))
-			return 1;
-		break;
-	case 0x12:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,1);
-		mkInstText(asap,instruction,"LDUS",2);
-		if ( !asap->errorMsg[0] )
+		uops[num++] = dp;
+	}
+	if ( !num )
+		return NULL;
+	blk = (Block_t *)malloc(sizeof(Block_t)+(num-1)*sizeof(Decode_t *)
+							+ (asap->timing ? (num+1)*sizeof(uint32_t) : 0));
+	if ( !blk )
+		return NULL;
+	blk->pc = pc;
+	blk->runs = 0;
+	blk->native = NULL;
+	blk->numUops = num;
+	memcpy(blk->uops,uops,num*sizeof(Decode_t *));
+	blk->cycleSum = NULL;
+	blk->maxCycles = 0;
+	if ( asap->timing )
+	{
+		blk->cycleSum = (uint32_t *)(blk->uops + num);
+		blk->cycleSum[0] = 0;
+		for ( ii = 0; ii < num; ++ii )
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				asap->bDst = *(uint16_t *)(asap->mem + memIdx);
+			blk->cycleSum[ii+1] = blk->cycleSum[ii] + uops[ii]->cycles;
+			if ( uops[ii]->opcode >= 0x10 && uops[ii]->opcode <= 0x17 )
+				blk->maxCycles += asap->maxWait;
 		}
-		asap->result = asap->bDst;
-		if ( commonLDIndOut(asap,memIdx,1) )
-			return 1;
-		break;
-	case 0x13:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,1);
-		mkInstText(asap,instruction,"STS",2);
-		asap->result = asap->registers[asap->dstReg];
-		asap->bDst = asap->result;
-		if ( !asap->errorMsg[0] )
+		blk->maxCycles += blk->cycleSum[num];
+	}
+	blk->next = asap->blockList;
+	asap->blockList = blk;
+	asap->blockMap[pc>>2] = blk;
+	return blk;
+}
+
+/*
+ * The threaded and block engines. Every combination of opcode, src2
+ * register or immediate and .C gets its own piece of code below and each
+ * piece goes directly to the next one. The program counters are kept in
+ * locals (pcQue[2] is always pcQue[1]+4 between instructions so only two
+ * are needed). The threaded engine (Blocks false) fetches each next
+ * instruction by pc. The block engine (Blocks true) takes them from the
+ * block being run and only looks for a block by pc at the end of one.
+ *
+ * Anything out of the ordinary (syscalls, illegal opcodes and branches,
+ * memory errors, code outside the image, the breakpoint) is not done here.
+ * The engine stops with pcQue[] pointing at that instruction, untouched,
+ * so the reference handler can do it the usual way, trace text and all.
+ * It also stops if asked to by stopRequest. The block engine stops between
+ * blocks once cycles reaches nextCheck and runs a block an instruction at
+ * a time if it might get there part way through, so events and interrupts
+ * happen at exactly the same instruction as with the reference engine.
+ */
+#define TH_DISPATCH() do { \
+		if ( Blocks ) \
+		{ \
+			if ( uop == uopEnd ) \
+				goto nextBlock; \
+			dp = *uop++; \
+		} \
+		else \
+		{ \
+			if ( (pc&3) || (pc>>2) >= asap->numDecodes ) \
+				goto bail; \
+			dp = asap->decodes + (pc>>2); \
+			if ( !dp->handler ) \
+				decodeMarked(asap,dp,pc); \
+		} \
+		goto *Labels[(dp->opcode<<2)|(dp->flags&(DEC_SRC2REG|DEC_CC))]; \
+	} while (0)
+
+#define TH_NEXT() do { pc = npc; npc += 4; TH_DISPATCH(); } while (0)
+
+/* Any loop has to branch, so that's where the threaded engine looks for a
+   stop request. The block engine looks at the end of each block. */
+#define TH_STOP() do { \
+		if ( !Blocks && asap->stopRequest ) \
+			goto bail; \
+	} while (0)
+
+/* The status was just written. If that lets an interrupt in, the block
+   ends here so it is taken in front of the next instruction. */
+#define TH_PS_WRITTEN() do { \
+		if ( Blocks && !asap->nextCheck ) \
+			uopEnd = uop; \
+	} while (0)
+
+#define TH_SRC2(isReg) ((isReg) ? regs[dp->src2] : dp->src2)
+
+#define TH_ALU(lbl,isReg,cc,stsMask,compute) \
+	lbl: \
+		bSrc1 = regs[dp->src1Reg]; \
+		bSrc2 = TH_SRC2(isReg); \
+		compute; \
+		if ( cc ) \
+			lazyStatus(asap,stsMask,bDst,bSrc1,bSrc2,2); \
+		regs[dp->dstReg] = bDst; \
+		regs[0] = 0; \
+		TH_NEXT()
+
+#define TH_ALU4(op,stsMask,compute) \
+	TH_ALU(op##_N,0,0,stsMask,compute); \
+	TH_ALU(op##_R,1,0,stsMask,compute); \
+	TH_ALU(op##_C,0,1,stsMask,compute); \
+	TH_ALU(op##_CR,1,1,stsMask,compute)
+
+/* Effective address of LEA/LD/ST/JSR, leaving for getLSargs() to complain if need be */
+#define TH_EA(isReg,shiftCnt) \
+		bSrc2 = TH_SRC2(isReg); \
+		ea = regs[dp->src1Reg] + ((uint32_t)bSrc2<<shiftCnt); \
+		if (    (dp->src1Reg == 29 || (isReg && bSrc2 == 29)) && !asap->wholeSpace \
+			 && (ea < asap->memLen || ea > asap->memSize) ) \
+			goto bail
+
+/* Ready to touch memory at ea. With guard pages past the top of memory
+   there is nothing to check, just pcQue[] to leave where a fault can find it.
+   With watchpoints, ROM or devices, anything on a page with any of them is
+   left for the reference handler to sort out. Wait states are counted here too. */
+#define TH_MEM(type) \
+		if ( Guard ) \
+		{ \
+			asap->pcQue[0] = pc; \
+			asap->pcQue[1] = npc; \
+		} \
+		else if ( ea > asap->memSize || (Hook && memHook(asap,ea,type)) ) \
+			goto bail
+
+/* For the engines' versions with watchpoints, ROM, devices or wait states.
+   Returns true if the access has to be left to the reference handler,
+   which will count its wait states itself. */
+static inline bool memHook(Asap_t *asap, uint32_t ea, uint8_t type)
+{
+	if ( asap->watchPages && (asap->watchPages[ea>>WATCH_SHIFT]&type) )
+		return true;
+	if ( asap->ioPages && (asap->ioPages[ea>>IO_SHIFT]&type) )
+		return true;
+	if ( asap->waitPages )
+		asap->cycles += asap->waitPages[ea>>WAIT_SHIFT];
+	return false;
+}
+
+#define TH_LD(lbl,isReg,cc,shiftCnt,fetch) \
+	lbl: \
+		TH_EA(isReg,shiftCnt); \
+		TH_MEM(BRK_READ); \
+		fetch; \
+		if ( cc ) \
+			lazyStatus(asap,NEGATIVE|ZERO,bDst,0,0,shiftCnt); \
+		regs[dp->dstReg] = bDst; \
+		regs[0] = 0; \
+		TH_NEXT()
+
+#define TH_LD4(op,shiftCnt,fetch) \
+	TH_LD(op##_N,0,0,shiftCnt,fetch); \
+	TH_LD(op##_R,1,0,shiftCnt,fetch); \
+	TH_LD(op##_C,0,1,shiftCnt,fetch); \
+	TH_LD(op##_CR,1,1,shiftCnt,fetch)
+
+#define TH_ST(lbl,isReg,cc,shiftCnt,type,mask) \
+	lbl: \
+		TH_EA(isReg,shiftCnt); \
+		TH_MEM(BRK_WRITE); \
+		bDst = regs[dp->dstReg]&mask; \
+		*(type *)(asap->mem + ea) = bDst; \
+		if ( (ea>>2) < asap->numDecodes ) \
+		{ \
+			codeWritten(asap,ea,1<<shiftCnt); \
+			if ( Blocks && asap->codeChanged ) \
+				uopEnd = uop; \
+		} \
+		if ( cc ) \
+			lazyStatus(asap,NEGATIVE|ZERO,bDst,0,0,shiftCnt); \
+		TH_NEXT()
+
+#define TH_ST4(op,shiftCnt,type,mask) \
+	TH_ST(op##_N,0,0,shiftCnt,type,mask); \
+	TH_ST(op##_R,1,0,shiftCnt,type,mask); \
+	TH_ST(op##_C,0,1,shiftCnt,type,mask); \
+	TH_ST(op##_CR,1,1,shiftCnt,type,mask)
+
+#define TH_LEA(lbl,isReg,cc,shiftCnt) \
+	lbl: \
+		TH_EA(isReg,shiftCnt); \
+		bDst = ea; \
+		if ( cc ) \
+			lazyStatus(asap,NEGATIVE|ZERO,bDst,0,0,shiftCnt); \
+		regs[dp->dstReg] = bDst; \
+		regs[0] = 0; \
+		TH_NEXT()
+
+#define TH_LEA4(op,shiftCnt) \
+	TH_LEA(op##_N,0,0,shiftCnt); \
+	TH_LEA(op##_R,1,0,shiftCnt); \
+	TH_LEA(op##_C,0,1,shiftCnt); \
+	TH_LEA(op##_CR,1,1,shiftCnt)
+
+#define TH_JSR(lbl,isReg,cc) \
+	lbl: \
+		TH_EA(isReg,2); \
+		regs[dp->dstReg] = pc+BSR_INC; \
+		regs[0] = 0; \
+		if ( cc ) \
+		{ \
+			putStatus(asap,((getStatus(asap)&PIENABLE)>>1) | (getStatus(asap)&0x2F)); \
+			TH_PS_WRITTEN(); \
+		} \
+		pc = npc; \
+		npc = ea; \
+		TH_STOP(); \
+		TH_DISPATCH()
+
+#define TH_4(op) &&op##_N, &&op##_R, &&op##_C, &&op##_CR
+#define TH_1(op) &&op, &&op, &&op, &&op
+
+template <bool Blocks, bool Guard, bool Hook>
+static void runThreaded(Asap_t *asap)
+{
+	static const void * const Labels[128] =
+	{
+		TH_1(ILLEGAL),	/* 0x00 */
+		TH_1(BCC),		/* 0x01 */
+		TH_1(BSR),		/* 0x02 */
+		TH_4(LEA),		/* 0x03 */
+		TH_4(LEAS),		/* 0x04 */
+		TH_4(SUBR),		/* 0x05 */
+		TH_4(XOR),		/* 0x06 */
+		TH_4(XORN),		/* 0x07 */
+		TH_4(ADD),		/* 0x08 */
+		TH_4(SUB),		/* 0x09 */
+		TH_4(ADDC),		/* 0x0A */
+		TH_4(SUBC),		/* 0x0B */
+		TH_4(AND),		/* 0x0C */
+		TH_4(ANDN),		/* 0x0D */
+		TH_4(OR),		/* 0x0E */
+		TH_4(ORN),		/* 0x0F */
+		TH_4(LD),		/* 0x10 */
+		TH_4(LDS),		/* 0x11 */
+		TH_4(LDUS),		/* 0x12 */
+		TH_4(STS),		/* 0x13 */
+		TH_4(ST),		/* 0x14 */
+		TH_4(LDB),		/* 0x15 */
+		TH_4(LDUB),		/* 0x16 */
+		TH_4(STB),		/* 0x17 */
+		TH_4(ASHR),		/* 0x18 */
+		TH_4(LSHR),		/* 0x19 */
+		TH_4(SHL),		/* 0x1A */
+		TH_4(ROTL),		/* 0x1B */
+		TH_1(GETPS),	/* 0x1C */
+		&&PUTPS_N, &&PUTPS_R, &&PUTPS_N, &&PUTPS_R,	/* 0x1D */
+		TH_4(JSR),		/* 0x1E */
+		TH_1(ILLEGAL)	/* 0x1F */
+	};
+	uint32_t *regs = asap->registers;
+	uint32_t pc = asap->pcQue[0], npc = asap->pcQue[1];
+	uint32_t ea;
+	int64_t bDst, bSrc1, bSrc2;
+	Decode_t *dp, *single[1];
+	Decode_t **uop = NULL, **uopEnd = NULL;
+	Decode_t **runBase = NULL;		/* uops being run, if timing */
+	const uint32_t *runSum = NULL;	/* and their cycleSum[] (NULL for one instruction) */
+	Block_t *blk;
+	int stop;
+	
+	TH_DISPATCH();
+
+	TH_ALU4(SUBR, CARRY|OVERFLOW|NEGATIVE|ZERO, bSrc1 = ((~bSrc1)&0xFFFFFFFF) + 1; bDst = bSrc2+bSrc1);
+	TH_ALU4(XOR,  NEGATIVE|ZERO, bDst = bSrc1^bSrc2);
+	TH_ALU4(XORN, NEGATIVE|ZERO, bDst = bSrc1^~bSrc2);
+	TH_ALU4(ADD,  CARRY|OVERFLOW|NEGATIVE|ZERO, bDst = bSrc1+bSrc2);
+	TH_ALU4(SUB,  CARRY|OVERFLOW|NEGATIVE|ZERO, bSrc2 = ((~bSrc2)&0xFFFFFFFF)+1; bDst = bSrc1+bSrc2);
+	TH_ALU4(ADDC, CARRY|OVERFLOW|NEGATIVE|ZERO, bDst = bSrc1+bSrc2+(getStatus(asap)&CARRY));
+	TH_ALU4(SUBC, CARRY|OVERFLOW|NEGATIVE|ZERO, bSrc2 = ((~bSrc2)&0xFFFFFFFF)+(getStatus(asap)&CARRY); bDst = bSrc1+bSrc2);
+	TH_ALU4(AND,  NEGATIVE|ZERO, bDst = bSrc1&bSrc2);
+	TH_ALU4(ANDN, NEGATIVE|ZERO, bDst = bSrc1&~bSrc2);
+	TH_ALU4(OR,   NEGATIVE|ZERO, bDst = bSrc1|bSrc2);
+	TH_ALU4(ORN,  NEGATIVE|ZERO, bDst = bSrc1|bSrc2);
+	TH_ALU4(ASHR, NEGATIVE|ZERO, bDst = bSrc1 >> bSrc2);
+	TH_ALU4(LSHR, NEGATIVE|ZERO, bDst = bSrc1 >> bSrc2);
+	TH_ALU4(SHL,  NEGATIVE|ZERO, bDst = bSrc1 << bSrc2);
+	TH_ALU4(ROTL, NEGATIVE|ZERO, bDst = bSrc1 << bSrc2; bDst |= bDst>>32);
+
+	TH_LEA4(LEA,2);
+	TH_LEA4(LEAS,1);
+	TH_LD4(LD,  2, bDst = *(uint32_t *)(asap->mem + ea));
+	TH_LD4(LDS, 1, bDst = *(uint16_t *)(asap->mem + ea); if ( (bDst&0x8000) ) bDst |= 0xFFFF0000);
+	TH_LD4(LDUS,1, bDst = *(uint16_t *)(asap->mem + ea));
+	TH_LD4(LDB, 0, bDst = (uint8_t)asap->mem[ea]; if ( (bDst&0x80) ) bDst |= 0xFFFFFF00);
+	TH_LD4(LDUB,0, bDst = (uint8_t)asap->mem[ea]);
+	TH_ST4(STS, 1, uint16_t, 0xFFFFFFFF);
+	TH_ST4(ST,  2, uint32_t, 0xFFFFFFFF);
+	TH_ST4(STB, 0, uint8_t, 0xFF);
+
+	TH_JSR(JSR_N,0,0);
+	TH_JSR(JSR_R,1,0);
+	TH_JSR(JSR_C,0,1);
+	TH_JSR(JSR_CR,1,1);
+
+BCC:
+	if ( dp->dstReg >= 16 )
+		goto bail;
+	if ( (BranchTaken[dp->dstReg]>>(getStatus(asap)&0xF))&1 )
+	{
+		ea = pc + dp->src2;
+		if ( ea > asap->memLen )
+			goto bail;
+		if ( Blocks && uop < uopEnd )
+			uopEnd = uop+1;		/* only the delay slot is left to do in this block (if it's in it) */
+		pc = npc;
+		npc = ea;
+		TH_STOP();
+		TH_DISPATCH();
+	}
+	TH_NEXT();
+
+BSR:
+	ea = pc + dp->src2;
+	if ( ea > asap->memLen )
+		goto bail;
+	regs[dp->dstReg] = pc+BSR_INC;
+	regs[0] = 0;
+	pc = npc;
+	npc = ea;
+	TH_STOP();
+	TH_DISPATCH();
+
+GETPS:
+	regs[dp->dstReg] = getStatus(asap);
+	regs[0] = 0;
+	TH_NEXT();
+
+PUTPS_N:
+	putStatus(asap,dp->src2&0x3F);
+	TH_PS_WRITTEN();
+	TH_NEXT();
+
+PUTPS_R:
+	putStatus(asap,regs[dp->src2]&0x3F);
+	TH_PS_WRITTEN();
+	TH_NEXT();
+
+nextBlock:
+	if ( runBase )
+	{
+		asap->insns += uopEnd - runBase;
+		asap->cycles += runSum ? runSum[uopEnd-runBase] : (*runBase)->cycles;
+		runBase = NULL;
+	}
+	if ( asap->codeChanged )
+		flushBlocks(asap);
+	if (    (pc&3) || (pc>>2) >= asap->numDecodes || isBreakAt(asap,pc)
+		 || asap->stopRequest || asap->cycles >= asap->nextCheck )
+		goto bail;
+	if ( npc == pc+4 )
+	{
+		blk = asap->blockMap ? asap->blockMap[pc>>2] : NULL;
+		if ( !blk )
+			blk = makeBlock(asap,pc);
+		if ( blk && asap->cycles + blk->maxCycles >= asap->nextCheck )
+			goto oneInsn;	/* an event is due within it, so one at a time to see exactly where */
+		if ( blk && asap->engine == ENGINE_JIT && !asap->watchPages )	/* native code doesn't do watchpoints */
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				*(uint16_t *)(asap->mem + memIdx) = asap->result;
+			if ( !blk->native && ++blk->runs == JIT_THRESHOLD )
+				blk->native = jitCompile(asap,blk->uops,blk->numUops,pc);
+			if ( blk->native )
+			{
+				getStatus(asap);	/* the native code starts with nothing pending */
+				stop = blk->native(asap);
+#ifdef LAZY_FLAGS_CHECK
+				asap->checkStatus = mkStatus(asap->status,asap->lazyMask,asap->lazyDst,
+											 asap->lazySrc1,asap->lazySrc2,asap->lazyShift);
+#endif
+				pc = asap->pcQue[0];
+				npc = asap->pcQue[1];
+				if ( !stop )
+					goto nextBlock;
+				goto oneInsn;
+			}
 		}
-		if ( commonSTIndOut(asap,memIdx,1) )
-			return 1;
-		break;
-	case 0x14:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,2);
-		mkInstText(asap,instruction,"ST",4);
-		asap->result = asap->registers[asap->dstReg];
-		asap->bDst = asap->result;
-		if ( !asap->errorMsg[0] )
+		if ( blk )
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				*(uint32_t *)(asap->mem + memIdx) = asap->result;
+			uop = blk->uops;
+			uopEnd = uop + blk->numUops;
+			if ( asap->timing )
+			{
+				runBase = uop;
+				runSum = blk->cycleSum;
+			}
+			TH_DISPATCH();
 		}
-		if (commonSTIndOut(asap,memIdx,2))
-			return 1;
-		break;
-	case 0x15:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,0);
-		mkInstText(asap,instruction,"LDB",1);
-		if ( !asap->errorMsg[0] )
+	}
+	/* In a delay slot or no block to be had, so just the one instruction */
+oneInsn:
+	single[0] = decodeAt(asap,pc);
+	uop = single;
+	uopEnd = uop+1;
+	if ( asap->timing )
+	{
+		runBase = uop;
+		runSum = NULL;
+	}
+	TH_DISPATCH();
+
+ILLEGAL:
+bail:
+	if ( Blocks && runBase && uop-1 > runBase )
+	{
+		/* all but the instruction it bailed on (and never one on its own) */
+		asap->insns += uop-1 - runBase;
+		asap->cycles += runSum[uop-1 - runBase];
+	}
+	asap->pcQue[0] = pc;
+	asap->pcQue[1] = npc;
+	asap->pcQue[2] = npc+4;
+}
+
+/* Run the threaded or block engine, the version for watchpoints, ROM,
+   devices, wait states or guard page memory if need be. All but the last
+   need the address checks. */
+template <bool Blocks>
+static void runFast(Asap_t *asap)
+{
+	if ( asap->watchPages || asap->ioPages || asap->waitPages )
+		runThreaded<Blocks,false,true>(asap);
+	else if ( !asap->guardBase )
+		runThreaded<Blocks,false,false>(asap);
+	else if ( guardRun(asap,runThreaded<Blocks,true,false>) )
+		asap->pcQue[2] = asap->pcQue[1]+4;	/* it left pcQue[0] and [1] at the faulting instruction */
+}
+
+/* Why runUntilEvent() came back */
+typedef enum
+{
+	RUN_BREAK,		/* at a breakpoint, its instruction not done yet */
+	RUN_HALT,		/* the simulation can't continue */
+	RUN_ERROR,		/* the last instruction left an errorMsg */
+	RUN_WATCH,		/* the last instruction hit a watchpoint */
+	RUN_BUDGET,		/* no instructions left to run (-n) */
+	RUN_STOP		/* stopRequest was set */
+} RunEvent_t;
+
+#define RUN_CHUNK	(4096)	/* instructions between looks at stopRequest */
+
+/* The one for ^C to stop, while it's running. SIGINT is only caught in
+   interactive mode, when this is the thread that gets it. */
+static __thread Asap_t *volatile stopAsap;
+
+static void stopHandler(int sig)
+{
+	if ( stopAsap )
+		stopAsap->stopRequest = 1;
+	else
+	{
+		signal(SIGINT,SIG_DFL);
+		raise(SIGINT);
+	}
+}
+
+/*
+ * Run until there is something to tell about. Nothing is looked at
+ * between instructions other than what the handler returns, errorMsg and
+ * whether nextCheck has come; breakpoints come back from opBreak() and stop
+ * requests are looked for every RUN_CHUNK instructions (the faster engines
+ * see them too). The faster engines look at nextCheck between blocks.
+ */
+static RunEvent_t runUntilEvent(Asap_t *asap)
+{
+	const Decode_t *dp;
+	uint64_t num, ii, insns;
+	int sts = 0;
+	
+	stopAsap = asap;
+	while ( !asap->stopRequest )
+	{
+		if ( asap->cycles >= asap->nextCheck )
+			serviceEvents(asap);
+		if ( asap->history && asap->insns >= asap->checkpointDue )
+			historyCheckpoint(asap);
+		num = RUN_CHUNK;
+		if ( asap->insnLimited )
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				asap->bDst = (uint8_t)asap->mem[memIdx];
+			if ( !asap->insnLeft )
+			{
+				stopAsap = NULL;
+				return RUN_BUDGET;
+			}
+			if ( num > asap->insnLeft )
+				num = asap->insnLeft;
 		}
-		if ( (asap->bDst&0x80) )
-			asap->bDst |= 0xFFFFFF00;
-		asap->result = asap->bDst;
-		if (commonLDIndOut(asap,memIdx,0))
-			return 1;
-		break;
-	case 0x16:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,0);
-		mkInstText(asap,instruction,"LDUB",1);
-		if ( !asap->errorMsg[0] )
+		if ( asap->history && num > asap->checkpointDue - asap->insns )
+			num = asap->checkpointDue - asap->insns;
+		if ( asap->insnLimited && !asap->timing )
+			;		/* the faster engines only count instructions when timing */
+		else if ( asap->engine == ENGINE_THREADED && !asap->breakPointSet && !asap->timing )	/* it has no blocks to count cycles by */
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				asap->bDst = (uint8_t)asap->mem[memIdx];
+			runFast<false>(asap);
+			num = 1;		/* for whatever stopped it */
 		}
-		asap->result = asap->bDst;
-		if (commonLDIndOut(asap,memIdx,0))
-			return 1;
-		break;
-	case 0x17:
-		asap->stsMask = NEGATIVE|ZERO;
-		memIdx = getLSargs(asap,instruction,0);
-		mkInstText(asap,instruction,"STB",1);
-		asap->bDst = asap->registers[asap->dstReg]&0xFF;
-		asap->result = asap->bDst;
-		if ( !asap->errorMsg[0] )
+		else if ( asap->engine == ENGINE_BLOCK || asap->engine == ENGINE_JIT )
 		{
-			if ( memIdx > asap->memLen + asap->stackSize )
-				snprintf(asap->errorMsg, sizeof(asap->errorMsg) - 1, "getLSargs(): memIdx %08X out of range of memory %08X\n", memIdx, asap->memLen + asap->stackSize);
-			else
-				asap->mem[memIdx] = asap->result;
+			/* Every instruction takes at least a cycle so stopping them at
+			   insnLeft more cycles can't overrun the budget. It gets closer
+			   each time round. */
+			insns = asap->insns;
+			if (    asap->insnLimited
+				 && asap->nextCheck > asap->cycles
+				 && asap->nextCheck - asap->cycles > asap->insnLeft )
+				asap->nextCheck = asap->cycles + asap->insnLeft;
+			runFast<true>(asap);
+			if ( asap->insnLimited )
+				asap->insnLeft -= asap->insns - insns;
+			if ( asap->cycles >= asap->nextCheck )
+				continue;
+			num = 1;
+			if ( asap->insnLimited && !asap->insnLeft )
+				continue;
 		}
-		if (commonSTIndOut(asap,memIdx,0))
-			return 1;
-		break;
-	case 0x18:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1 >> asap->bSrc2;
-		commonAluOut(asap,"ASHR",">>");
-		break;
-	case 0x19:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1 >> asap->bSrc2;
-		commonAluOut(asap,"LSHR",">>");
-		break;
-	case 0x1A:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1 << asap->bSrc2;
-		commonAluOut(asap,"SHL","<<");
-		break;
-	case 0x1B:
-		asap->stsMask = NEGATIVE|ZERO;
-		getALUargs(asap);
-		asap->bDst = asap->bSrc1 << asap->bSrc2;
-		asap->bDst |= asap->bDst>>32;
-		commonAluOut(asap,"ROTL","<<");
-		break;
-	case 0x1C:
-		asap->showTextLen += snprintf(
-			asap->showText+asap->showTextLen,
-			sizeof(asap->showText)-asap->showTextLen,
-			"GETPS %s  ; dst gets %02X%s\n",
-			mkRegName(asap,0,asap->dstReg),
-			asap->status&0x3F,
-			mkStsTxt(asap,true));
-		if ( asap->dstReg )
-			asap->registers[asap->dstReg] = asap->status;
-		break;
-	case 0x1D:
-		if ( asap->src2 >= 0xFFE0 )
+		for ( ii = 0; ii < num; ++ii )
 		{
-			asap->status = asap->registers[asap->src2-0xFFE0]&0x3F;
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-			    "PUTPS %s  ; PS gets %02X%s",
-				mkRegName(asap,0,asap->dstReg),
-				asap->status,
-				mkStsTxt(asap,true));
+			dp = getDecode(asap,asap->pcQue[0]);
+			sts = runHandler(asap,dp,dp->handler);
+			if ( sts || asap->errorMsg[0] )
+				break;
+			if ( asap->cycles >= asap->nextCheck )
+				num = ii+1;		/* the rest after the event */
 		}
-		else
+		if ( asap->insnLimited )
+			asap->insnLeft -= ii + (ii < num && sts != BREAK_HIT);
+		if ( ii < num )
 		{
-			asap->status = asap->src2&0x3F;
-			asap->showTextLen += snprintf(
-				asap->showText+asap->showTextLen,
-				sizeof(asap->showText)-asap->showTextLen,
-			    "PUTPS %d    ; PS gets %02X%s\n",
-				asap->src2,
-				asap->src2&0x3F,
-				mkStsTxt(asap,true));
+			stopAsap = NULL;
+			if ( sts == BREAK_HIT )
+				return RUN_BREAK;
+			if ( sts == WATCH_HIT )
+				return RUN_WATCH;
+			if ( sts )
+			{
+				asap->cannotContinue = true;
+				return RUN_HALT;
+			}
+			return RUN_ERROR;
 		}
-		break;
-	case 0x1E:
-		memIdx = getLSargs(asap,instruction,2);
-		mkInstText(asap,instruction,"JSR",4);
-		if ( asap->dstReg )
-			asap->registers[asap->dstReg] = asap->pcQue[0]+BSR_INC;
-		asap->pcQue[2] = memIdx;
-		if ( asap->affectStatus )
-			asap->status = ((asap->status&PIENABLE)>>1) | (asap->status&0x2F);
-		he = findHash(asap,memIdx);
-		asap->showTextLen += snprintf(
-			asap->showText+asap->showTextLen,
-			sizeof(asap->showText)-asap->showTextLen,
-			"; dst gets %08X, jump to %08X%s  %s\n",
-			   asap->pcQue[0]+BSR_INC,
-			   memIdx,
-			   mkStsTxt(asap,asap->affectStatus),
-			   he ? he->name : ""
-			   );
-		if ( asap->errorMsg[0] )
-			return 1;
-		break;
 	}
-	asap->pcQue[0] = asap->pcQue[1];
-	asap->pcQue[1] = asap->pcQue[2];
-	asap->pcQue[2] = asap->pcQue[1]+4;
-	return 0;
+	stopAsap = NULL;
+	asap->stopRequest = 0;
+	return RUN_STOP;
 }
 
 static void dumpRegs(Asap_t *asap)
@@ -1121,7 +2218,7 @@ static void dumpRegs(Asap_t *asap)
 	const uint32_t *ptr;
 
 	ptr = asap->registers;
-	printf("pcs=%08X,%08X,%08X %smemLen=%d, stackSize=%d.\n",
+	fprintf(asap->fout,"pcs=%08X,%08X,%08X %smemLen=%d, stackSize=%d.\n",
 		   asap->pcQue[0],
 		   asap->pcQue[1],
 		   asap->pcQue[2],
@@ -1131,10 +2228,42 @@ static void dumpRegs(Asap_t *asap)
 	for ( ii = 0; ii < 32; ++ii, ++ptr )
 	{
 		if ( !(ii & 7) )
-			printf("%sreg %2d:", ii ? "\n" : "", ii);
-		printf("  %08X", *ptr);
+			fprintf(asap->fout,"%sreg %2d:", ii ? "\n" : "", ii);
+		fprintf(asap->fout,"  %08X", *ptr);
 	}
-	printf("\n");
+	fprintf(asap->fout,"\n");
+	if ( asap->timing )
+		fprintf(asap->fout,"insns=%llu, cycles=%llu.\n", (unsigned long long)asap->insns, (unsigned long long)asap->cycles);
+}
+
+/* Tell about the breakpoint at pcQue[0] before its instruction is done */
+static void showBreakPoint(Asap_t *asap)
+{
+	const HashEntry_t *he = findHash(asap,asap->pcQue[0]);
+
+	fprintf(asap->fout,"Hit breakpoint at %08X", asap->pcQue[0]);
+	if ( he )
+		fprintf(asap->fout,": %s", he->name);
+	fprintf(asap->fout,"\nBefore execution:\n");
+	dumpRegs(asap);
+}
+
+static void hitBreakPoint(Asap_t *asap)
+{
+	showBreakPoint(asap);
+	asap->interactive = true;
+}
+
+/* Tell about the watchpoint the last instruction hit */
+static void showWatchPoint(Asap_t *asap)
+{
+	fprintf(asap->fout,"Hit watchpoint %d: %s of %08X by instruction at %08X\nAfter execution:\n",
+		   asap->watchHit,
+		   asap->watchType == BRK_READ ? "read" : "write",
+		   asap->watchAddr,
+		   asap->trace.pc);
+	dumpRegs(asap);
+	asap->watchHit = 0;
 }
 
 static char *dmpAscii(char *dst, int columns, const uint8_t *rcd, int bytes)
@@ -1194,7 +2323,7 @@ static int hexDump(Asap_t *asap, uint32_t addr, uint32_t cnt)
 		{
 			if ( ii )
 			{
-				printf("%s\n", line);
+				fprintf(asap->fout,"%s\n", line);
 				memset(line,' ',sizeof(line)-1);
 			}
 			len = snprintf(line,sizeof(line),"%08X: ", addr);
@@ -1227,7 +2356,7 @@ static int hexDump(Asap_t *asap, uint32_t addr, uint32_t cnt)
 		}
 		dmpAscii(dst, Bytes, linePtr, items*4);
 	}
-	printf("%s\n", line);
+	fprintf(asap->fout,"%s\n", line);
 	return 0;
 }
 
@@ -1242,9 +2371,357 @@ typedef enum
 	Continue,
 	Run,
 	Quit,
-	Breakpoint
+	Breakpoint,
+	ReverseStep
 } Cmds_t;
 
+/*
+ * Breakpoints and watchpoints are all kept in breaks[]. Whenever any of
+ * them change, what execution looks at is made again from that: the
+ * breakpoint bits (and the marks in the predecoded instructions that go
+ * with them) and the watched pages.
+ */
+static void applyBreaks(Asap_t *asap)
+{
+	const BreakPoint_t *bp;
+	uint64_t top = asap->memSize;
+	uint32_t ii, idx;
+	bool watch = false;
+	int jj;
+	
+	/* blocks are cut at breakpoints, so they have to be made again */
+	flushBlocks(asap);
+	for ( ii = 0; ii < asap->numDecodes; ++ii )
+	{
+		if ( asap->decodes[ii].handler == opBreak )
+			asap->decodes[ii].handler = NULL;
+	}
+	if ( !asap->breakBits )
+		asap->breakBits = (uint32_t *)calloc((asap->numDecodes+31)/32,sizeof(uint32_t));
+	else
+		memset(asap->breakBits,0,(asap->numDecodes+31)/32*sizeof(uint32_t));
+	free(asap->watchPages);
+	asap->watchPages = NULL;
+	asap->breakPointSet = false;
+	for ( jj = 0, bp = asap->breaks; jj < asap->numBreaks; ++jj, ++bp )
+	{
+		if ( !bp->enabled )
+			continue;
+		if ( bp->type != BRK_EXEC )
+		{
+			watch = true;
+			continue;
+		}
+		asap->breakPointSet = true;
+		idx = bp->addr>>2;
+		if ( !(bp->addr&3) && idx < asap->numDecodes && asap->breakBits )
+		{
+			asap->breakBits[idx>>5] |= 1<<(idx&31);
+			asap->decodes[idx].handler = NULL;	/* to be marked when decoded again */
+		}
+	}
+	if ( watch )
+	{
+		asap->watchPages = (uint8_t *)calloc((top>>WATCH_SHIFT)+1,1);
+		if ( !asap->watchPages )
+		{
+			fprintf(asap->fout,"Unable to allocate memory for watchpoints. They're ignored.\n");
+			return;
+		}
+		for ( jj = 0, bp = asap->breaks; jj < asap->numBreaks; ++jj, ++bp )
+		{
+			if ( !bp->enabled || bp->type == BRK_EXEC || bp->addr > top )
+				continue;
+			/* The page an access starts on is what gets looked at */
+			ii = bp->addr < 3 ? 0 : bp->addr-3;
+			for ( ii >>= WATCH_SHIFT; ii <= (bp->end < top ? bp->end : top)>>WATCH_SHIFT; ++ii )
+				asap->watchPages[ii] |= bp->type;
+		}
+	}
+}
+
+static BreakPoint_t *addBreak(Asap_t *asap, uint8_t type, uint32_t addr, uint32_t end)
+{
+	BreakPoint_t *bp;
+	
+	if ( asap->numBreaks >= asap->maxBreaks )
+	{
+		bp = (BreakPoint_t *)realloc(asap->breaks,(asap->maxBreaks+16)*sizeof(BreakPoint_t));
+		if ( !bp )
+		{
+			fprintf(asap->fout,"Unable to allocate memory for another breakpoint\n");
+			return NULL;
+		}
+		asap->breaks = bp;
+		asap->maxBreaks += 16;
+	}
+	bp = asap->breaks + asap->numBreaks++;
+	bp->addr = addr;
+	bp->end = end;
+	bp->num = ++asap->lastBreakNum;
+	bp->type = type;
+	bp->enabled = true;
+	applyBreaks(asap);
+	return bp;
+}
+
+int replaceBreaks(Asap_t *asap, const BreakPoint_t *breaks, int num)
+{
+	BreakPoint_t *bp = NULL;
+	int ii;
+	
+	if ( num )
+	{
+		bp = (BreakPoint_t *)malloc(num*sizeof(BreakPoint_t));
+		if ( !bp )
+		{
+			fprintf(asap->fout,"Unable to allocate memory for %d breakpoints\n", num);
+			return 1;
+		}
+		memcpy(bp,breaks,num*sizeof(BreakPoint_t));
+	}
+	free(asap->breaks);
+	asap->breaks = bp;
+	asap->numBreaks = asap->maxBreaks = num;
+	asap->lastBreakNum = 0;
+	for ( ii = 0; ii < num; ++ii )
+	{
+		if ( asap->lastBreakNum < bp[ii].num )
+			asap->lastBreakNum = bp[ii].num;
+	}
+	applyBreaks(asap);
+	return 0;
+}
+
+/* Address of token, hex or a symbol. Complains and returns false if there isn't one. */
+static bool breakAddr(Asap_t *asap, const char *token, uint32_t *addr, const HashEntry_t **hep)
+{
+	const HashEntry_t *he;
+	char *endp = NULL;
+	
+	*hep = NULL;
+	*addr = strtoul(token, &endp, 16);
+	if ( endp && !*endp )
+		return true;
+	if ( !asap->numSyms )
+	{
+		fprintf(asap->fout,"No symbols available. Can't set bp to '%s'\n", token);
+		return false;
+	}
+	he = findHashByName(asap, token);
+	if ( !he )
+	{
+		fprintf(asap->fout,"No such symbol as '%s'\n", token);
+		return false;
+	}
+	*addr = he->value;
+	*hep = he;
+	return true;
+}
+
+static void listBreaks(Asap_t *asap)
+{
+	const BreakPoint_t *bp;
+	const HashEntry_t *he;
+	int ii;
+	
+	if ( !asap->numBreaks )
+	{
+		fprintf(asap->fout,"No breakpoint set\n");
+		return;
+	}
+	for ( ii = 0, bp = asap->breaks; ii < asap->numBreaks; ++ii, ++bp )
+	{
+		fprintf(asap->fout,"%3d %-8s %-3s %08X",
+			   bp->num,
+			   bp->type == BRK_EXEC ? "break" : bp->type == BRK_READ ? "read" : bp->type == BRK_WRITE ? "write" : "access",
+			   bp->enabled ? "on" : "off",
+			   bp->addr);
+		if ( bp->type != BRK_EXEC )
+			fprintf(asap->fout,"-%08X", bp->end);
+		he = findHash(asap,bp->addr);
+		if ( he )
+			fprintf(asap->fout,": %s", he->name);
+		fprintf(asap->fout,"\n");
+	}
+}
+
+/* breakpoint delete|enable|disable num|all */
+static void changeBreaks(Asap_t *asap, const char *cmd, const char *which)
+{
+	BreakPoint_t *bp;
+	char *endp = NULL;
+	bool all;
+	int num, ii, found = 0;
+	
+	all = !strcasecmp(which,"all");
+	num = strtol(which, &endp, 0);
+	if ( !all && (!*which || !endp || *endp) )
+	{
+		fprintf(asap->fout,"Expected a breakpoint number or 'all', not '%s'\n", which);
+		return;
+	}
+	for ( ii = 0, bp = asap->breaks; ii < asap->numBreaks; ++ii, ++bp )
+	{
+		if ( !all && bp->num != num )
+			continue;
+		++found;
+		if ( !strncasecmp(cmd,"delete",strlen(cmd)) )
+		{
+			memmove(bp,bp+1,(asap->numBreaks-ii-1)*sizeof(BreakPoint_t));
+			--asap->numBreaks;
+			--ii;
+			--bp;
+		}
+		else
+			bp->enabled = !strncasecmp(cmd,"enable",strlen(cmd));
+	}
+	if ( !found )
+		fprintf(asap->fout,"No breakpoint %s\n", which);
+	applyBreaks(asap);
+}
+
+/* The breakpoint command. args is what follows the command itself. */
+static void breakCmd(Asap_t *asap, const char *args)
+{
+	const HashEntry_t *he, *heEnd;
+	const BreakPoint_t *bp;
+	char cmd[128], from[128], to[128];
+	uint32_t addr, end;
+	uint8_t type = 0;
+	int num;
+	
+	cmd[0] = from[0] = to[0] = 0;
+	num = sscanf(args, "%127s %127s %127s", cmd, from, to);
+	if ( num <= 0 || !strcasecmp(cmd,"list") )
+	{
+		listBreaks(asap);
+		return;
+	}
+	if (    !strcasecmp(cmd,"delete") || !strcasecmp(cmd,"enable")
+		 || !strcasecmp(cmd,"disable") )
+	{
+		changeBreaks(asap,cmd,from);
+		return;
+	}
+	if ( !strcasecmp(cmd,"read") )
+		type = BRK_READ;
+	else if ( !strcasecmp(cmd,"write") )
+		type = BRK_WRITE;
+	else if ( !strcasecmp(cmd,"access") )
+		type = BRK_READ|BRK_WRITE;
+	if ( type )
+	{
+		if ( num < 2 )
+		{
+			fprintf(asap->fout,"Expected an address to watch\n");
+			return;
+		}
+		if ( !breakAddr(asap,from,&addr,&he) )
+			return;
+		end = addr+3;
+		if ( num > 2 )
+		{
+			if ( !breakAddr(asap,to,&end,&heEnd) )
+				return;
+			if ( end <= addr )
+			{
+				fprintf(asap->fout,"Nothing to watch from 0x%08X to 0x%08X\n", addr, end);
+				return;
+			}
+			--end;
+		}
+		bp = addBreak(asap,type,addr,end);
+		if ( bp )
+			fprintf(asap->fout,"Watchpoint %d set on 0x%08X-0x%08X\n", bp->num, bp->addr, bp->end);
+		return;
+	}
+	if ( !breakAddr(asap,cmd,&addr,&he) )
+		return;
+	if ( !he && addr > asap->memLen )
+	{
+		fprintf(asap->ferr, "Breakpoint value 0x%08X out of memory limits 0x%08X\n",
+				addr, asap->memLen);
+		return;
+	}
+	bp = addBreak(asap,BRK_EXEC,addr,addr);
+	if ( !bp )
+		return;
+	if ( he )
+		fprintf(asap->fout,"Breakpoint %d set at %s: 0x%08X\n", bp->num, he->name, he->value);
+	else
+		fprintf(asap->fout,"Breakpoint %d set at 0x%08X\n", bp->num, bp->addr);
+}
+
+/* reverse-step [n], reverse-continue and last-write from [to] */
+static void reverseCmd(Asap_t *asap, const char *cmd, const char *args)
+{
+	const HashEntry_t *he;
+	BreakPoint_t *bp;
+	char from[128], to[128];
+	unsigned long long count = 1;
+	uint32_t addr, end;
+	int num, sts;
+	
+	if ( !asap->history )
+	{
+		fprintf(asap->fout,"No history is kept. -H turns it on.\n");
+		return;
+	}
+	if ( tolower(cmd[0]) == 'l' )
+	{
+		from[0] = to[0] = 0;
+		num = sscanf(args, "%127s %127s", from, to);
+		if ( num < 1 )
+		{
+			fprintf(asap->fout,"Expected an address\n");
+			return;
+		}
+		if ( !breakAddr(asap,from,&addr,&he) )
+			return;
+		end = addr+3;
+		if ( num > 1 )
+		{
+			if ( !breakAddr(asap,to,&end,&he) )
+				return;
+			if ( end <= addr )
+			{
+				fprintf(asap->fout,"Nothing to look for from 0x%08X to 0x%08X\n", addr, end);
+				return;
+			}
+			--end;
+		}
+		bp = addBreak(asap,BRK_WRITE,addr,end);
+		if ( !bp )
+			return;
+		sts = historyReverse(asap,bp->num);
+		/* the watchpoint is the last one there is */
+		--asap->numBreaks;
+		--asap->lastBreakNum;
+		applyBreaks(asap);
+	}
+	else if ( !strcasecmp(cmd,"rs") || !strcasecmp(cmd,"reverse-step") )
+	{
+		if ( sscanf(args, "%llu", &count) == 1 && !count )
+			return;
+		if ( count > asap->insns )
+			count = asap->insns;
+		sts = historyGoTo(asap,asap->insns - count);
+	}
+	else
+		sts = historyReverse(asap,0);
+	if ( asap->watchHit )
+		showWatchPoint(asap);
+	else if ( !sts && isBreakAt(asap,asap->pcQue[0]) )
+		showBreakPoint(asap);
+	else
+	{
+		fprintf(asap->fout,"At %08X, %llu instructions\nBefore execution:\n",
+				asap->pcQue[0], (unsigned long long)asap->insns);
+		dumpRegs(asap);
+	}
+}
+
 void simulateAsap(Asap_t *asap)
 {
 //	asap->brTarget = 0;
@@ -1252,15 +2729,22 @@ void simulateAsap(Asap_t *asap)
 	Cmds_t lastCmd=Nothing;
 	uint32_t memFrom=0;
 	int memLen=0, args;
+	bool resume=false;		/* just continued, so not stopping at a breakpoint where it is */
+	bool prompted=asap->interactive;
 	
-	asap->pcQue[0] = 0;
-	asap->pcQue[1] = 4;
-	asap->pcQue[2] = 8;
+	pthread_once(&branchTakenOnce,initBranchTaken);
+	if ( !asap->decodes )
+	{
+		fprintf(asap->fout,"No image loaded\n");
+		return;
+	}
+	if ( asap->interactive || asap->history )
+		signal(SIGINT,stopHandler);		/* so ^C gets back to the prompt */
 	if ( !asap->interactive && asap->verbose )
 	{
-		printf("Before execution:\n");
+		fprintf(asap->fout,"Before execution:\n");
 		dumpRegs(asap);
-		printf("\n");
+		fprintf(asap->fout,"\n");
 	}
 	while ( 1 )
 	{
@@ -1269,17 +2753,17 @@ void simulateAsap(Asap_t *asap)
 			char ttybuf[128], token[sizeof(ttybuf)+1];
 			char *ttp;
 			ttp = ttybuf;
-			if ( qa5(stdin, stdout, "asap-sim> ", sizeof(ttybuf), ttybuf) )
+			if ( qa5(asap->fin, asap->fout, "asap-sim> ", sizeof(ttybuf), ttybuf) )
 			{
 				switch (_qaval_)
 				{
 				case EOF:
-					printf("\n");
+					fprintf(asap->fout,"\n");
 					return;
 	
 				case EOF - 1:
-					fprintf(stderr, "\nI/O error; command ignored\n\n");
-					purge_qa2(stdin, stdout);
+					fprintf(asap->ferr, "\nI/O error; command ignored\n\n");
+					purge_qa2(asap->fin, asap->fout);
 					lastCmd = Nothing;
 					memFrom = 0;
 					memLen = 0;
@@ -1289,8 +2773,8 @@ void simulateAsap(Asap_t *asap)
 					break;
 					
 				default:
-					fprintf(stderr, "\nUnhandled qa5() return: %d; command ignored\n\n", _qaval_);
-					purge_qa2(stdin, stdout);
+					fprintf(asap->ferr, "\nUnhandled qa5() return: %d; command ignored\n\n", _qaval_);
+					purge_qa2(asap->fin, asap->fout);
 					lastCmd = Nothing;
 					memFrom = 0;
 					memLen = 0;
@@ -1339,12 +2823,15 @@ void simulateAsap(Asap_t *asap)
 				case Run:
 					strncpy(ttybuf, "run", sizeof(ttybuf));
 					break;
+				case ReverseStep:
+					strncpy(ttybuf, "reverse-step", sizeof(ttybuf));
+					break;
 				}
 			}
 			token[0] = 0;
 			if ( (args=sscanf(ttp, "%127s", token)) != 1 )
 			{
-				fprintf(stderr, "Invalid characters;  unrecognized command. args=%d, token='%s'\n", args, token);
+				fprintf(asap->ferr, "Invalid characters;  unrecognized command. args=%d, token='%s'\n", args, token);
 				continue;
 			}
 			if ( !strncasecmp(token,"step",strlen(token)) )
@@ -1352,32 +2839,30 @@ void simulateAsap(Asap_t *asap)
 				lastCmd = Step;
 				if ( !asap->cannotContinue )
 				{
-					if ( asap->breakPointSet && asap->pcQue[0] == asap->breakPoint )
+					if ( isBreakAt(asap,asap->pcQue[0]) )
 					{
-						const HashEntry_t *he = findHash(asap,asap->breakPoint);
-						printf("Hit breakpoint at %08X", asap->breakPoint);
-						if ( he )
-							printf(": %s", he->name);
-						printf("\nBefore execution:\n");
-						dumpRegs(asap);
-						printf("Executing instruction at breakpoint address\n");
+						showBreakPoint(asap);
+						fprintf(asap->fout,"Executing instruction at breakpoint address\n");
 					}
 					asap->cannotContinue = executeInstruction(asap);
 					if ( asap->cannotContinue || asap->verbose )
 					{
-						if ( asap->showText[0] )
+						const char *txt = mkShowText(asap);
+						if ( txt[0] )
 						{
-							fputs(asap->showText,stdout);
-							if ( !strchr(asap->showText,'\n') )
-								fputs("\n",stdout);
+							fputs(txt,asap->fout);
+							if ( !strchr(txt,'\n') )
+								fputs("\n",asap->fout);
 						}
 					}
 					if ( asap->errorMsg[0] )
 					{
-						fputs(asap->errorMsg,stdout);
+						fputs(asap->errorMsg,asap->fout);
 						if ( !strchr(asap->errorMsg,'\n') )
-							fputs("\n",stdout);
+							fputs("\n",asap->fout);
 					}
+					if ( asap->watchHit )
+						showWatchPoint(asap);
 				}
 				else
 					lastCmd = Nothing;
@@ -1385,66 +2870,8 @@ void simulateAsap(Asap_t *asap)
 			}
 			if ( !strncasecmp(token,"breakpoint",strlen(token)) || !strncasecmp(token,"bp",strlen(token)))
 			{
-				const HashEntry_t *he;
-				char *endp;
-				
 				lastCmd = Breakpoint;
-				endp = ttybuf+strlen(token);
-				while ( isspace(*endp) )
-					++endp;
-				if ( *endp )
-				{
-					asap->breakPointSet = false;
-					asap->breakPoint = 0;
-					token[0] = 0;
-					if ( (args=sscanf(endp, "%127s", token)) != 1 )
-					{
-						fprintf(stderr, "Invalid characters;  unrecognized argument to breakpoint command. args=%d, token='%s'\n", args, token);
-						continue;
-					}
-					endp = NULL;
-					asap->breakPoint = strtoul(token, &endp, 16);
-					if ( !endp || *endp )
-					{
-						if ( !asap->numUsedHashes )
-						{
-							printf("No symbols available. Can't set bp to '%s'\n", token);
-							continue;
-						}
-						he = findHashByName(asap, token);
-						if ( !he )
-						{
-							printf("No such symbol as '%s'\n", token);
-							continue;
-						}
-						asap->breakPoint = he->value;
-						printf("Breakpoint set at %s: 0x%08X\n", he->name, he->value);
-					}
-					else
-					{
-						if ( asap->breakPoint > asap->memLen )
-						{
-							fprintf(stderr, "Breakpoint value 0x%08X out of memory limits 0x%08X\n",
-									asap->breakPoint, asap->memLen);
-							continue;
-						}
-						printf("Breakpoint set at 0x%08X\n", asap->breakPoint);
-					}
-					asap->breakPointSet = true;
-				}
-				else
-				{
-					if ( asap->breakPointSet )
-					{
-						he = findHash(asap,asap->breakPoint);
-						printf("Breakpoint set at %08X", asap->breakPoint);
-						if ( he )
-							printf(": %s", he->name);
-						printf("\n");
-					}
-					else
-						printf("No breakpoint set\n");
-				}
+				breakCmd(asap,ttp+strlen(token));
 				continue;
 			}
 			if ( !strncasecmp(token,"registers",strlen(token)) )
@@ -1465,11 +2892,11 @@ void simulateAsap(Asap_t *asap)
 				}
 				else if ( args == 1 )
 				{
-					memLen = asap->memLen + asap->stackSize - memFrom;
+					memLen = asap->wholeSpace ? 256 : asap->memSize - memFrom;
 				}
 				else if ( args != 2 )
 				{
-					fprintf(stderr,"Bad from and/or to parameters\n");
+					fprintf(asap->ferr,"Bad from and/or to parameters\n");
 					memFrom = 0;
 					memLen = 0;
 					lastCmd = Nothing;
@@ -1488,19 +2915,27 @@ void simulateAsap(Asap_t *asap)
 			{
 				lastCmd = Verbose;
 				asap->verbose = !asap->verbose;
-				printf("Verbose turned %s\n", asap->verbose ? "ON":"OFF");
+				fprintf(asap->fout,"Verbose turned %s\n", asap->verbose ? "ON":"OFF");
 				continue;
 			}
 			if ( !strncasecmp(token,"help",strlen(token)) )
 			{
 				lastCmd = Help;
-				printf("Commands are:\n"
+				fprintf(asap->fout,"Commands are:\n"
 					   "(Commands can be abbreviated to 1 or more characters)\n"
 					   "breakpoint n - set breakpoint at 'n' (expected to be hex)\n"
 					   "             - 'n' could also be a symbol if available\n"
-					   "bp        - same as breakpoint"
-					   "continue  - continue execution. Have to ^C to stop and exit.\n"
+					   "breakpoint read|write|access from [to]\n"
+					   "             - set watchpoint on bytes 'from' up to 'to'\n"
+					   "               (default 4 bytes). Either can be a symbol\n"
+					   "breakpoint [list] - list breakpoints and watchpoints\n"
+					   "breakpoint delete|enable|disable num|all\n"
+					   "bp        - same as breakpoint\n"
+					   "continue  - continue execution. ^C stops it and comes back here.\n"
 					   "exit      - exit\n"
+					   "history   - how far back -H's checkpoints go and what they cost\n"
+					   "last-write from [to] - go back to the last store to bytes 'from' up to\n"
+					   "            'to' (default 4 bytes). Needs -H\n"
 					   "memory [start [nBytes]] - display memory.\n"
 					   "            optional start address\n"
 					   "            followed by optional byte count\n"
@@ -1508,7 +2943,13 @@ void simulateAsap(Asap_t *asap)
 					   "            start and nBytes are expected to be in hex\n"
 					   "quit      - exit\n"
 					   "registers - show registers\n"
-					   "run       - continue execution. Have to ^C to stop and exit.\n"
+					   "restore path - put the machine back as a snapshot has it\n"
+					   "reverse-continue - go back to the last breakpoint or watchpoint hit. Needs -H\n"
+					   "reverse-step [n] - go back n (default 1) instructions. Needs -H\n"
+					   "rc        - same as reverse-continue\n"
+					   "rs        - same as reverse-step\n"
+					   "run       - same as continue\n"
+					   "save path - write a snapshot of the machine to path\n"
 					   "step      - execute one instruction\n"
 					   "verbose   - toggle verbose mode\n"
 					   );
@@ -1521,59 +2962,247 @@ void simulateAsap(Asap_t *asap)
 			{
 				lastCmd = Continue;
 				if ( !asap->cannotContinue )
+				{
 					asap->interactive = 0;
+					resume = true;
+				}
 				else
 				{
-					printf("Due to error condition, cannot continue\n");
+					fprintf(asap->fout,"Due to error condition, cannot continue\n");
 					lastCmd = Nothing;
 				}
 				continue;
 			}
+			if (    !strcasecmp(token,"reverse-step") || !strcasecmp(token,"rs")
+				 || !strcasecmp(token,"reverse-continue") || !strcasecmp(token,"rc")
+				 || !strcasecmp(token,"last-write") )
+			{
+				lastCmd = !strcasecmp(token,"rs") || !strcasecmp(token,"reverse-step") ? ReverseStep : Nothing;
+				reverseCmd(asap,token,ttp+strlen(token));
+				continue;
+			}
+			if ( !strcasecmp(token,"history") )
+			{
+				lastCmd = Nothing;
+				if ( asap->history )
+					historyReport(asap);
+				else
+					fprintf(asap->fout,"No history is kept. -H turns it on.\n");
+				continue;
+			}
+			if ( !strcasecmp(token,"save") || !strcasecmp(token,"restore") )
+			{
+				lastCmd = Nothing;
+				ttp += strlen(token);
+				if ( sscanf(ttp,"%127s",token+1) != 1 )
+					fprintf(asap->ferr,"Expected a file name\n");
+				else if ( tolower(token[0]) == 's' )
+				{
+					if ( !snapSave(asap,token+1) )
+						fprintf(asap->fout,"Saved to %s\n", token+1);
+				}
+				else if ( !snapRestore(asap,token+1) )
+				{
+					if ( asap->history )
+						historyStart(asap,0);		/* what's kept is of another time line */
+					fprintf(asap->fout,"Restored from %s\n", token+1);
+					dumpRegs(asap);
+				}
+				continue;
+			}
 			if ( !strncasecmp(token,"quit",strlen(token)) || !strncasecmp(token,"exit",strlen(token)) )
 			{
 				lastCmd = Quit;
 				return;
 			}
-			fprintf(stderr,"Unrecognized command\n");
+			fprintf(asap->ferr,"Unrecognized command\n");
 			continue;
 		}
-		if ( asap->breakPointSet && asap->pcQue[0] == asap->breakPoint )
+		if ( asap->verbose )
 		{
-			const HashEntry_t *he = findHash(asap,asap->breakPoint);
-			printf("Hit breakpoint at %08X", asap->breakPoint);
-			if ( he )
-				printf(": %s", he->name);
-			printf("\nBefore execution:\n");
-			dumpRegs(asap);
-			asap->interactive = true;
-			continue;
+			/* The slow way, an instruction at a time with everything shown */
+			if ( isBreakAt(asap,asap->pcQue[0]) && !resume )
+			{
+				hitBreakPoint(asap);
+				continue;
+			}
+			resume = false;
+			asap->cannotContinue = executeInstruction(asap);
+		}
+		else if ( resume && isBreakAt(asap,asap->pcQue[0]) )
+		{
+			/* Continuing from a breakpoint, so the instruction there goes first */
+			resume = false;
+			asap->cannotContinue = executeInstruction(asap);
+		}
+		else
+		{
+			resume = false;
+			switch (runUntilEvent(asap))
+			{
+			case RUN_BREAK:
+				hitBreakPoint(asap);
+				continue;
+			case RUN_STOP:
+				fprintf(asap->fout,"\nStopped at %08X\n", asap->pcQue[0]);
+				asap->interactive = true;
+				continue;
+			case RUN_BUDGET:
+				fprintf(asap->fout,"Instruction limit reached at %08X\n", asap->pcQue[0]);
+				return;
+			case RUN_HALT:
+			case RUN_ERROR:
+			case RUN_WATCH:
+				break;
+			}
 		}
-		asap->cannotContinue = executeInstruction(asap);
 		if ( asap->cannotContinue || asap->verbose || asap->errorMsg[0] )
 		{
-			if ( asap->showText[0] )
+			const char *txt = mkShowText(asap);
+			if ( txt[0] )
 			{
-				fputs(asap->showText,stdout);
-				if ( !strchr(asap->showText,'\n') )
-					fputs("\n",stdout);
+				fputs(txt,asap->fout);
+				if ( !strchr(txt,'\n') )
+					fputs("\n",asap->fout);
 			}
 			if ( asap->errorMsg[0] )
 			{
-				fputs(asap->errorMsg,stdout);
+				fputs(asap->errorMsg,asap->fout);
 				if ( !strchr(asap->errorMsg,'\n') )
-					fputs("\n",stdout);
+					fputs("\n",asap->fout);
 			}
 		}
+		if ( asap->watchHit )
+		{
+			showWatchPoint(asap);
+			asap->interactive = true;
+		}
 		if ( asap->cannotContinue )
 		{
 			if ( asap->verbose )
 			{
-				printf("After execution (%d bytes):\n", asap->memLen);
+				fprintf(asap->fout,"After execution (%d bytes):\n", asap->memLen);
 				dumpRegs(asap);
-				printf("\n");
+				fprintf(asap->fout,"\n");
+			}
+			if ( asap->history && (prompted || asap->exitStatus == -1) )
+			{
+				/* so what led up to it can be gone back over */
+				asap->interactive = true;
+				continue;
 			}
 			return;
 		}
 	}
 }
 
+int runTo(Asap_t *asap, uint32_t addr)
+{
+	RunEvent_t ev;
+	int sts = 1;
+	
+	pthread_once(&branchTakenOnce,initBranchTaken);
+	if ( !asap->decodes )
+	{
+		fprintf(asap->fout,"No image loaded\n");
+		return 1;
+	}
+	if ( !addBreak(asap,BRK_EXEC,addr,addr) )
+		return 1;
+	while ( 1 )
+	{
+		ev = runUntilEvent(asap);
+		if ( ev == RUN_BREAK && asap->pcQue[0] == addr )
+		{
+			sts = 0;
+			break;
+		}
+		if ( ev == RUN_BREAK )
+			asap->cannotContinue = executeInstruction(asap);	/* someone else's, so past it */
+		else if ( ev == RUN_WATCH )
+			asap->watchHit = 0;
+		else if ( ev == RUN_BUDGET || ev == RUN_STOP )
+		{
+			fprintf(asap->fout,"Stopped at %08X before getting to %08X\n", asap->pcQue[0], addr);
+			break;
+		}
+		if ( asap->cannotContinue || asap->errorMsg[0] )
+		{
+			const char *txt = mkShowText(asap);
+			if ( txt[0] )
+			{
+				fputs(txt,asap->fout);
+				if ( !strchr(txt,'\n') )
+					fputs("\n",asap->fout);
+			}
+			if ( asap->errorMsg[0] )
+			{
+				fputs(asap->errorMsg,asap->fout);
+				if ( !strchr(asap->errorMsg,'\n') )
+					fputs("\n",asap->fout);
+			}
+			if ( asap->cannotContinue )
+				break;
+		}
+	}
+	/* the breakpoint is the last one there is */
+	--asap->numBreaks;
+	--asap->lastBreakNum;
+	applyBreaks(asap);
+	return sts;
+}
+
+int runUntil(Asap_t *asap, uint64_t until, int num, uint64_t *hit)
+{
+	bool insnLimited = asap->insnLimited;
+	uint64_t insnLeft = asap->insnLeft;
+	RunEvent_t ev;
+	int sts = 0;
+	
+	pthread_once(&branchTakenOnce,initBranchTaken);
+	while ( asap->insns < until )
+	{
+		asap->insnLimited = true;
+		asap->insnLeft = until - asap->insns;
+		ev = runUntilEvent(asap);
+		if ( ev == RUN_BREAK )
+		{
+			if ( hit && !num )
+				*hit = asap->insns;
+			asap->cannotContinue = executeInstruction(asap);	/* past it */
+		}
+		if ( asap->watchHit && asap->insns < until )
+		{
+			if ( hit && (!num || asap->watchHit == num) )
+				*hit = asap->insns;
+			asap->watchHit = 0;
+		}
+		if ( ev == RUN_STOP || asap->cannotContinue )
+		{
+			sts = asap->insns < until;
+			break;
+		}
+	}
+	asap->insnLimited = insnLimited;
+	asap->insnLeft = insnLeft;
+	return sts;
+}
+
+/* Give back what simulateAsap() and the breakpoint commands allocated */
+void freeExecution(Asap_t *asap)
+{
+	flushBlocks(asap);
+	jitFree(asap);
+	free(asap->blockMap);
+	asap->blockMap = NULL;
+	free(asap->decodes);
+	asap->decodes = NULL;
+	asap->numDecodes = 0;
+	free(asap->breaks);
+	asap->breaks = NULL;
+	asap->numBreaks = asap->maxBreaks = 0;
+	free(asap->breakBits);
+	asap->breakBits = NULL;
+	free(asap->watchPages);
+	asap->watchPages = NULL;
+}
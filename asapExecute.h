@@ -1,52 +1,244 @@
 #ifndef _ASAPEXECUTE_H_
 #define _ASAPEXECUTE_H_
 
-#define HASH_TABLE_ENTRIES (127)
+/* Bits in the status register */
+#define CARRY		(1<<0)
+#define OVERFLOW	(1<<1)
+#define ZERO		(1<<2)
+#define NEGATIVE	(1<<3)
+#define IENABLE		(1<<4)
+#define PIENABLE	(1<<5)
+#define BSR_INC		(8)		/* Spec says this should be 4, but some real code assumes 8 */
 
+/* A symbol from the .stb (see get_stb.cpp) */
 typedef struct HashEntry_t
 {
-	struct HashEntry_t *next;
 	uint32_t value;
 	const char *name;
 } HashEntry_t;
 
+/* A segment from the .stb */
+typedef struct StbSeg_t
+{
+	const char *name;
+	uint32_t base;
+	uint32_t len;			/* from its VLDA_SLEN, 0 if it had none */
+	uint16_t flags;			/* VSEG_xxx */
+	uint16_t ident;
+} StbSeg_t;
+
+/* What executeInstruction() leaves behind about the instruction it just
+   executed. The trace text is made from this only when it is wanted. */
 typedef struct
+{
+	uint32_t pc;			/* address of instruction */
+	uint32_t instruction;	/* the instruction itself */
+	uint32_t src1;			/* contents of src1 register before execution */
+	uint32_t src2;			/* src2 operand (register contents or immediate) */
+	uint32_t result;		/* value written to dst or to memory */
+	uint32_t ea;			/* effective address, branch target or r31 of a trap */
+	uint32_t flags;			/* TRC_xxx */
+} Trace_t;
+
+#define TRC_TAKEN		(1<<0)	/* conditional branch was taken */
+#define TRC_TERMINATED	(1<<1)	/* illegal opcode terminated the simulation */
+#define TRC_TEXT		(1<<2)	/* showText already holds the text */
+#define TRC_TRAPPED		(1<<3)	/* illegal opcode went to its vector */
+
+/* Ways instructions can be executed */
+typedef enum
+{
+	ENGINE_SIMPLE,		/* one at a time through executeInstruction() (the reference) */
+	ENGINE_THREADED,	/* threaded code, one specialized handler per instruction form */
+	ENGINE_BLOCK,		/* threaded code run a translated basic block at a time */
+	ENGINE_JIT			/* blocks, with the busy ones translated to native code */
+} Engine_t;
+
+/* What illegal opcodes (0 and 0x1F) do */
+typedef enum
+{
+	TRAPS_HLE,			/* syscalls are done by the simulator, anything else ends the run (default) */
+	TRAPS_MIXED,		/* syscalls are done by the simulator, anything else traps */
+	TRAPS_EXACT			/* everything traps, as asap.doc says */
+} TrapMode_t;
+
+struct Asap_t;
+struct Decode_t;
+struct Block_t;
+
+typedef int (*InstHandler_t)(struct Asap_t *asap, const struct Decode_t *dp);
+
+/* An instruction pulled apart once so it needn't be each time it executes */
+typedef struct Decode_t
+{
+	InstHandler_t handler;	/* executes the instruction. NULL if not decoded yet */
+	uint32_t instruction;	/* the instruction itself */
+	uint32_t src2;			/* immediate, register number or branch offset */
+	uint8_t opcode;
+	uint8_t dstReg;			/* also branch condition */
+	uint8_t src1Reg;
+	uint8_t flags;			/* DEC_xxx */
+	uint16_t cycles;		/* with the wait states of fetching it, if timing */
+} Decode_t;
+
+#define DEC_SRC2REG	(1<<0)	/* src2 is a register number rather than an immediate */
+#define DEC_CC		(1<<1)	/* instruction affects the condition codes (.C) */
+
+/* A breakpoint or a watchpoint */
+typedef struct
+{
+	uint32_t addr;			/* breakpoint address or first byte watched */
+	uint32_t end;			/* last byte watched */
+	int num;				/* what the user knows it by */
+	uint8_t type;			/* BRK_xxx */
+	bool enabled;
+} BreakPoint_t;
+
+#define BRK_EXEC	(1<<0)	/* breakpoint */
+#define BRK_READ	(1<<1)	/* watchpoint on loads */
+#define BRK_WRITE	(1<<2)	/* watchpoint on stores */
+
+#define WATCH_SHIFT	(8)		/* log2 of the size of a page watchPages[] has a byte for */
+#define WAIT_SHIFT	(8)		/* and waitPages[] */
+#define IO_SHIFT	(8)		/* and ioPages[] */
+#define MEM_CHUNK_SHIFT	(20)	/* and touched[] */
+#define HIST_SHIFT	(10)		/* and histDirty[] */
+#define MEM_CHUNK	(1<<MEM_CHUNK_SHIFT)
+
+/* ioPages[] bits, the same as BRK_READ and BRK_WRITE so one mask does for both */
+#define IO_READ		(2)		/* loads on the page might be from a device */
+#define IO_WRITE	(4)		/* stores on the page might be to a device or ROM */
+
+struct WaitRegion_t;
+struct IoRegion_t;
+struct Event_t;
+
+#define ILL_VCT		(0x40)	/* where opcode 0 traps to */
+#define SYS_VCT		(0x80)	/* where opcode 0x1F traps to */
+#define IRQ_VCT		(0xC0)	/* where an interrupt goes */
+#define IRQ_TIMER	(0)		/* irqLines bit of the periodic timer */
+
+typedef struct Asap_t
 {
 	uint32_t registers[32];
 	uint32_t pcQue[3];
 	uint32_t status;
 	uint32_t memLen;
-	uint32_t breakPoint;
-	const char *msg;
 	const char *stbFilename;
-	uint8_t *stbFileContents;
+	const uint8_t *stbFileContents;	/* mapped. The symbols' names are in it */
+	size_t stbFileLen;
 	char errorMsg[128];
+	Trace_t trace;
 	char showText[128];
 	char regName[3][16];
 	int showTextLen;
 	char stsTxt[16];
-	int dstReg, src1Reg, src2;
 	uint32_t result;
-	int64_t bDst, bSrc1, bSrc2;
+	int64_t lazyDst, lazySrc1, lazySrc2;	/* result and sources of the last .C instruction */
+	uint8_t lazyMask;		/* status bits still to be made from them, if any */
+	uint8_t lazyShift;		/* and the shiftCnt to use */
+#ifdef LAZY_FLAGS_CHECK
+	uint32_t checkStatus;	/* status worked out the eager way */
+	int lazyFlagsErrors;	/* times it and the lazy status disagreed */
+#endif
 	uint8_t *mem;
-	uint8_t stsMask;
 	int stackSize;
 	int verbose;
+	FILE *fin;				/* the guest's stdin, stdout and stderr. The simulator's */
+	FILE *fout;				/* own messages go to fout and ferr too */
+	FILE *ferr;
+	int exitStatus;			/* r1 of SYSCALL_EXIT, -1 if the run ended some other way */
+	struct Replay_t *replay;	/* -I, NULL if reads aren't being recorded or played back */
+	Engine_t engine;
+	TrapMode_t traps;
 //	int pcInc;
 //	int brTarget;
 	int *errnoPtr;
-	HashEntry_t *hashesPool;
-	int numUsedHashes;
-	int numHashes;
-	HashEntry_t *hashTableTop[HASH_TABLE_ENTRIES];
+	Decode_t *decodes;		/* one per word of the loaded image */
+	uint32_t numDecodes;
+	Decode_t tmpDecode;		/* for instructions outside the image */
+	struct Block_t **blockMap;	/* translated block starting at each word of the image, if any */
+	struct Block_t *blockList;	/* all translated blocks */
+	bool codeChanged;		/* a predecoded instruction was written over */
+	uint8_t *jitMem;		/* native code for the JIT engine */
+	uint32_t jitSize;
+	uint32_t jitUsed;
+	uint8_t *guardBase;		/* region mem is in if it has guard pages (-g), else NULL */
+	uint64_t guardSize;
+	size_t memMapLen;		/* mem is an mmap() this long if it has no guard pages, else 0 */
+	uint64_t memSize;		/* bytes of memory, memLen+stackSize or all 4GB with -A */
+	bool wholeSpace;		/* memory is the whole 32 bit address space (-A) */
+	uint8_t *touched;		/* -A: a byte per MEM_CHUNK, see memTouched() */
+	bool noPagemapScan;		/* the kernel has no PAGEMAP_SCAN, read pagemap instead */
+	HashEntry_t *syms;		/* symbols, in address order */
+	uint32_t *symValues;	/* just their values, to search */
+	int numSyms;
+	int *symNames;			/* index in syms[] of each name, hashed (-1 if empty) */
+	uint32_t symNameMask;	/* symNames[] has one more than this */
 	int longestName;
-	bool affectStatus;
+	StbSeg_t *segs;			/* segments, in file order */
+	int numSegs;
 	bool interactive;
 	bool cannotContinue;
-	bool breakPointSet;
+	bool breakPointSet;		/* there is an enabled breakpoint (not watchpoint) */
+	BreakPoint_t *breaks;	/* breakpoints and watchpoints */
+	int numBreaks;
+	int maxBreaks;
+	int lastBreakNum;
+	uint32_t *breakBits;	/* a bit for each word of the image with an enabled breakpoint */
+	uint8_t *watchPages;	/* BRK_READ/BRK_WRITE of the watchpoints on each page, NULL if none */
+	struct IoRegion_t *regions;	/* ROM and devices */
+	int numRegions;
+	uint8_t *ioPages;		/* IO_READ/IO_WRITE for each page of memory, NULL if no region is in memory */
+	int watchHit;			/* num of the watchpoint the last instruction hit, 0 if none */
+	uint32_t watchAddr;		/* and the address it accessed */
+	uint8_t watchType;		/* and how */
+	bool timing;			/* counting cycles (-t) */
+	uint8_t opCycles[32];	/* cycles each opcode takes without wait states */
+	uint8_t *waitPages;		/* wait states of an access to each page, NULL if none */
+	uint8_t maxWait;		/* the most in waitPages[] */
+	struct WaitRegion_t *waitRegions;	/* what waitPages[] is made from */
+	int numWaitRegions;
+	double clockMHz;
+	uint64_t cycles;		/* cycles and instructions executed, if timing */
+	uint64_t insns;
+	struct Event_t *events;	/* scheduled events, a heap on when they're due */
+	int numEvents;
+	int maxEvents;
+	uint64_t nextCheck;		/* cycles at which to look at events and /IRQ again */
+	uint32_t irqLines;		/* sources asserting /IRQ, a bit each */
+	uint64_t timerPeriod;	/* cycles between timer interrupts, 0 if none */
+	bool insnLimited;		/* stop after insnLeft more instructions (-n) */
+	uint64_t insnLeft;
+	volatile int stopRequest;	/* set asynchronously (^C) to stop a run */
+	struct History_t *history;	/* -H checkpoints, NULL if none are kept */
+	uint8_t *histDirty;		/* -H: a byte per 1<<HIST_SHIFT of memory written since the last checkpoint */
+	uint64_t checkpointDue;	/* insns at which the next one is taken */
 } Asap_t;
 
 extern void simulateAsap(Asap_t *asap);
-extern char *mkStsTxt(Asap_t *asap);
+/* Run until the instruction at addr is next. Returns non-zero, having said
+   why, if the program stops or can't go on before it gets there. */
+extern int runTo(Asap_t *asap, uint32_t addr);
+/* Run on through breakpoints and watchpoints until insns gets to until, to
+   go over what has been run before. If hit isn't NULL insns when the last
+   breakpoint or watchpoint (only watchpoint num, if num isn't 0) was hit
+   before until is put there. A watchpoint hit by the very last instruction
+   is left in watchHit. Returns non-zero if the program stops short. */
+extern int runUntil(Asap_t *asap, uint64_t until, int num, uint64_t *hit);
+extern void freeExecution(Asap_t *asap);
+extern char *mkStsTxt(Asap_t *asap, bool flag);
+extern const char *mkShowText(Asap_t *asap);
+extern void codeWritten(Asap_t *asap, uint32_t addr, uint32_t len);
+/* With -A, a byte for each MEM_CHUNK of memory that is non-zero unless all
+   of it is still the kernel's zeros, so what walks memory can skip the rest
+   of the 4GB. NULL without -A or if it can't be found out, when all of
+   memory has to be looked at. (asapSim.cpp) */
+extern const uint8_t *memTouched(Asap_t *asap);
+extern uint32_t readStatus(Asap_t *asap);	/* with the lazy condition codes worked out */
+extern void writeStatus(Asap_t *asap, uint32_t status);
+/* Replace the breakpoints and watchpoints with num of them from breaks. Returns non-zero if out of memory. */
+extern int replaceBreaks(Asap_t *asap, const BreakPoint_t *breaks, int num);
+extern uint16_t BranchTaken[16];
 
 #endif	/* _ASAPEXECUTE_H_ */
@@ -0,0 +1,188 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "asapExecute.h"
+#include "asapFork.h"
+#include "get_stb.h"
+
+/*
+ * Fork server (-F where). The image, symbols and everything else are
+ * loaded once and the program is run up to where, past whatever it does
+ * to get itself going. From then on each line read from requests is
+ *
+ *	input output [count]
+ *
+ * and is done by a fork()ed copy of the simulator that carries on from
+ * where with the guest's stdin from input and its stdout and stderr (the
+ * simulator's messages too) to output, '-' being nothing for either. It
+ * stops after count instructions if given, else after -n's. The copy
+ * starts out sharing all of memory, the predecoded instructions and any
+ * native code with the server and only gets its own of what it writes.
+ * When the copy is done it hands back how the run went through a pipe and
+ * the server writes
+ *
+ *	exit=S end=HOW insns=I cycles=C
+ *
+ * to replies. S is what the guest gave SYSCALL_EXIT, -1 if it didn't. HOW
+ * is 'exit', 'budget', 'halt' or 'error', as for -B, or 'crash' if the
+ * copy died without saying, in which case S is the signal. I and C are
+ * what the copy ran, from where on as count is. An empty line or EOF ends
+ * it. Requests are done one at a time.
+ *
+ * Nothing but the replies may go to replies, so whatever is printed on the
+ * way to where has to go somewhere else: -F gives replies stdout and sends
+ * everything else to stderr (see main()).
+ */
+
+typedef struct
+{
+	int32_t exitStatus;
+	int32_t end;			/* FORK_xxx */
+	uint64_t insns;
+	uint64_t cycles;
+} ForkResult_t;
+
+enum
+{
+	FORK_EXIT,
+	FORK_BUDGET,
+	FORK_HALT,
+	FORK_ERROR
+};
+
+static const char * const EndNames[] = { "exit", "budget", "halt", "error" };
+
+/* What a forked copy does for one request. It never returns. */
+static void forkChild(Asap_t *asap, int fd, const char *input, const char *output, uint64_t budget)
+{
+	ForkResult_t res;
+	uint64_t insns = asap->insns, cycles = asap->cycles;	/* at where */
+	FILE *in, *out;
+
+	memset(&res,0,sizeof(res));
+	res.exitStatus = -1;
+	res.end = FORK_ERROR;
+	in = fopen(strcmp(input,"-") ? input : "/dev/null","r");
+	out = fopen(strcmp(output,"-") ? output : "/dev/null","w");
+	if ( in && out )
+	{
+		asap->fin = in;
+		asap->fout = out;
+		asap->ferr = out;
+		if ( budget )
+		{
+			asap->insnLimited = true;
+			asap->insnLeft = budget;
+		}
+		simulateAsap(asap);
+		res.exitStatus = asap->exitStatus;
+		if ( asap->exitStatus != -1 )
+			res.end = FORK_EXIT;
+		else if ( asap->insnLimited && !asap->insnLeft )
+			res.end = FORK_BUDGET;
+		else
+			res.end = FORK_HALT;
+		res.insns = asap->insns - insns;
+		res.cycles = asap->cycles - cycles;
+		fclose(out);
+	}
+	if ( write(fd,&res,sizeof(res)) != sizeof(res) )
+		_exit(1);
+	_exit(0);
+}
+
+int forkServer(Asap_t *asap, const char *where, FILE *requests, FILE *replies)
+{
+	const HashEntry_t *he;
+	ForkResult_t res;
+	char line[1024], *input, *output, *count, *endp;
+	uint64_t insnLeft = asap->insnLeft, budget;
+	bool insnLimited = asap->insnLimited;
+	uint32_t addr;
+	int fds[2], status;
+	ssize_t got;
+	pid_t pid;
+
+	endp = NULL;
+	addr = strtoul(where,&endp,16);
+	if ( !endp || *endp )
+	{
+		he = asap->numSyms ? findHashByName(asap,where) : NULL;
+		if ( !he )
+		{
+			fprintf(asap->ferr,"No such symbol as '%s'\n", where);
+			return 1;
+		}
+		addr = he->value;
+	}
+	/* -n is for the requests */
+	asap->insnLimited = false;
+	if ( runTo(asap,addr) )
+		return 1;
+	asap->insnLimited = insnLimited;
+	asap->insnLeft = insnLeft;
+	signal(SIGPIPE,SIG_IGN);		/* a copy dying early mustn't take the server with it */
+	while ( fgets(line,sizeof(line),requests) )
+	{
+		input = strtok(line," \t\r\n");
+		if ( !input )
+			break;
+		output = strtok(NULL," \t\r\n");
+		count = output ? strtok(NULL," \t\r\n") : NULL;
+		budget = 0;
+		if ( count )
+		{
+			endp = NULL;
+			budget = strtoull(count,&endp,0);
+			if ( !endp || *endp || !budget )
+				output = NULL;
+		}
+		if ( !output )
+		{
+			fprintf(replies,"Expected input output [count]\n");
+			fflush(replies);
+			continue;
+		}
+		if ( pipe(fds) < 0 )
+		{
+			fprintf(asap->ferr,"Unable to make a pipe: %s\n", strerror(errno));
+			return 1;
+		}
+		fflush(NULL);		/* so the copy has nothing buffered to write again */
+		pid = fork();
+		if ( pid < 0 )
+		{
+			fprintf(asap->ferr,"Unable to fork: %s\n", strerror(errno));
+			close(fds[0]);
+			close(fds[1]);
+			return 1;
+		}
+		if ( !pid )
+		{
+			close(fds[0]);
+			forkChild(asap,fds[1],input,output,budget);
+		}
+		close(fds[1]);
+		got = read(fds[0],&res,sizeof(res));
+		close(fds[0]);
+		while ( waitpid(pid,&status,0) < 0 && errno == EINTR )
+			;
+		if ( got == sizeof(res) && res.end >= FORK_EXIT && res.end <= FORK_ERROR )
+			fprintf(replies,"exit=%d end=%s insns=%llu cycles=%llu\n",
+					res.exitStatus, EndNames[res.end],
+					(unsigned long long)res.insns, (unsigned long long)res.cycles);
+		else
+			fprintf(replies,"exit=%d end=crash insns=0 cycles=0\n",
+					WIFSIGNALED(status) ? WTERMSIG(status) : -1);
+		fflush(replies);
+	}
+	return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef _ASAPFORK_H_
+#define _ASAPFORK_H_
+
+#include "asapExecute.h"
+
+/* Run the loaded program up to where (a symbol or a hex address) and then
+   serve runs from there, a forked copy each, for the requests read from
+   requests. Each one's result goes to replies. Returns non-zero if the
+   program didn't get to where. */
+extern int forkServer(Asap_t *asap, const char *where, FILE *requests, FILE *replies);
+
+#endif	/* _ASAPFORK_H_ */
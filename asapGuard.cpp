@@ -0,0 +1,109 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "asapExecute.h"
+#include "asapGuard.h"
+
+/*
+ * Guest memory with guard pages, for the -g option.
+ *
+ * A region big enough for the image, the stack and all 4GB a 32 bit
+ * address can reach beyond them is reserved with nothing mapped. Only the
+ * pages holding the image and stack are made readable and writable and
+ * the guest memory is placed so that it ends exactly at the end of the
+ * last of them. Any access past the top then lands on a PROT_NONE page.
+ *
+ * That lets the threaded, block and JIT engines do loads and stores
+ * without comparing the address against the top of memory. If one of
+ * them does stray, the SIGSEGV is caught here and guardRun() returns to
+ * its caller, which leaves the instruction to executeInstruction() to do
+ * the usual way, explicit checks, error message and all. The stack checks
+ * on r29 are about more than running off the end of memory and are still
+ * done by the engines.
+ *
+ * executeInstruction() allows an access at exactly memLen+stackSize so
+ * the 4 bytes from there are mapped too. An access starting within 3
+ * bytes above that is let through instead of being complained about.
+ */
+
+typedef struct
+{
+	sigjmp_buf jmp;
+	Asap_t *asap;
+} GuardRun_t;
+
+static __thread GuardRun_t *running;	/* the guardRun() in progress, if any */
+
+static void guardHandler(int sig, siginfo_t *info, void *ctx)
+{
+	uint8_t *addr = (uint8_t *)info->si_addr;
+
+	if (    running
+		 && addr >= running->asap->guardBase
+		 && addr < running->asap->guardBase + running->asap->guardSize )
+		siglongjmp(running->jmp,1);
+	/* Not one of ours. Put things back so it happens again and is fatal. */
+	signal(SIGSEGV,SIG_DFL);
+}
+
+static pthread_once_t installOnce = PTHREAD_ONCE_INIT;	/* the handler is for every context */
+static int installSts;
+
+static void installHandler(void)
+{
+	struct sigaction sa;
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_sigaction = guardHandler;
+	/* SA_NODEFER because the handler leaves with siglongjmp() and SIGSEGV mustn't stay blocked */
+	sa.sa_flags = SA_SIGINFO|SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	installSts = sigaction(SIGSEGV,&sa,NULL);
+}
+
+uint8_t *guardAlloc(Asap_t *asap, uint32_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t mapped = (size + page - 1) & ~(page - 1);
+	uint8_t *base;
+
+	pthread_once(&installOnce,installHandler);
+	if ( installSts < 0 )
+		return NULL;
+	asap->guardSize = mapped + 0x100000000ULL + page;
+	base = (uint8_t *)mmap(NULL,asap->guardSize,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if ( base == MAP_FAILED )
+		return NULL;
+	if ( mprotect(base,mapped,PROT_READ|PROT_WRITE) < 0 )
+	{
+		munmap(base,asap->guardSize);
+		return NULL;
+	}
+	asap->guardBase = base;
+	return base + mapped - size;
+}
+
+bool guardRun(Asap_t *asap, void (*func)(Asap_t *asap))
+{
+	GuardRun_t run;
+
+	run.asap = asap;
+	if ( sigsetjmp(run.jmp,0) )
+	{
+		running = NULL;
+		return true;
+	}
+	running = &run;
+	func(asap);
+	running = NULL;
+	return false;
+}
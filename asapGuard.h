@@ -0,0 +1,14 @@
+#ifndef _ASAPGUARD_H_
+#define _ASAPGUARD_H_
+
+#include "asapExecute.h"
+
+/* Guest memory of size bytes with nothing but guard pages above it, far
+   enough that no 32 bit address can get past them. NULL if it can't be had. */
+extern uint8_t *guardAlloc(Asap_t *asap, uint32_t size);
+
+/* Run func(asap). Returns true if it was stopped by touching a guard page,
+   in which case whatever func() had in local variables is lost. */
+extern bool guardRun(Asap_t *asap, void (*func)(Asap_t *asap));
+
+#endif	/* _ASAPGUARD_H_ */
@@ -0,0 +1,499 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "asapExecute.h"
+#include "asapHistory.h"
+#include "asapReplay.h"
+#include "asapEvent.h"
+
+/*
+ * Going back in time (-H n and the reverse-step, reverse-continue and
+ * last-write commands).
+ *
+ * Every n instructions a checkpoint is taken: the registers, pcQue,
+ * status, cycle count, timer and where the input log is (see
+ * asapReplay.cpp). Memory isn't copied. Instead shadow[] holds it as it was
+ * at the last checkpoint, and every store notes the HIST_PAGE it writes
+ * in histDirty[] and, the first time, in changed[] (see historyWritten(),
+ * which codeWritten() calls). Taking the next checkpoint compares just
+ * those pages with shadow[]. The ones that differ are kept with the last
+ * checkpoint, as they were then, and copied to shadow[]. So a checkpoint
+ * costs a compare and a copy of what was written, however big memory is,
+ * and it holds only what changed before the next one. errno is written
+ * through a pointer rather than by a store, so its page is always looked
+ * at. With -A, shadow[] is an anonymous mapping, so it only takes up what
+ * is copied to it.
+ *
+ * Going back to a checkpoint puts back the pages written since the last one
+ * and then the pages kept with each checkpoint after it, newest first. The
+ * later checkpoints are let go. Going back to any instruction is going
+ * back to the checkpoint before it and running on to it with breakpoints
+ * passed over, reads played back from the input log and output thrown
+ * away. That is only the same as the first time if everything happens at
+ * the same instruction, so the simple engine is used (interrupts are taken
+ * at block ends by the others).
+ *
+ * When there are HIST_MAX checkpoints every other one is let go (its pages
+ * go to the one before it) and n doubles, so what's kept covers the whole
+ * run in a bounded number of checkpoints, at the cost of running further
+ * to get to an instruction a long way back.
+ */
+
+#define HIST_PAGE	(1<<HIST_SHIFT)	/* what memory is compared and kept in */
+#define HIST_MAX	(64)		/* checkpoints kept before every other one is let go */
+
+typedef struct
+{
+	uint64_t insns;
+	uint64_t cycles;
+	uint64_t timerDue;
+	uint32_t registers[32];
+	uint32_t pcQue[3];
+	uint32_t status;
+	uint32_t irqLines;
+	ReplayMark_t input;
+	int numPages;			/* of memory as it was here that changed before the next checkpoint */
+	uint32_t *pageNums;		/* ascending */
+	uint8_t *pages;			/* HIST_PAGE bytes each */
+} Checkpoint_t;
+
+typedef struct History_t
+{
+	uint64_t every;			/* what -H asked for */
+	uint64_t interval;		/* what it is now */
+	uint64_t top;			/* bytes of memory kept track of */
+	uint8_t *shadow;		/* memory as it was at the last checkpoint */
+	uint32_t *changed;		/* page numbers histDirty[] has set, in the order written */
+	uint32_t numChanged;
+	uint32_t numPages;		/* of memory */
+	Checkpoint_t cps[HIST_MAX];
+	int num;
+	FILE *quiet;			/* output goes here when running over old ground */
+	bool full;				/* no memory for more checkpoints */
+	uint64_t taken;			/* checkpoints taken, all told */
+	uint64_t nsecs;			/* spent taking them */
+	uint64_t rerun;			/* instructions run again to go back */
+} History_t;
+
+static uint32_t pageLen(const History_t *hp, uint64_t off)
+{
+	return hp->top - off < HIST_PAGE ? hp->top - off : HIST_PAGE;
+}
+
+static void freePages(Checkpoint_t *cp)
+{
+	free(cp->pageNums);
+	free(cp->pages);
+	cp->pageNums = NULL;
+	cp->pages = NULL;
+	cp->numPages = 0;
+}
+
+void historyWritten(Asap_t *asap, uint64_t addr, uint32_t len)
+{
+	History_t *hp = asap->history;
+	uint64_t page, last = (addr+len-1)>>HIST_SHIFT;
+
+	for ( page = addr>>HIST_SHIFT; page <= last && page < hp->numPages; ++page )
+	{
+		if ( !asap->histDirty[page] )
+		{
+			asap->histDirty[page] = 1;
+			hp->changed[hp->numChanged++] = page;
+		}
+	}
+}
+
+static int comparePageNums(const void *a, const void *b)
+{
+	uint32_t pa = *(const uint32_t *)a, pb = *(const uint32_t *)b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+/* Add errno's page to what's been written, it isn't stored to */
+static void errnoWritten(Asap_t *asap)
+{
+	if ( asap->errnoPtr )
+		historyWritten(asap,(uint8_t *)asap->errnoPtr - asap->mem,sizeof(*asap->errnoPtr));
+}
+
+/* Forget what's been written, shadow[] being up to date */
+static void clearWritten(Asap_t *asap)
+{
+	History_t *hp = asap->history;
+	uint32_t ii;
+
+	for ( ii = 0; ii < hp->numChanged; ++ii )
+		asap->histDirty[hp->changed[ii]] = 0;
+	hp->numChanged = 0;
+}
+
+/* Keep with cp the pages that changed since it was taken and bring shadow[] up to date */
+static int keepChanges(Asap_t *asap, Checkpoint_t *cp)
+{
+	History_t *hp = asap->history;
+	uint64_t off;
+	uint32_t len;
+	int num = 0, ii;
+
+	errnoWritten(asap);
+	/* written to, but only some put back as they were */
+	for ( ii = 0; ii < (int)hp->numChanged; ++ii )
+	{
+		off = (uint64_t)hp->changed[ii] << HIST_SHIFT;
+		if ( memcmp(asap->mem+off,hp->shadow+off,pageLen(hp,off)) )
+			hp->changed[num++] = hp->changed[ii];
+		else
+			asap->histDirty[hp->changed[ii]] = 0;
+	}
+	hp->numChanged = num;
+	if ( !num )
+		return 0;
+	qsort(hp->changed,num,sizeof(uint32_t),comparePageNums);
+	cp->pageNums = (uint32_t *)malloc(num*sizeof(uint32_t));
+	cp->pages = (uint8_t *)malloc((size_t)num*HIST_PAGE);
+	if ( !cp->pageNums || !cp->pages )
+	{
+		freePages(cp);
+		return 1;
+	}
+	for ( ii = 0; ii < num; ++ii )
+	{
+		off = (uint64_t)hp->changed[ii] << HIST_SHIFT;
+		len = pageLen(hp,off);
+		memcpy(cp->pages + (size_t)ii*HIST_PAGE,hp->shadow+off,len);
+		memcpy(hp->shadow+off,asap->mem+off,len);
+	}
+	memcpy(cp->pageNums,hp->changed,num*sizeof(uint32_t));
+	cp->numPages = num;
+	clearWritten(asap);
+	return 0;
+}
+
+/* Let go of later, the checkpoint after cp. Its pages that cp doesn't have are as they were at cp too. */
+static int mergeInto(Checkpoint_t *cp, Checkpoint_t *later)
+{
+	uint32_t *pageNums;
+	uint8_t *pages;
+	int num = 0, ii = 0, jj = 0;
+
+	pageNums = (uint32_t *)malloc((cp->numPages+later->numPages+1)*sizeof(uint32_t));
+	pages = (uint8_t *)malloc((size_t)(cp->numPages+later->numPages+1)*HIST_PAGE);
+	if ( !pageNums || !pages )
+	{
+		free(pageNums);
+		free(pages);
+		return 1;
+	}
+	while ( ii < cp->numPages || jj < later->numPages )
+	{
+		if ( jj >= later->numPages || (ii < cp->numPages && cp->pageNums[ii] <= later->pageNums[jj]) )
+		{
+			if ( jj < later->numPages && cp->pageNums[ii] == later->pageNums[jj] )
+				++jj;
+			pageNums[num] = cp->pageNums[ii];
+			memcpy(pages + (size_t)num*HIST_PAGE,cp->pages + (size_t)ii*HIST_PAGE,HIST_PAGE);
+			++ii;
+		}
+		else
+		{
+			pageNums[num] = later->pageNums[jj];
+			memcpy(pages + (size_t)num*HIST_PAGE,later->pages + (size_t)jj*HIST_PAGE,HIST_PAGE);
+			++jj;
+		}
+		++num;
+	}
+	freePages(cp);
+	freePages(later);
+	cp->pageNums = pageNums;
+	cp->pages = pages;
+	cp->numPages = num;
+	return 0;
+}
+
+/* Let go of every other checkpoint but the first and last and take them half as often */
+static void thin(History_t *hp)
+{
+	int ii, jj;
+
+	for ( ii = jj = 1; ii < hp->num; ++ii )
+	{
+		if ( (ii&1) && ii < hp->num-1 && !mergeInto(&hp->cps[jj-1],&hp->cps[ii]) )
+			continue;
+		hp->cps[jj++] = hp->cps[ii];
+	}
+	hp->num = jj;
+	hp->interval *= 2;
+}
+
+void historyCheckpoint(Asap_t *asap)
+{
+	History_t *hp = asap->history;
+	struct timespec t0, t1;
+	Checkpoint_t *cp;
+
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	if ( hp->num == HIST_MAX )
+		thin(hp);
+	if ( hp->num == HIST_MAX || (hp->num && keepChanges(asap,&hp->cps[hp->num-1])) )
+	{
+		/* what's kept still goes back to where it did */
+		if ( !hp->full )
+			fprintf(asap->ferr,"Out of memory for checkpoints. No more are taken.\n");
+		hp->full = true;
+		asap->checkpointDue = UINT64_MAX;
+		return;
+	}
+	cp = &hp->cps[hp->num++];
+	memset(cp,0,sizeof(*cp));
+	cp->insns = asap->insns;
+	cp->cycles = asap->cycles;
+	cp->timerDue = timerDue(asap);
+	memcpy(cp->registers,asap->registers,sizeof(cp->registers));
+	memcpy(cp->pcQue,asap->pcQue,sizeof(cp->pcQue));
+	cp->status = readStatus(asap);
+	cp->irqLines = asap->irqLines;
+	replayMark(asap,&cp->input);
+	asap->checkpointDue = asap->insns + hp->interval;
+	++hp->taken;
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	hp->nsecs += (t1.tv_sec - t0.tv_sec)*1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+}
+
+int historyStart(Asap_t *asap, uint64_t interval)
+{
+	const uint8_t *touched;
+	History_t *hp;
+	uint64_t off;
+
+	if ( asap->history )
+	{
+		if ( !interval )
+			interval = asap->history->every;
+		historyFree(asap);
+	}
+	if ( replayKeep(asap) )
+		return 1;
+	hp = (History_t *)calloc(1,sizeof(History_t));
+	if ( !hp )
+	{
+		fprintf(asap->ferr,"Out of memory for checkpoints\n");
+		return 1;
+	}
+	hp->every = hp->interval = interval;
+	hp->top = asap->memSize;
+	hp->shadow = (uint8_t *)mmap(NULL,hp->top,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if ( hp->shadow == MAP_FAILED )
+		hp->shadow = NULL;
+	hp->numPages = (hp->top+HIST_PAGE-1)>>HIST_SHIFT;
+	hp->changed = (uint32_t *)malloc(hp->numPages*sizeof(uint32_t));
+	hp->quiet = fopen("/dev/null","w");
+	asap->history = hp;
+	/* one more for a store at the very top, which is past what's kept */
+	asap->histDirty = (uint8_t *)calloc(hp->numPages+1,1);
+	if ( !hp->shadow || !hp->changed || !hp->quiet || !asap->histDirty )
+	{
+		fprintf(asap->ferr,"Out of memory for checkpoints\n");
+		historyFree(asap);
+		return 1;
+	}
+	touched = memTouched(asap);
+	for ( off = 0; off < hp->top; off += MEM_CHUNK )
+	{
+		if ( !touched || touched[off>>MEM_CHUNK_SHIFT] )
+			memcpy(hp->shadow+off,asap->mem+off,hp->top - off < MEM_CHUNK ? hp->top - off : MEM_CHUNK);
+	}
+	historyCheckpoint(asap);
+	return 0;
+}
+
+/* Put the machine back as it was at checkpoint k and let go of the ones after it */
+static void restoreCheckpoint(Asap_t *asap, int k)
+{
+	History_t *hp = asap->history;
+	Checkpoint_t *cp;
+	uint64_t off;
+	uint32_t len;
+	int ii, jj;
+
+	/* what's been written since the last checkpoint first */
+	errnoWritten(asap);
+	for ( ii = 0; ii < (int)hp->numChanged; ++ii )
+	{
+		off = (uint64_t)hp->changed[ii] << HIST_SHIFT;
+		len = pageLen(hp,off);
+		if ( memcmp(asap->mem+off,hp->shadow+off,len) )
+		{
+			memcpy(asap->mem+off,hp->shadow+off,len);
+			codeWritten(asap,off,len);
+		}
+	}
+	for ( ii = hp->num-1; ii >= k; --ii )
+	{
+		cp = &hp->cps[ii];
+		for ( jj = 0; jj < cp->numPages; ++jj )
+		{
+			off = (uint64_t)cp->pageNums[jj] << HIST_SHIFT;
+			len = pageLen(hp,off);
+			memcpy(asap->mem+off,cp->pages + (size_t)jj*HIST_PAGE,len);
+			memcpy(hp->shadow+off,asap->mem+off,len);
+			codeWritten(asap,off,len);
+		}
+		freePages(cp);
+	}
+	clearWritten(asap);		/* memory is shadow[] again */
+	hp->num = k+1;
+	hp->full = false;
+	cp = &hp->cps[k];
+	memcpy(asap->registers,cp->registers,sizeof(asap->registers));
+	memcpy(asap->pcQue,cp->pcQue,sizeof(asap->pcQue));
+	asap->irqLines = cp->irqLines;
+	asap->cycles = cp->cycles;
+	asap->insns = cp->insns;
+	writeStatus(asap,cp->status);
+	eventsRestart(asap,cp->timerDue);
+	replayRewind(asap,&cp->input);
+	asap->checkpointDue = cp->insns + hp->interval;
+	asap->cannotContinue = false;
+	asap->errorMsg[0] = 0;
+	asap->watchHit = 0;
+	asap->exitStatus = -1;
+}
+
+/* Back to checkpoint k and quietly on from there to until, as runUntil() has it */
+static int rerun(Asap_t *asap, int k, uint64_t until, int num, uint64_t *hit)
+{
+	History_t *hp = asap->history;
+	FILE *fout = asap->fout, *ferr = asap->ferr;
+	int sts;
+
+	restoreCheckpoint(asap,k);
+	fflush(fout);
+	fflush(ferr);
+	asap->fout = asap->ferr = hp->quiet;
+	sts = runUntil(asap,until,num,hit);
+	asap->fout = fout;
+	asap->ferr = ferr;
+	hp->rerun += asap->insns - hp->cps[k].insns;
+	if ( sts )
+		fprintf(asap->fout,"Stopped at %08X (%llu instructions) going back\n",
+				asap->pcQue[0], (unsigned long long)asap->insns);
+	return sts;
+}
+
+/* Newest checkpoint from before insns, -1 if none */
+static int checkpointBefore(const History_t *hp, uint64_t insns)
+{
+	int k;
+
+	for ( k = hp->num-1; k >= 0 && hp->cps[k].insns > insns; --k )
+		;
+	return k;
+}
+
+static bool haveHistory(Asap_t *asap)
+{
+	if ( !asap->history )
+		fprintf(asap->fout,"No history is kept. -H turns it on.\n");
+	return asap->history != NULL;
+}
+
+int historyGoTo(Asap_t *asap, uint64_t target)
+{
+	uint64_t now = asap->insns;
+	int k, sts;
+
+	if ( !haveHistory(asap) )
+		return 1;
+	k = checkpointBefore(asap->history,target);
+	if ( k < 0 )
+	{
+		fprintf(asap->fout,"History only goes back to %llu instructions\n",
+				(unsigned long long)asap->history->cps[0].insns);
+		return 1;
+	}
+	sts = rerun(asap,k,target,0,NULL);
+	if ( asap->insnLimited )
+		asap->insnLeft += now - asap->insns;		/* -n is what's left to go forward */
+	return sts;
+}
+
+int historyReverse(Asap_t *asap, int num)
+{
+	History_t *hp = asap->history;
+	uint64_t now = asap->insns, end = now, hit;
+	int k;
+
+	if ( !haveHistory(asap) )
+		return 1;
+	for ( k = checkpointBefore(hp,now ? now-1 : 0); k >= 0; --k )
+	{
+		/* the newest hit between checkpoint k and end, if any */
+		hit = UINT64_MAX;
+		if ( hp->cps[k].insns >= end )
+			continue;
+		if ( rerun(asap,k,end,num,&hit) )
+			break;
+		if ( hit != UINT64_MAX )
+		{
+			rerun(asap,k,hit,0,NULL);
+			if ( asap->insnLimited )
+				asap->insnLeft += now - asap->insns;
+			return 0;
+		}
+		end = hp->cps[k].insns;
+	}
+	if ( k < 0 )
+	{
+		rerun(asap,0,hp->cps[0].insns,0,NULL);
+		fprintf(asap->fout,"No %s hit since %llu instructions\n",
+				num ? "write" : "breakpoint or watchpoint", (unsigned long long)asap->insns);
+	}
+	if ( asap->insnLimited )
+		asap->insnLeft += now - asap->insns;
+	return 1;
+}
+
+void historyReport(Asap_t *asap)
+{
+	const History_t *hp = asap->history;
+	uint64_t kept = 0;
+	int ii;
+
+	if ( !hp )
+		return;
+	for ( ii = 0; ii < hp->num; ++ii )
+		kept += (uint64_t)hp->cps[ii].numPages*HIST_PAGE;
+	fprintf(asap->fout,"%d checkpoints, one every %llu instructions back to %llu, holding %llu KB (and %llu KB of shadow)\n",
+			hp->num, (unsigned long long)hp->interval, (unsigned long long)hp->cps[0].insns,
+			(unsigned long long)kept/1024, (unsigned long long)hp->top/1024);
+	fprintf(asap->fout,"%llu checkpoints taken in %.3f ms, %llu instructions run again going back\n",
+			(unsigned long long)hp->taken, hp->nsecs/1e6, (unsigned long long)hp->rerun);
+}
+
+void historyFree(Asap_t *asap)
+{
+	History_t *hp = asap->history;
+	int ii;
+
+	if ( !hp )
+		return;
+	for ( ii = 0; ii < hp->num; ++ii )
+		freePages(&hp->cps[ii]);
+	if ( hp->shadow )
+		munmap(hp->shadow,hp->top);
+	free(hp->changed);
+	if ( hp->quiet )
+		fclose(hp->quiet);
+	free(hp);
+	asap->history = NULL;
+	free(asap->histDirty);
+	asap->histDirty = NULL;
+}
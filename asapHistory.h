@@ -0,0 +1,33 @@
+#ifndef _ASAPHISTORY_H_
+#define _ASAPHISTORY_H_
+
+#include "asapExecute.h"
+
+/* Keep checkpoints from here on, one every interval instructions (-H), or
+   if interval is 0 start again from here with whatever it was. Returns
+   non-zero, having said why, if it can't. */
+extern int historyStart(Asap_t *asap, uint64_t interval);
+
+/* Take a checkpoint now. runUntilEvent() does once insns reaches checkpointDue. */
+extern void historyCheckpoint(Asap_t *asap);
+
+/* Go back to when insns was target by going back to the checkpoint before
+   it and running on from there. Returns non-zero, having said why, if
+   there's no checkpoint that far back or the program stops short. */
+extern int historyGoTo(Asap_t *asap, uint64_t target);
+
+/* Go back to the last time a breakpoint or watchpoint (only watchpoint
+   num, if num isn't 0) was hit. Returns non-zero, having said why, if none
+   was in what's kept, after going back as far as it does. */
+extern int historyReverse(Asap_t *asap, int num);
+
+/* Note that len bytes at addr were written, for the next checkpoint.
+   codeWritten() calls it for every store while histDirty is set. */
+extern void historyWritten(Asap_t *asap, uint64_t addr, uint32_t len);
+
+/* Say how many checkpoints there are and what they cost */
+extern void historyReport(Asap_t *asap);
+
+extern void historyFree(Asap_t *asap);
+
+#endif	/* _ASAPHISTORY_H_ */
@@ -0,0 +1,157 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "asapExecute.h"
+#include "asapIo.h"
+#include "asapReplay.h"
+
+/*
+ * ROM and memory mapped devices, for boards with more than plain RAM.
+ *
+ * Memory is still the one array from 0 to memSize (memLen+stackSize, or
+ * all 4GB with -A) and anything not in a region is plain RAM in it,
+ * loaded and stored directly. Regions are kept in a table and looked up,
+ * by the address an access starts at, only for the accesses that might be
+ * in one:
+ *
+ *	Above the top of memory, where the engines never go and everything
+ *	already ends up in the reference handlers. A device there costs
+ *	nothing until it's used.
+ *
+ *	On pages of memory marked in ioPages[] with IO_READ and/or IO_WRITE.
+ *	While there are any the engines look at it, much like watchPages[],
+ *	and leave those accesses to the reference handlers.
+ *
+ * ROM is memory that stores don't change; it's loaded with the image like
+ * the rest. A device gets called for every load and store in its region.
+ * With the -m option:
+ *
+ *	-m rom=from-to			ROM from..to (hex, inclusive)
+ *	-m console=addr		a byte wide console at addr: a store writes the
+ *					byte to the guest's stdout, a load reads one from its stdin (-1 at EOF)
+ */
+
+static uint32_t consoleRead(Asap_t *asap, void *arg, uint32_t addr, int shiftCnt)
+{
+	fflush(asap->fout);
+	return inputChar(asap,INPUT_CONSOLE);
+}
+
+static void consoleWrite(Asap_t *asap, void *arg, uint32_t addr, uint32_t value, int shiftCnt)
+{
+	fputc(value&0xFF,asap->fout);
+}
+
+int addRegion(Asap_t *asap, uint32_t from, uint32_t to, IoRead_t read, IoWrite_t write, void *arg, const char *name)
+{
+	uint64_t top = asap->memSize;
+	uint32_t page, last;
+	IoRegion_t *rp;
+	uint8_t type;
+	int ii;
+
+	if ( to < from || (!read) != (!write) || (!read && to > top) )
+		return 1;
+	if ( from <= top && asap->guardBase )
+		return 1;		/* the engines don't look at ioPages[] with guard pages */
+	for ( ii = 0, rp = asap->regions; ii < asap->numRegions; ++ii, ++rp )
+	{
+		if ( from <= rp->to && to >= rp->from )
+			return 1;		/* they can't overlap */
+	}
+	rp = (IoRegion_t *)realloc(asap->regions,(asap->numRegions+1)*sizeof(IoRegion_t));
+	if ( !rp )
+		return 1;
+	asap->regions = rp;
+	rp += asap->numRegions;
+	if ( from <= top )
+	{
+		if ( !asap->ioPages )
+		{
+			asap->ioPages = (uint8_t *)calloc((top>>IO_SHIFT)+1,1);
+			if ( !asap->ioPages )
+				return 1;
+		}
+		page = from >> IO_SHIFT;
+		last = (to > top ? top : to) >> IO_SHIFT;
+		type = read ? IO_READ|IO_WRITE : IO_WRITE;
+		for ( ; page <= last; ++page )
+			asap->ioPages[page] |= type;
+	}
+	rp->from = from;
+	rp->to = to;
+	rp->read = read;
+	rp->write = write;
+	rp->arg = arg;
+	rp->name = name;
+	++asap->numRegions;
+	asap->codeChanged = true;	/* for blocks and native code to be made again with ioPages[] in mind */
+	return 0;
+}
+
+const IoRegion_t *findRegion(Asap_t *asap, uint32_t addr)
+{
+	const IoRegion_t *rp;
+	int ii;
+
+	for ( ii = 0, rp = asap->regions; ii < asap->numRegions; ++ii, ++rp )
+	{
+		if ( addr >= rp->from && addr <= rp->to )
+			return rp;
+	}
+	return NULL;
+}
+
+int ioOption(Asap_t *asap, const char *spec)
+{
+	const char *val = strchr(spec,'=');
+	char *endp;
+	unsigned long from, to;
+
+	if ( !val || val == spec )
+	{
+		fprintf(asap->ferr,"Invalid memory spec: '%s'. Expected name=value\n", spec);
+		return 1;
+	}
+	++val;
+	from = strtoul(val,&endp,16);
+	if ( endp == val || from > 0xFFFFFFFFUL )
+		goto bad;
+	if ( !strncasecmp(spec,"rom=",4) )
+	{
+		val = endp;
+		if ( *val++ != '-' )
+			goto bad;
+		to = strtoul(val,&endp,16);
+		if ( endp == val || *endp || to > 0xFFFFFFFFUL )
+			goto bad;
+		if ( addRegion(asap,from,to,NULL,NULL,NULL,"rom") )
+		{
+			fprintf(asap->ferr,"Can't make %08lX-%08lX ROM. It has to be in memory (0-%08llX) and not overlap anything else\n",
+					from, to, (unsigned long long)asap->memSize);
+			return 1;
+		}
+		return 0;
+	}
+	if ( !strncasecmp(spec,"console=",8) )
+	{
+		if ( *endp )
+			goto bad;
+		if ( addRegion(asap,from,from,consoleRead,consoleWrite,NULL,"console") )
+		{
+			fprintf(asap->ferr,"Can't put the console at %08lX. It overlaps something else\n", from);
+			return 1;
+		}
+		return 0;
+	}
+	fprintf(asap->ferr,"Unknown memory spec: '%s'\n", spec);
+	return 1;
+bad:
+	fprintf(asap->ferr,"Invalid memory spec: '%s'\n", spec);
+	return 1;
+}
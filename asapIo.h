@@ -0,0 +1,31 @@
+#ifndef _ASAPIO_H_
+#define _ASAPIO_H_
+
+#include "asapExecute.h"
+
+/* A device's registers. shiftCnt is 0, 1 or 2 for a byte, halfword or word. */
+typedef uint32_t (*IoRead_t)(Asap_t *asap, void *arg, uint32_t addr, int shiftCnt);
+typedef void (*IoWrite_t)(Asap_t *asap, void *arg, uint32_t addr, uint32_t value, int shiftCnt);
+
+typedef struct IoRegion_t
+{
+	uint32_t from;			/* first and last address, inclusive */
+	uint32_t to;
+	IoRead_t read;			/* both NULL for ROM */
+	IoWrite_t write;
+	void *arg;
+	const char *name;
+} IoRegion_t;
+
+/* Make from-to (inclusive) ROM, if read and write are NULL, or a device.
+   ROM has to be in memory; devices can be anywhere. Memory has to be
+   set up first. Returns non-zero if it can't be done. */
+extern int addRegion(Asap_t *asap, uint32_t from, uint32_t to, IoRead_t read, IoWrite_t write, void *arg, const char *name);
+
+/* The region addr is in, NULL if none */
+extern const IoRegion_t *findRegion(Asap_t *asap, uint32_t addr);
+
+/* Take one -m spec, once memory is set up. Returns non-zero if it's no good. */
+extern int ioOption(Asap_t *asap, const char *spec);
+
+#endif	/* _ASAPIO_H_ */
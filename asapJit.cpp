@@ -0,0 +1,874 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "asapExecute.h"
+#include "asapJit.h"
+
+/*
+ * Translates blocks to native code for the JIT engine. Only done on x86-64
+ * hosts; anywhere else jitCompile() never has anything to offer and the JIT
+ * engine is no different from the block engine.
+ *
+ * The guest registers, status and pcQue stay where they are in Asap_t and
+ * the generated code reads and writes them there (rbx holds asap and r15
+ * the guest memory). The condition codes of a .C instruction are not
+ * worked out when it executes. Like the interpreter, it leaves its result
+ * and sources in lazyDst, lazySrc1 and lazySrc2 along with lazyMask and
+ * lazyShift, and the status is only made from them when something in the
+ * block reads it (Bcc, GETPS, ADDC, SUBC, JSR.C). Otherwise getStatus()
+ * does it once the native code has returned. Either way Asap_t is always
+ * as it should be, even if the native code is left in the middle of an
+ * instruction by a fault on a guard page (see asapGuard.cpp).
+ *
+ * Anything that would be an error (a bad stack or memory address, a bad
+ * branch) makes the native code return in front of that instruction so the
+ * interpreter can do it and complain the usual way. With guard pages the
+ * memory address isn't checked; pcQue[] is set before each load and store
+ * instead, for the fault to leave the interpreter to it.
+ *
+ * Loads and stores on pages with ROM or devices leave the native code too.
+ *
+ * With timing on, each exit adds the instructions and cycles of the part
+ * of the block done by then, which are known when translating. Only wait
+ * states on loads and stores are counted as they happen.
+ */
+#if defined(__x86_64__)
+
+#define JIT_MEM_SIZE	(16*1024*1024)
+#define JIT_MAX_INSN	(2048)	/* room enough for the code of any one instruction */
+
+/* Host registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* Operand sizes */
+enum { SZ32, SZ64, SZ16 };
+
+/* Conditions of Jcc and SETcc */
+#define CC_B		0x2
+#define CC_AE		0x3
+#define CC_E		0x4
+#define CC_NE		0x5
+#define CC_A		0x7
+
+/* Opcodes taking a ModRM */
+#define OP_ADD		0x01	/* r/m += reg */
+#define OP_OR		0x09
+#define OP_AND		0x21
+#define OP_XOR		0x31
+#define OP_TEST		0x85
+#define OP_TESTB	0x84
+#define OP_MOVB_ST	0x88	/* r/m8 = reg8 */
+#define OP_MOV_ST	0x89	/* r/m = reg */
+#define OP_MOV_LD	0x8B	/* reg = r/m */
+#define OP_MOV_IMM	0xC7
+#define OP_MOVB_IMM	0xC6
+#define OP_NOT		0xF7
+#define OP_BT		0x0FA3
+#define OP_SETE		0x0F94
+#define OP_MOVZXB	0x0FB6
+#define OP_MOVZXW	0x0FB7
+#define OP_MOVSXB	0x0FBE
+#define OP_MOVSXW	0x0FBF
+
+/* ModRM reg field of the immediate (0x81) and shift (0xC1, 0xD3) groups */
+#define X_ADD		0
+#define X_AND		4
+#define X_XOR		6
+#define X_CMP		7
+#define X_SHL		4
+#define X_SHR		5
+#define X_SAR		7
+
+#define ASAP_OFS(field)	((int)offsetof(Asap_t,field))
+#define REG_OFS(reg)	(ASAP_OFS(registers)+4*(reg))
+#define PCQUE_OFS(idx)	(ASAP_OFS(pcQue)+4*(idx))
+
+/* A guest address known when translating or, if inR14, r14 plus addr (a JSR target) */
+typedef struct
+{
+	bool inR14;
+	uint32_t addr;
+} JitPc_t;
+
+typedef struct
+{
+	Asap_t *asap;
+	uint8_t *code;			/* next byte goes here */
+	uint8_t pendMask;		/* lazyMask as it will be when the code gets here */
+	uint8_t pendShift;		/* and lazyShift */
+	Decode_t * const *uops;	/* the block */
+	int uopIdx;				/* and which of them is being translated */
+} Jit_t;
+
+static JitPc_t jitPc(bool inR14, uint32_t addr)
+{
+	JitPc_t ans;
+
+	ans.inR14 = inR14;
+	ans.addr = addr;
+	return ans;
+}
+
+static void emit8(Jit_t *jp, int byte)
+{
+	*jp->code++ = byte;
+}
+
+static void emit32(Jit_t *jp, uint32_t value)
+{
+	memcpy(jp->code,&value,4);
+	jp->code += 4;
+}
+
+static void emit64(Jit_t *jp, uint64_t value)
+{
+	memcpy(jp->code,&value,8);
+	jp->code += 8;
+}
+
+/* Prefixes and opcode. reg, idx and base are the registers going in the ModRM and SIB */
+static void emitOp(Jit_t *jp, int size, int op, int reg, int idx, int base)
+{
+	int rex = 0x40;
+
+	if ( size == SZ16 )
+		emit8(jp,0x66);
+	if ( size == SZ64 )
+		rex |= 8;
+	if ( (reg&8) )
+		rex |= 4;
+	if ( (idx&8) )
+		rex |= 2;
+	if ( (base&8) )
+		rex |= 1;
+	if ( rex != 0x40 )
+		emit8(jp,rex);
+	if ( op > 0xFF )
+		emit8(jp,op>>8);
+	emit8(jp,op&0xFF);
+}
+
+/* op with two registers */
+static void emitRR(Jit_t *jp, int size, int op, int reg, int rm)
+{
+	emitOp(jp,size,op,reg,0,rm);
+	emit8(jp,0xC0|((reg&7)<<3)|(rm&7));
+}
+
+/* op with a register and a field of Asap_t, [rbx+ofs] */
+static void emitRA(Jit_t *jp, int size, int op, int reg, int ofs)
+{
+	emitOp(jp,size,op,reg,0,RBX);
+	emit8(jp,0x80|((reg&7)<<3)|RBX);
+	emit32(jp,ofs);
+}
+
+/* op with a register and the guest memory at eax, [r15+rax] */
+static void emitRM(Jit_t *jp, int size, int op, int reg)
+{
+	emitOp(jp,size,op,reg,RAX,R15);
+	emit8(jp,0x04|((reg&7)<<3));
+	emit8(jp,(RAX<<3)|(R15&7));
+}
+
+/* Two operand ALU op (OP_ADD etc.) and mov between registers: dst op= src */
+static void emitAlu(Jit_t *jp, int size, int op, int dst, int src)
+{
+	emitRR(jp,size,op,src,dst);
+}
+
+/* ALU op with an immediate */
+static void emitImm(Jit_t *jp, int size, int ext, int rm, uint32_t imm)
+{
+	emitRR(jp,size,0x81,ext,rm);
+	emit32(jp,imm);
+}
+
+/* Shift by count or, if count is negative, by cl */
+static void emitShift(Jit_t *jp, int size, int ext, int rm, int count)
+{
+	if ( count < 0 )
+		emitRR(jp,size,0xD3,ext,rm);
+	else
+	{
+		emitRR(jp,size,0xC1,ext,rm);
+		emit8(jp,count);
+	}
+}
+
+static void emitMovImm(Jit_t *jp, int reg, uint32_t imm)
+{
+	emitOp(jp,SZ32,0xB8|(reg&7),0,0,reg);
+	emit32(jp,imm);
+}
+
+static void emitMovImm64(Jit_t *jp, int reg, uint64_t imm)
+{
+	emitOp(jp,SZ64,0xB8|(reg&7),0,0,reg);
+	emit64(jp,imm);
+}
+
+/* Put imm in a 32 bit field of Asap_t */
+static void emitStoreImm(Jit_t *jp, int ofs, uint32_t imm)
+{
+	emitRA(jp,SZ32,OP_MOV_IMM,0,ofs);
+	emit32(jp,imm);
+}
+
+/* Put imm in an 8 bit field of Asap_t */
+static void emitStoreImm8(Jit_t *jp, int ofs, uint8_t imm)
+{
+	emitRA(jp,SZ32,OP_MOVB_IMM,0,ofs);
+	emit8(jp,imm);
+}
+
+/* Jumps return where their displacement goes for patch() */
+static uint8_t *emitJcc(Jit_t *jp, int cc)
+{
+	emit8(jp,0x0F);
+	emit8(jp,0x80|cc);
+	emit32(jp,0);
+	return jp->code-4;
+}
+
+static uint8_t *emitJmp(Jit_t *jp)
+{
+	emit8(jp,0xE9);
+	emit32(jp,0);
+	return jp->code-4;
+}
+
+/* Point the jump whose displacement is at 'at' here */
+static void patch(Jit_t *jp, uint8_t *at)
+{
+	int32_t rel = jp->code - (at+4);
+
+	memcpy(at,&rel,4);
+}
+
+static void emitCall(Jit_t *jp, void *func)
+{
+	emitMovImm64(jp,RAX,(uintptr_t)func);
+	emitRR(jp,SZ32,0xFF,2,RAX);
+}
+
+static void loadReg(Jit_t *jp, int reg, int guest)
+{
+	emitRA(jp,SZ32,OP_MOV_LD,reg,REG_OFS(guest));
+}
+
+static void storeReg(Jit_t *jp, int reg, int guest)
+{
+	if ( guest )
+		emitRA(jp,SZ32,OP_MOV_ST,reg,REG_OFS(guest));
+}
+
+static void loadSrc2(Jit_t *jp, int reg, const Decode_t *dp)
+{
+	if ( (dp->flags&DEC_SRC2REG) )
+		loadReg(jp,reg,dp->src2);
+	else
+		emitMovImm(jp,reg,dp->src2);
+}
+
+/* Set the status bits in mask from lazyDst, lazySrc1 and lazySrc2 the same way mkStatus() does */
+static void emitStatus(Jit_t *jp, int mask, int shiftCnt)
+{
+	emitRA(jp,SZ64,OP_MOV_LD,RDX,ASAP_OFS(lazyDst));
+	emitRA(jp,SZ32,OP_MOV_LD,RAX,ASAP_OFS(status));
+	emitImm(jp,SZ32,X_AND,RAX,~mask);
+	if ( (mask&(CARRY|OVERFLOW)) )
+	{
+		/* r8 = carry, which is bit 32 of the result */
+		emitAlu(jp,SZ64,OP_MOV_ST,R8,RDX);
+		emitShift(jp,SZ64,X_SHR,R8,32);
+		emitImm(jp,SZ32,X_AND,R8,1);
+		if ( (mask&CARRY) )
+			emitAlu(jp,SZ32,OP_OR,RAX,R8);
+	}
+	if ( (mask&OVERFLOW) )
+	{
+		/* Both sources negative and no carry or both positive and a carry */
+		emitRA(jp,SZ64,OP_MOV_LD,R9,ASAP_OFS(lazySrc1));
+		emitRA(jp,SZ64,OP_MOV_LD,R10,ASAP_OFS(lazySrc2));
+		emitAlu(jp,SZ64,OP_MOV_ST,RCX,R9);
+		emitAlu(jp,SZ64,OP_AND,RCX,R10);
+		emitShift(jp,SZ64,X_SHR,RCX,31);
+		emitImm(jp,SZ32,X_AND,RCX,1);			/* ecx = both negative */
+		emitAlu(jp,SZ64,OP_OR,R9,R10);
+		emitShift(jp,SZ64,X_SHR,R9,31);
+		emitImm(jp,SZ32,X_AND,R9,1);
+		emitImm(jp,SZ32,X_XOR,R9,1);				/* r9d = both positive */
+		emitAlu(jp,SZ32,OP_AND,R9,R8);
+		emitAlu(jp,SZ32,OP_MOV_ST,R10,R8);
+		emitImm(jp,SZ32,X_XOR,R10,1);
+		emitAlu(jp,SZ32,OP_AND,RCX,R10);
+		emitAlu(jp,SZ32,OP_OR,RCX,R9);
+		emitShift(jp,SZ32,X_SHL,RCX,1);
+		emitAlu(jp,SZ32,OP_OR,RAX,RCX);
+	}
+	if ( (mask&ZERO) )
+	{
+		emitAlu(jp,SZ32,OP_XOR,RCX,RCX);
+		if ( shiftCnt == 0 )
+			emitRR(jp,SZ32,OP_TESTB,RDX,RDX);
+		else
+			emitRR(jp,shiftCnt == 1 ? SZ16 : SZ32,OP_TEST,RDX,RDX);
+		emitRR(jp,SZ32,OP_SETE,0,RCX);
+		emitShift(jp,SZ32,X_SHL,RCX,2);
+		emitAlu(jp,SZ32,OP_OR,RAX,RCX);
+	}
+	if ( (mask&NEGATIVE) )
+	{
+		emitAlu(jp,SZ32,OP_MOV_ST,RCX,RDX);
+		emitShift(jp,SZ32,X_SHR,RCX,(8<<shiftCnt)-1);
+		emitImm(jp,SZ32,X_AND,RCX,1);
+		emitShift(jp,SZ32,X_SHL,RCX,3);
+		emitAlu(jp,SZ32,OP_OR,RAX,RCX);
+	}
+	emitRA(jp,SZ32,OP_MOV_ST,RAX,ASAP_OFS(status));
+}
+
+/* Bring status up to date before something reads it */
+static void flushStatus(Jit_t *jp)
+{
+	if ( jp->pendMask )
+	{
+		emitStatus(jp,jp->pendMask,jp->pendShift);
+		emitStoreImm8(jp,ASAP_OFS(lazyMask),0);
+		jp->pendMask = 0;
+	}
+}
+
+/* Start of a .C instruction setting the bits in mask. Whatever is pending
+   needn't be made unless it has bits this one doesn't set. */
+static void beginStatus(Jit_t *jp, int mask)
+{
+	if ( (jp->pendMask&~mask) )
+		flushStatus(jp);
+}
+
+/* End of a .C instruction. The result is in reg and, if there is an
+   overflow to be had, the sources are in rax and rcx. */
+static void endStatus(Jit_t *jp, int mask, int shiftCnt, int reg)
+{
+	emitRA(jp,SZ64,OP_MOV_ST,reg,ASAP_OFS(lazyDst));
+	if ( (mask&OVERFLOW) )
+	{
+		emitRA(jp,SZ64,OP_MOV_ST,RAX,ASAP_OFS(lazySrc1));
+		emitRA(jp,SZ64,OP_MOV_ST,RCX,ASAP_OFS(lazySrc2));
+	}
+	if ( jp->pendMask != mask )
+		emitStoreImm8(jp,ASAP_OFS(lazyMask),mask);
+	if ( jp->pendShift != shiftCnt )
+		emitStoreImm8(jp,ASAP_OFS(lazyShift),shiftCnt);
+	jp->pendMask = mask;
+	jp->pendShift = shiftCnt;
+}
+
+static void emitSetPc(Jit_t *jp, int ofs, JitPc_t where)
+{
+	if ( where.inR14 )
+	{
+		emitAlu(jp,SZ32,OP_MOV_ST,RAX,R14);
+		emitImm(jp,SZ32,X_ADD,RAX,where.addr);
+		emitRA(jp,SZ32,OP_MOV_ST,RAX,ofs);
+	}
+	else
+		emitStoreImm(jp,ofs,where.addr);
+}
+
+/* Count the first done instructions of the block, if timing */
+static void emitCount(Jit_t *jp, int done)
+{
+	uint32_t cycles = 0;
+	int ii;
+
+	if ( !jp->asap->timing || !done )
+		return;
+	for ( ii = 0; ii < done; ++ii )
+		cycles += jp->uops[ii]->cycles;
+	emitRA(jp,SZ64,0x81,X_ADD,ASAP_OFS(insns));
+	emit32(jp,done);
+	emitRA(jp,SZ64,0x81,X_ADD,ASAP_OFS(cycles));
+	emit32(jp,cycles);
+}
+
+/* Return ret from the native code with pcQue[] at pc and npc, done
+   instructions of the block having been */
+static void emitExit(Jit_t *jp, JitPc_t pc, JitPc_t npc, int ret, int done)
+{
+	emitCount(jp,done);
+	emitSetPc(jp,PCQUE_OFS(0),pc);
+	emitSetPc(jp,PCQUE_OFS(1),npc);
+	emitMovImm(jp,RAX,ret);
+	emit8(jp,0x41);		/* pop r15 */
+	emit8(jp,0x5F);
+	emit8(jp,0x41);		/* pop r14 */
+	emit8(jp,0x5E);
+	emit8(jp,0x5B);		/* pop rbx */
+	emit8(jp,0xC3);		/* ret */
+}
+
+/* Have the numFix jumps in fix[] leave the native code in front of the instruction at pc */
+static void emitSideExit(Jit_t *jp, uint8_t **fix, int numFix, JitPc_t pc, JitPc_t npc)
+{
+	uint8_t *over = emitJmp(jp);
+	int ii;
+
+	for ( ii = 0; ii < numFix; ++ii )
+		patch(jp,fix[ii]);
+	emitExit(jp,pc,npc,1,jp->uopIdx);
+	patch(jp,over);
+}
+
+/* Effective address of LEA/LD/ST/JSR into eax. Leaves the native code if
+   getLSargs() would complain about the stack or, if chkMem, if it is
+   outside memory. With guard pages chkMem just sets pcQue[] for a fault.
+   With -A nothing is outside memory and the stack can be anywhere. */
+static void emitEA(Jit_t *jp, const Decode_t *dp, int shiftCnt, bool chkMem, JitPc_t pc, JitPc_t npc)
+{
+	Asap_t *asap = jp->asap;
+	uint32_t top = asap->memSize;
+	uint8_t *fix[3], *notStack = NULL;
+	int numFix = 0;
+
+	if ( chkMem && asap->guardBase )
+	{
+		emitSetPc(jp,PCQUE_OFS(0),pc);
+		emitSetPc(jp,PCQUE_OFS(1),npc);
+		chkMem = false;
+	}
+	if ( asap->wholeSpace )
+		chkMem = false;
+	loadReg(jp,RAX,dp->src1Reg);
+	if ( (dp->flags&DEC_SRC2REG) )
+	{
+		loadReg(jp,RCX,dp->src2);
+		emitAlu(jp,SZ32,OP_MOV_ST,RDX,RCX);
+		if ( shiftCnt )
+			emitShift(jp,SZ32,X_SHL,RDX,shiftCnt);
+		emitAlu(jp,SZ32,OP_ADD,RAX,RDX);
+	}
+	else if ( dp->src2 )
+		emitImm(jp,SZ32,X_ADD,RAX,dp->src2<<shiftCnt);
+	if ( (dp->src1Reg == 29 || (dp->flags&DEC_SRC2REG)) && !asap->wholeSpace )
+	{
+		if ( dp->src1Reg != 29 )
+		{
+			/* Like getLSargs(), it's the contents of the src2 register that counts */
+			emitImm(jp,SZ32,X_CMP,RCX,29);
+			notStack = emitJcc(jp,CC_NE);
+		}
+		emitImm(jp,SZ32,X_CMP,RAX,asap->memLen);
+		fix[numFix++] = emitJcc(jp,CC_B);
+		emitImm(jp,SZ32,X_CMP,RAX,top);
+		fix[numFix++] = emitJcc(jp,CC_A);
+		if ( notStack )
+			patch(jp,notStack);
+	}
+	if ( chkMem )
+	{
+		emitImm(jp,SZ32,X_CMP,RAX,top);
+		fix[numFix++] = emitJcc(jp,CC_A);
+	}
+	if ( numFix )
+		emitSideExit(jp,fix,numFix,pc,npc);
+}
+
+/* The status was just written by the instruction being translated. Like
+   putStatus(), have the interrupt looked for if /IRQ is asserted, leaving
+   the native code for it to be taken in front of pc. */
+static void emitIrqCheck(Jit_t *jp, JitPc_t pc, JitPc_t npc)
+{
+	uint8_t *none;
+
+	emitRA(jp,SZ32,0x83,X_CMP,ASAP_OFS(irqLines));
+	emit8(jp,0);
+	none = emitJcc(jp,CC_E);
+	emitRA(jp,SZ64,OP_MOV_IMM,0,ASAP_OFS(nextCheck));
+	emit32(jp,0);
+	emitExit(jp,pc,npc,0,jp->uopIdx+1);
+	patch(jp,none);
+}
+
+/* Leave the native code in front of the load or store at eax if its page
+   has ROM or a device that wants it (type is IO_READ or IO_WRITE) */
+static void emitIoCheck(Jit_t *jp, uint8_t type, JitPc_t pc, JitPc_t npc)
+{
+	uint8_t *fix;
+
+	if ( !jp->asap->ioPages )
+		return;
+	emitRA(jp,SZ64,OP_MOV_LD,RDX,ASAP_OFS(ioPages));
+	emitAlu(jp,SZ32,OP_MOV_ST,RCX,RAX);
+	emitShift(jp,SZ32,X_SHR,RCX,IO_SHIFT);
+	emitOp(jp,SZ32,0xF6,0,RCX,RDX);		/* test byte [rdx+rcx],type */
+	emit8(jp,0x04);
+	emit8(jp,(RCX<<3)|RDX);
+	emit8(jp,type);
+	fix = emitJcc(jp,CC_NE);
+	emitSideExit(jp,&fix,1,pc,npc);
+}
+
+/* Add the wait states of a load or store at eax to cycles */
+static void emitWaits(Jit_t *jp)
+{
+	if ( !jp->asap->waitPages )
+		return;
+	emitRA(jp,SZ64,OP_MOV_LD,RDX,ASAP_OFS(waitPages));
+	emitAlu(jp,SZ32,OP_MOV_ST,RCX,RAX);
+	emitShift(jp,SZ32,X_SHR,RCX,WAIT_SHIFT);
+	emitOp(jp,SZ32,OP_MOVZXB,RCX,RCX,RDX);	/* movzx ecx,byte [rdx+rcx] */
+	emit8(jp,0x04|(RCX<<3));
+	emit8(jp,(RCX<<3)|RDX);
+	emitRA(jp,SZ64,OP_ADD,RCX,ASAP_OFS(cycles));
+}
+
+static void emitAluInsn(Jit_t *jp, const Decode_t *dp)
+{
+	bool cc = (dp->flags&DEC_CC);
+	int mask = NEGATIVE|ZERO;
+
+	switch (dp->opcode)
+	{
+	case 0x05:		/* SUBR */
+	case 0x08:		/* ADD */
+	case 0x09:		/* SUB */
+		mask |= CARRY|OVERFLOW;
+		if ( cc )
+			beginStatus(jp,mask);
+		break;
+	case 0x0A:		/* ADDC */
+	case 0x0B:		/* SUBC */
+		mask |= CARRY|OVERFLOW;
+		flushStatus(jp);		/* they want the carry */
+		break;
+	default:
+		if ( cc )
+			beginStatus(jp,mask);
+		break;
+	}
+	loadReg(jp,RAX,dp->src1Reg);
+	loadSrc2(jp,RCX,dp);
+	switch (dp->opcode)
+	{
+	case 0x05:		/* SUBR */
+		emitRR(jp,SZ32,OP_NOT,2,RAX);
+		emitImm(jp,SZ64,X_ADD,RAX,1);
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RCX);
+		emitAlu(jp,SZ64,OP_ADD,RDX,RAX);
+		break;
+	case 0x06:		/* XOR */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitAlu(jp,SZ64,OP_XOR,RDX,RCX);
+		break;
+	case 0x07:		/* XORN */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RCX);
+		emitRR(jp,SZ64,OP_NOT,2,RDX);
+		emitAlu(jp,SZ64,OP_XOR,RDX,RAX);
+		break;
+	case 0x08:		/* ADD */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitAlu(jp,SZ64,OP_ADD,RDX,RCX);
+		break;
+	case 0x09:		/* SUB */
+		emitRR(jp,SZ32,OP_NOT,2,RCX);
+		emitImm(jp,SZ64,X_ADD,RCX,1);
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitAlu(jp,SZ64,OP_ADD,RDX,RCX);
+		break;
+	case 0x0A:		/* ADDC */
+		emitRA(jp,SZ32,OP_MOV_LD,RDX,ASAP_OFS(status));
+		emitImm(jp,SZ32,X_AND,RDX,CARRY);
+		emitAlu(jp,SZ64,OP_ADD,RDX,RAX);
+		emitAlu(jp,SZ64,OP_ADD,RDX,RCX);
+		break;
+	case 0x0B:		/* SUBC */
+		emitRR(jp,SZ32,OP_NOT,2,RCX);
+		emitRA(jp,SZ32,OP_MOV_LD,RDX,ASAP_OFS(status));
+		emitImm(jp,SZ32,X_AND,RDX,CARRY);
+		emitAlu(jp,SZ64,OP_ADD,RCX,RDX);
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitAlu(jp,SZ64,OP_ADD,RDX,RCX);
+		break;
+	case 0x0C:		/* AND */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitAlu(jp,SZ64,OP_AND,RDX,RCX);
+		break;
+	case 0x0D:		/* ANDN */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RCX);
+		emitRR(jp,SZ64,OP_NOT,2,RDX);
+		emitAlu(jp,SZ64,OP_AND,RDX,RAX);
+		break;
+	case 0x0E:		/* OR */
+	case 0x0F:		/* ORN (an OR, same as the interpreter) */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitAlu(jp,SZ64,OP_OR,RDX,RCX);
+		break;
+	case 0x18:		/* ASHR */
+	case 0x19:		/* LSHR */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitShift(jp,SZ64,X_SAR,RDX,-1);
+		break;
+	case 0x1A:		/* SHL */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitShift(jp,SZ64,X_SHL,RDX,-1);
+		break;
+	case 0x1B:		/* ROTL */
+		emitAlu(jp,SZ64,OP_MOV_ST,RDX,RAX);
+		emitShift(jp,SZ64,X_SHL,RDX,-1);
+		emitAlu(jp,SZ64,OP_MOV_ST,R8,RDX);
+		emitShift(jp,SZ64,X_SAR,R8,32);
+		emitAlu(jp,SZ64,OP_OR,RDX,R8);
+		break;
+	}
+	if ( cc )
+		endStatus(jp,mask,2,RDX);
+	storeReg(jp,RDX,dp->dstReg);
+}
+
+/* Native code for an instruction other than a branch at pc, followed by npc */
+static void emitInsn(Jit_t *jp, const Decode_t *dp, JitPc_t pc, JitPc_t npc)
+{
+	static const int LoadOps[8] = { OP_MOV_LD, OP_MOVSXW, OP_MOVZXW, 0, 0, OP_MOVSXB, OP_MOVZXB, 0 };
+	Asap_t *asap = jp->asap;
+	bool cc = (dp->flags&DEC_CC);
+	uint8_t *noCode, *same;
+	int shiftCnt;
+
+	switch (dp->opcode)
+	{
+	case 0x03:		/* LEA */
+	case 0x04:		/* LEAS */
+		shiftCnt = dp->opcode == 0x03 ? 2 : 1;
+		if ( cc )
+			beginStatus(jp,NEGATIVE|ZERO);
+		emitEA(jp,dp,shiftCnt,false,pc,npc);
+		if ( cc )
+			endStatus(jp,NEGATIVE|ZERO,shiftCnt,RAX);
+		storeReg(jp,RAX,dp->dstReg);
+		break;
+	case 0x10:		/* LD */
+	case 0x11:		/* LDS */
+	case 0x12:		/* LDUS */
+	case 0x15:		/* LDB */
+	case 0x16:		/* LDUB */
+		shiftCnt = dp->opcode == 0x10 ? 2 : dp->opcode < 0x15 ? 1 : 0;
+		if ( cc )
+			beginStatus(jp,NEGATIVE|ZERO);
+		emitEA(jp,dp,shiftCnt,true,pc,npc);
+		emitIoCheck(jp,IO_READ,pc,npc);
+		emitWaits(jp);
+		emitRM(jp,SZ32,LoadOps[dp->opcode-0x10],RAX);
+		if ( cc )
+			endStatus(jp,NEGATIVE|ZERO,shiftCnt,RAX);
+		storeReg(jp,RAX,dp->dstReg);
+		break;
+	case 0x13:		/* STS */
+	case 0x14:		/* ST */
+	case 0x17:		/* STB */
+		shiftCnt = dp->opcode == 0x14 ? 2 : dp->opcode == 0x13 ? 1 : 0;
+		if ( cc )
+			beginStatus(jp,NEGATIVE|ZERO);
+		emitEA(jp,dp,shiftCnt,true,pc,npc);
+		emitIoCheck(jp,IO_WRITE,pc,npc);
+		emitWaits(jp);
+		loadReg(jp,RCX,dp->dstReg);
+		if ( shiftCnt == 0 )
+		{
+			emitRM(jp,SZ32,OP_MOVB_ST,RCX);
+			emitRR(jp,SZ32,OP_MOVZXB,RCX,RCX);
+		}
+		else
+			emitRM(jp,shiftCnt == 1 ? SZ16 : SZ32,OP_MOV_ST,RCX);
+		if ( cc )
+			endStatus(jp,NEGATIVE|ZERO,shiftCnt,RCX);
+		/* Stores into the image may be over code */
+		emitImm(jp,SZ32,X_CMP,RAX,asap->numDecodes*4);
+		noCode = emitJcc(jp,CC_AE);
+		emitAlu(jp,SZ64,OP_MOV_ST,RDI,RBX);
+		emitAlu(jp,SZ32,OP_MOV_ST,RSI,RAX);
+		emitMovImm(jp,RDX,1<<shiftCnt);
+		emitCall(jp,(void *)codeWritten);
+		emitRA(jp,SZ32,0x80,X_CMP,ASAP_OFS(codeChanged));
+		emit8(jp,0);
+		same = emitJcc(jp,CC_E);
+		emitExit(jp,npc,jitPc(npc.inR14,npc.addr+4),0,jp->uopIdx+1);
+		patch(jp,same);
+		patch(jp,noCode);
+		break;
+	case 0x1C:		/* GETPS */
+		flushStatus(jp);
+		emitRA(jp,SZ32,OP_MOV_LD,RAX,ASAP_OFS(status));
+		storeReg(jp,RAX,dp->dstReg);
+		break;
+	case 0x1D:		/* PUTPS */
+		if ( jp->pendMask )
+			emitStoreImm8(jp,ASAP_OFS(lazyMask),0);
+		jp->pendMask = 0;		/* it's all replaced */
+		loadSrc2(jp,RAX,dp);
+		emitImm(jp,SZ32,X_AND,RAX,0x3F);
+		emitRA(jp,SZ32,OP_MOV_ST,RAX,ASAP_OFS(status));
+		emitIrqCheck(jp,npc,jitPc(npc.inR14,npc.addr+4));
+		break;
+	default:
+		emitAluInsn(jp,dp);
+		break;
+	}
+}
+
+JitCode_t jitCompile(Asap_t *asap, Decode_t * const *uops, int numUops, uint32_t pc)
+{
+	Jit_t jit, *jp = &jit;
+	const Decode_t *dp;
+	uint8_t *start, *notTaken, shift;
+	JitPc_t here, next;
+	uint32_t target;
+	int ii;
+
+	if ( !asap->jitMem )
+	{
+		if ( asap->jitSize )
+			return NULL;		/* tried before and failed */
+		asap->jitSize = JIT_MEM_SIZE;
+		asap->jitMem = (uint8_t *)mmap(NULL,asap->jitSize,PROT_READ|PROT_WRITE|PROT_EXEC,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if ( asap->jitMem == MAP_FAILED )
+		{
+			asap->jitMem = NULL;
+			return NULL;
+		}
+	}
+	jp->asap = asap;
+	jp->code = start = asap->jitMem + asap->jitUsed;
+	jp->pendMask = 0;
+	jp->pendShift = 0xFF;	/* lazyShift could be anything */
+	jp->uops = uops;
+	if ( jp->code + JIT_MAX_INSN > asap->jitMem + asap->jitSize )
+		return NULL;
+	emit8(jp,0x53);		/* push rbx */
+	emit8(jp,0x41);		/* push r14 */
+	emit8(jp,0x56);
+	emit8(jp,0x41);		/* push r15 */
+	emit8(jp,0x57);
+	emitAlu(jp,SZ64,OP_MOV_ST,RBX,RDI);
+	emitRA(jp,SZ64,OP_MOV_LD,R15,ASAP_OFS(mem));
+	for ( ii = 0; ii < numUops; ++ii, pc += 4 )
+	{
+		if ( jp->code + JIT_MAX_INSN > asap->jitMem + asap->jitSize )
+			return NULL;
+		dp = uops[ii];
+		jp->uopIdx = ii;
+		here = jitPc(false,pc);
+		next = jitPc(false,pc+4);
+		switch (dp->opcode)
+		{
+		case 0x01:		/* Bcc */
+			target = pc + dp->src2;
+			if ( dp->dstReg >= 16 || target > asap->memLen )
+			{
+				emitExit(jp,here,next,1,ii);
+				goto done;
+			}
+			flushStatus(jp);
+			emitRA(jp,SZ32,OP_MOV_LD,RAX,ASAP_OFS(status));
+			emitImm(jp,SZ32,X_AND,RAX,0xF);
+			emitMovImm(jp,RCX,BranchTaken[dp->dstReg]);
+			emitRR(jp,SZ32,OP_BT,RAX,RCX);
+			notTaken = emitJcc(jp,CC_AE);
+			shift = jp->pendShift;
+			jp->uopIdx = ii+1;
+			emitInsn(jp,uops[ii+1],next,jitPc(false,target));
+			emitExit(jp,jitPc(false,target),jitPc(false,target+4),0,ii+2);
+			/* the delay slot is done again below, with status as it was */
+			jp->pendMask = 0;
+			jp->pendShift = shift;
+			patch(jp,notTaken);
+			++ii;
+			pc += 4;
+			emitInsn(jp,uops[ii],next,jitPc(false,pc+4));
+			break;
+		case 0x02:		/* BSR */
+			target = pc + dp->src2;
+			if ( target > asap->memLen )
+			{
+				emitExit(jp,here,next,1,ii);
+				goto done;
+			}
+			if ( dp->dstReg )
+				emitStoreImm(jp,REG_OFS(dp->dstReg),pc+BSR_INC);
+			jp->uopIdx = ii+1;
+			emitInsn(jp,uops[ii+1],next,jitPc(false,target));
+			emitExit(jp,jitPc(false,target),jitPc(false,target+4),0,ii+2);
+			goto done;
+		case 0x1E:		/* JSR */
+			if ( (dp->flags&DEC_CC) )
+				flushStatus(jp);
+			emitEA(jp,dp,2,false,here,next);
+			emitAlu(jp,SZ32,OP_MOV_ST,R14,RAX);
+			if ( dp->dstReg )
+				emitStoreImm(jp,REG_OFS(dp->dstReg),pc+BSR_INC);
+			if ( (dp->flags&DEC_CC) )
+			{
+				/* P goes to I */
+				emitRA(jp,SZ32,OP_MOV_LD,RAX,ASAP_OFS(status));
+				emitAlu(jp,SZ32,OP_MOV_ST,RCX,RAX);
+				emitImm(jp,SZ32,X_AND,RCX,PIENABLE);
+				emitShift(jp,SZ32,X_SHR,RCX,1);
+				emitImm(jp,SZ32,X_AND,RAX,0x2F);
+				emitAlu(jp,SZ32,OP_OR,RAX,RCX);
+				emitRA(jp,SZ32,OP_MOV_ST,RAX,ASAP_OFS(status));
+				emitIrqCheck(jp,next,jitPc(true,0));
+			}
+			jp->uopIdx = ii+1;
+			emitInsn(jp,uops[ii+1],next,jitPc(true,0));
+			emitExit(jp,jitPc(true,0),jitPc(true,4),0,ii+2);
+			goto done;
+		default:
+			emitInsn(jp,dp,here,next);
+			break;
+		}
+	}
+	emitExit(jp,jitPc(false,pc),jitPc(false,pc+4),0,numUops);
+done:
+	asap->jitUsed = jp->code - asap->jitMem;
+	return (JitCode_t)start;
+}
+
+/* Forget all the native code */
+void jitFlush(Asap_t *asap)
+{
+	asap->jitUsed = 0;
+}
+
+void jitFree(Asap_t *asap)
+{
+	if ( asap->jitMem )
+		munmap(asap->jitMem,asap->jitSize);
+	asap->jitMem = NULL;
+	asap->jitSize = 0;
+	asap->jitUsed = 0;
+}
+
+#else
+
+JitCode_t jitCompile(Asap_t *asap, Decode_t * const *uops, int numUops, uint32_t pc)
+{
+	return NULL;
+}
+
+void jitFlush(Asap_t *asap)
+{
+}
+
+void jitFree(Asap_t *asap)
+{
+}
+
+#endif	/* __x86_64__ */
@@ -0,0 +1,15 @@
+#ifndef _ASAPJIT_H_
+#define _ASAPJIT_H_
+
+#include "asapExecute.h"
+
+/* Native code for a block. Returns 0 if it ran to the end of the block or
+   1 if the instruction at pcQue[0] has to be done by the interpreter. Either
+   way pcQue[0] and pcQue[1] say where to carry on from. */
+typedef int (*JitCode_t)(Asap_t *asap);
+
+extern JitCode_t jitCompile(Asap_t *asap, Decode_t * const *uops, int numUops, uint32_t pc);
+extern void jitFlush(Asap_t *asap);
+extern void jitFree(Asap_t *asap);		/* give back jitMem */
+
+#endif	/* _ASAPJIT_H_ */
@@ -0,0 +1,321 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "asapExecute.h"
+#include "asapReplay.h"
+#include "asapTiming.h"
+
+/*
+ * Recording and playing back what the guest reads (-I).
+ *
+ *	-I record=path		everything read from stdin is written to path too
+ *	-I replay=path		and is read from there instead of stdin
+ *
+ * so a run that reads from a tty can be done again exactly, with any
+ * engine. The log is REPLAY_MAGIC, a byte of REPLAY_VERSION and a byte of
+ * flags (REPLAY_TIMED when instructions are counted, which -I turns on)
+ * followed by a record for every read:
+ *
+ *	kind			a byte, INPUT_xxx
+ *	pc				of the instruction doing the read
+ *	insns			instructions since the last record
+ *	INPUT_FGETC, INPUT_CONSOLE:
+ *		value+1		so EOF is 0
+ *	INPUT_FGETS:
+ *		len			0 if fgets() gave NULL, else 1 more than the
+ *					number of bytes that follow
+ *
+ * Everything but kind is an unsigned LEB128 number (7 bits a byte, low
+ * bits first, the top bit set on all but the last byte). When playing back
+ * the kind, pc and instruction count of each read are checked against the
+ * log and the first that differs is complained about. The log keeps being
+ * used in order regardless. Once it runs out everything reads EOF.
+ *
+ * Going back in time (-H) rewinds the log (to a temporary file if -I
+ * didn't give one) so what was read after that point is read again the
+ * same way. When recording, the log is played back up to where it got to
+ * and only then is stdin read again.
+ */
+
+#define REPLAY_MAGIC	"ASAPRPL"
+#define REPLAY_VERSION	(1)
+#define REPLAY_TIMED	(1<<0)
+
+typedef struct Replay_t
+{
+	FILE *fp;
+	const char *path;
+	bool playing;			/* else recording */
+	bool timed;				/* the log has instruction counts */
+	bool complained;		/* about going a different way than the log */
+	bool reading;			/* recording, but rewound and playing back up to end */
+	long end;				/* recording: how far the log goes */
+	uint64_t lastInsns;		/* at the last record */
+} Replay_t;
+
+static const char * const KindNames[] = { "?", "fgetc", "fgets", "console" };
+
+static void putNum(FILE *fp, uint64_t num)
+{
+	while ( num >= 0x80 )
+	{
+		fputc((num&0x7F)|0x80,fp);
+		num >>= 7;
+	}
+	fputc(num,fp);
+}
+
+/* Returns false at the end of the log */
+static bool getNum(FILE *fp, uint64_t *num)
+{
+	int cc, shift = 0;
+
+	*num = 0;
+	do
+	{
+		cc = fgetc(fp);
+		if ( cc == EOF || shift > 63 )
+			return false;
+		*num |= (uint64_t)(cc&0x7F) << shift;
+		shift += 7;
+	} while ( cc&0x80 );
+	return true;
+}
+
+static void startLog(Asap_t *asap, Replay_t *rp)
+{
+	rp->timed = asap->timing;
+	fwrite(REPLAY_MAGIC,1,sizeof(REPLAY_MAGIC),rp->fp);
+	fputc(REPLAY_VERSION,rp->fp);
+	fputc(rp->timed ? REPLAY_TIMED : 0,rp->fp);
+	rp->end = ftell(rp->fp);
+}
+
+/* True if the next read comes from the log */
+static bool fromLog(Replay_t *rp)
+{
+	if ( rp->playing )
+		return true;
+	if ( rp->reading && ftell(rp->fp) < rp->end )
+		return true;
+	if ( rp->reading )
+	{
+		/* caught up. Writing after reading needs a seek anyway */
+		fseek(rp->fp,rp->end,SEEK_SET);
+		rp->reading = false;
+	}
+	return false;
+}
+
+int replayOption(Asap_t *asap, const char *spec)
+{
+	Replay_t *rp;
+	char magic[sizeof(REPLAY_MAGIC)];
+	bool playing;
+	int flags;
+
+	if ( !strncasecmp(spec,"record=",7) )
+		playing = false;
+	else if ( !strncasecmp(spec,"replay=",7) )
+		playing = true;
+	else
+	{
+		fprintf(asap->ferr,"Invalid input spec: '%s'. Expected record=path or replay=path\n", spec);
+		return 1;
+	}
+	if ( asap->replay )
+	{
+		fprintf(asap->ferr,"Only one of -I record and -I replay, once\n");
+		return 1;
+	}
+	timingDefaults(asap);		/* so each read is logged with when */
+	rp = (Replay_t *)calloc(1,sizeof(Replay_t));
+	if ( !rp )
+	{
+		fprintf(asap->ferr,"Out of memory for -I\n");
+		return 1;
+	}
+	rp->path = spec+7;
+	rp->playing = playing;
+	rp->fp = fopen(rp->path,playing ? "rb" : "w+b");
+	if ( !rp->fp )
+	{
+		fprintf(asap->ferr,"Unable to open '%s': %s\n", rp->path, strerror(errno));
+		free(rp);
+		return 1;
+	}
+	if ( playing )
+	{
+		if (    fread(magic,1,sizeof(magic),rp->fp) != sizeof(magic)
+			 || memcmp(magic,REPLAY_MAGIC,sizeof(magic))
+			 || fgetc(rp->fp) != REPLAY_VERSION
+			 || (flags = fgetc(rp->fp)) == EOF )
+		{
+			fprintf(asap->ferr,"'%s' is not a version %d input log\n", rp->path, REPLAY_VERSION);
+			fclose(rp->fp);
+			free(rp);
+			return 1;
+		}
+		rp->timed = (flags&REPLAY_TIMED) != 0;
+	}
+	else
+		startLog(asap,rp);
+	asap->replay = rp;
+	return 0;
+}
+
+int replayKeep(Asap_t *asap)
+{
+	Replay_t *rp;
+
+	if ( asap->replay )
+		return 0;
+	rp = (Replay_t *)calloc(1,sizeof(Replay_t));
+	if ( rp )
+		rp->fp = tmpfile();
+	if ( !rp || !rp->fp )
+	{
+		fprintf(asap->ferr,"Unable to make a temporary file for input: %s\n", strerror(errno));
+		free(rp);
+		return 1;
+	}
+	rp->path = "(temporary)";
+	startLog(asap,rp);
+	asap->replay = rp;
+	return 0;
+}
+
+void replayMark(Asap_t *asap, ReplayMark_t *mark)
+{
+	Replay_t *rp = asap->replay;
+
+	mark->offset = rp ? ftell(rp->fp) : 0;
+	mark->lastInsns = rp ? rp->lastInsns : 0;
+}
+
+void replayRewind(Asap_t *asap, const ReplayMark_t *mark)
+{
+	Replay_t *rp = asap->replay;
+
+	if ( !rp )
+		return;
+	fseek(rp->fp,mark->offset,SEEK_SET);
+	rp->reading = !rp->playing;
+	rp->lastInsns = mark->lastInsns;
+}
+
+/* The next record's kind, pc and instruction count, checked. Returns false at the end of the log. */
+static bool playHead(Asap_t *asap, int how)
+{
+	Replay_t *rp = asap->replay;
+	uint64_t pc, insns;
+	int kind;
+
+	kind = fgetc(rp->fp);
+	if ( kind == EOF || !getNum(rp->fp,&pc) || !getNum(rp->fp,&insns) )
+	{
+		if ( !rp->complained )
+			fprintf(asap->ferr,"Input log '%s' ran out at %08X. Reading EOF from now on.\n", rp->path, asap->pcQue[0]);
+		rp->complained = true;
+		return false;
+	}
+	insns += rp->lastInsns;
+	if (    !rp->complained
+		 && (    kind != how || pc != asap->pcQue[0]
+			  || (rp->timed && asap->timing && insns != asap->insns)) )
+	{
+		fprintf(asap->ferr,"%s at %08X (%llu instructions) isn't what '%s' has, %s at %08X (%llu instructions). Playing it back anyway.\n",
+				KindNames[how], asap->pcQue[0], (unsigned long long)asap->insns, rp->path,
+				KindNames[kind <= INPUT_CONSOLE ? kind : 0], (uint32_t)pc, (unsigned long long)insns);
+		rp->complained = true;
+	}
+	rp->lastInsns = insns;
+	return true;
+}
+
+static void recordHead(Asap_t *asap, int how)
+{
+	Replay_t *rp = asap->replay;
+	uint64_t insns = rp->timed ? asap->insns : 0;
+
+	fputc(how,rp->fp);
+	putNum(rp->fp,asap->pcQue[0]);
+	putNum(rp->fp,insns - rp->lastInsns);
+	rp->lastInsns = insns;
+}
+
+int inputChar(Asap_t *asap, int how)
+{
+	Replay_t *rp = asap->replay;
+	uint64_t num;
+	int cc;
+
+	if ( rp && fromLog(rp) )
+	{
+		if ( !playHead(asap,how) || !getNum(rp->fp,&num) )
+			return EOF;
+		return (int)num - 1;
+	}
+	cc = fgetc(asap->fin);
+	if ( rp )
+	{
+		recordHead(asap,how);
+		putNum(rp->fp,cc+1);
+		rp->end = ftell(rp->fp);
+	}
+	return cc;
+}
+
+char *inputLine(Asap_t *asap, char *buf, int len)
+{
+	Replay_t *rp = asap->replay;
+	uint64_t num;
+	char *ret;
+	int cc;
+
+	if ( rp && fromLog(rp) )
+	{
+		if ( !playHead(asap,INPUT_FGETS) || !getNum(rp->fp,&num) || !num )
+			return NULL;
+		/* what won't fit (if len isn't what it was) is dropped */
+		for ( ret = buf; --num; )
+		{
+			cc = fgetc(rp->fp);
+			if ( cc == EOF )
+				break;
+			if ( ret < buf+len-1 )
+				*ret++ = cc;
+		}
+		if ( len > 0 )
+			*ret = 0;
+		return buf;
+	}
+	ret = fgets(buf,len,asap->fin);
+	if ( rp )
+	{
+		recordHead(asap,INPUT_FGETS);
+		num = ret ? strlen(buf) : 0;
+		putNum(rp->fp,ret ? num+1 : 0);
+		fwrite(buf,1,num,rp->fp);
+		rp->end = ftell(rp->fp);
+	}
+	return ret;
+}
+
+void replayClose(Asap_t *asap)
+{
+	Replay_t *rp = asap->replay;
+
+	if ( !rp )
+		return;
+	if ( fclose(rp->fp) && !rp->playing )
+		fprintf(asap->ferr,"Error writing '%s': %s\n", rp->path, strerror(errno));
+	free(rp);
+	asap->replay = NULL;
+}
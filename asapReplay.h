@@ -0,0 +1,37 @@
+#ifndef _ASAPREPLAY_H_
+#define _ASAPREPLAY_H_
+
+#include "asapExecute.h"
+
+/* What the guest is reading with */
+#define INPUT_FGETC		(1)		/* SYSCALL_FGETC */
+#define INPUT_FGETS		(2)		/* SYSCALL_FGETS */
+#define INPUT_CONSOLE	(3)		/* the console device */
+
+/* Take one -I spec: record=path or replay=path. Returns non-zero if it's no good. */
+extern int replayOption(Asap_t *asap, const char *spec);
+
+/* fgetc() and fgets() on the guest's stdin, recorded or played back if -I says so */
+extern int inputChar(Asap_t *asap, int how);
+extern char *inputLine(Asap_t *asap, char *buf, int len);
+
+/* Where the log is, to go back to */
+typedef struct
+{
+	long offset;
+	uint64_t lastInsns;
+} ReplayMark_t;
+
+/* Make sure what's read is logged, to a temporary file if -I didn't say where. Returns non-zero if it can't be. */
+extern int replayKeep(Asap_t *asap);
+
+/* Where the log is now (or all zeros if there isn't one) and going back
+   there. What's been read since is played back from the log again before
+   anything more is read from stdin. */
+extern void replayMark(Asap_t *asap, ReplayMark_t *mark);
+extern void replayRewind(Asap_t *asap, const ReplayMark_t *mark);
+
+/* Finish off the recording or play back, if any */
+extern void replayClose(Asap_t *asap);
+
+#endif	/* _ASAPREPLAY_H_ */
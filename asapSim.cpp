@@ -0,0 +1,323 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <errno.h>
+
+#include "asapExecute.h"
+#include "asapSim.h"
+#include "asapGuard.h"
+#include "asapTiming.h"
+#include "asapReplay.h"
+#include "asapHistory.h"
+#include "asapVlda.h"
+
+#ifndef PAGEMAP_SCAN
+/* Linux 6.7's, for headers older than that */
+struct page_region
+{
+	uint64_t start, end, categories;
+};
+struct pm_scan_arg
+{
+	uint64_t size, flags, start, end, walk_end, vec, vec_len, max_pages;
+	uint64_t category_inverted, category_mask, category_anyof_mask, return_mask;
+};
+#define PAGE_IS_PRESENT		(1<<3)
+#define PAGE_IS_SWAPPED		(1<<4)
+#define PAGEMAP_SCAN		_IOWR('f',16,struct pm_scan_arg)
+#endif
+
+Asap_t *asapCreate(void)
+{
+	Asap_t *asap;
+
+	asap = (Asap_t *)calloc(1,sizeof(Asap_t));
+	if ( !asap )
+		return NULL;
+	asap->fin = stdin;
+	asap->fout = stdout;
+	asap->ferr = stderr;
+	asap->stackSize = 32768;
+	asap->exitStatus = -1;
+	return asap;
+}
+
+int asapAllocMem(Asap_t *asap, bool guard)
+{
+	asap->memSize = asap->wholeSpace ? (uint64_t)1<<32 : (uint64_t)asap->memLen+asap->stackSize;
+	if ( guard )
+		asap->mem = guardAlloc(asap,asap->memSize+4);	/* the +4 is for an access at the very top */
+	else
+	{
+		/* a mapping, so the image can be mapped over the start of it, with
+		   4 bytes more for an access at the very top, as with -g. With -A it
+		   is only address space (and a page more) until the guest touches
+		   it, a page at a time. */
+		asap->memMapLen = asap->wholeSpace ? asap->memSize+getpagesize() : asap->memSize+4;
+		asap->mem = (uint8_t *)mmap(NULL,asap->memMapLen,PROT_READ|PROT_WRITE,
+									MAP_PRIVATE|MAP_ANONYMOUS|(asap->wholeSpace ? MAP_NORESERVE : 0),-1,0);
+		if ( asap->mem == MAP_FAILED )
+		{
+			asap->mem = NULL;
+			asap->memMapLen = 0;
+		}
+	}
+	if ( !asap->mem )
+	{
+		fprintf(asap->fout,"Unable to allocate %llu bytes\n", (unsigned long long)asap->memSize);
+		return 1;
+	}
+	asap->numDecodes = (asap->memLen+3)/4;
+	asap->decodes = (Decode_t *)calloc(asap->numDecodes,sizeof(Decode_t));
+	if ( !asap->decodes )
+	{
+		fprintf(asap->fout,"Unable to allocate %d bytes for decoded instructions\n", (int)(asap->numDecodes*sizeof(Decode_t)));
+		return 1;
+	}
+	/* execution starts at 0 */
+	asap->pcQue[0] = 0;
+	asap->pcQue[1] = 4;
+	asap->pcQue[2] = 8;
+	return 0;
+}
+
+/* Read all len bytes at the start of fd into buf, however many reads it
+   takes. Returns how many there were or -1 on error. Leaves the file
+   offset alone, so fd can be shared. */
+static ssize_t readAll(int fd, uint8_t *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t sts;
+
+	while ( got < len )
+	{
+		sts = pread(fd, buf+got, len-got, got);
+		if ( sts < 0 && errno == EINTR )
+			continue;
+		if ( sts < 0 )
+			return -1;
+		if ( sts == 0 )
+			break;
+		got += sts;
+	}
+	return got;
+}
+
+/*
+ * The image is mapped copy on write over the start of memory rather than
+ * read into it. Pages are only read in as they're touched and every
+ * instance of the simulator running the same image shares them (with the
+ * page cache too) until it writes to them. The rest of the last page and
+ * the stack above it come from the anonymous mapping underneath. Guard
+ * pages (-g) put the top of memory rather than the start on a page
+ * boundary, so then, or if the file can't be mapped, it is read.
+ * The linker's own output (.hex) is loaded by asapVlda.cpp.
+ */
+int asapLoadImage(Asap_t *asap, const char *path, bool guard)
+{
+	int fd, sts;
+
+	fd = open(path, O_RDONLY);
+	if ( fd < 0 )
+	{
+		fprintf(asap->fout,"Unable to open for read '%s': %s\n", path, strerror(errno));
+		return 1;
+	}
+	sts = asapLoadFd(asap,fd,path,guard);
+	close(fd);
+	return sts;
+}
+
+int asapLoadFd(Asap_t *asap, int fd, const char *path, bool guard)
+{
+	const char *ext = strrchr(path,'.');
+	struct stat st;
+	ssize_t sts;
+
+	if ( ext && !strcasecmp(ext,".hex") )
+		return vldaLoad(asap,fd,path,guard);
+	if ( fstat(fd, &st) < 0 )
+	{
+		fprintf(asap->fout,"Unable to stat '%s': %s\n", path, strerror(errno));
+		return 1;
+	}
+	if ( st.st_size <= 0 )
+	{
+		fprintf(asap->fout,"Premature EOF on '%s'\n", path);
+		return 1;
+	}
+	asap->memLen = st.st_size;
+	if ( asapAllocMem(asap,guard) )
+		return 1;
+	sts = -1;
+	if ( asap->memMapLen )
+	{
+		if ( mmap(asap->mem,asap->memLen,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,0) != MAP_FAILED )
+			sts = asap->memLen;
+		else if ( mmap(asap->mem,asap->memLen,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED,-1,0) == MAP_FAILED )
+		{
+			/* a failed MAP_FIXED can take what was there with it */
+			fprintf(asap->fout,"Unable to map '%s': %s\n", path, strerror(errno));
+			return 1;
+		}
+	}
+	if ( sts < 0 )
+		sts = readAll(fd, asap->mem, asap->memLen);
+	if ( sts < 0 )
+	{
+		fprintf(asap->fout,"Error reading '%s': %s\n", path, strerror(errno));
+		return 1;
+	}
+	if ( sts < (ssize_t)asap->memLen )
+	{
+		fprintf(asap->fout,"Premature EOF on '%s' after %d of %d bytes\n", path, (int)sts, asap->memLen);
+		return 1;
+	}
+	return timingInit(asap);
+}
+
+/* Mark the chunks from..to has pages in. Returns 1 if the kernel can't say that way */
+static int scanTouched(Asap_t *asap, int fd, uint64_t from, uint64_t to)
+{
+	struct page_region regions[64];
+	struct pm_scan_arg arg;
+	uint64_t addr, end;
+	long num, ii;
+
+	memset(&arg,0,sizeof(arg));
+	arg.size = sizeof(arg);
+	arg.start = (uintptr_t)(asap->mem+from);
+	arg.end = (uintptr_t)(asap->mem+to);
+	arg.vec = (uintptr_t)regions;
+	arg.vec_len = sizeof(regions)/sizeof(regions[0]);
+	arg.category_anyof_mask = arg.return_mask = PAGE_IS_PRESENT|PAGE_IS_SWAPPED;
+	while ( arg.start < arg.end )
+	{
+		num = ioctl(fd,PAGEMAP_SCAN,&arg);
+		if ( num < 0 || arg.walk_end <= arg.start )
+			return 1;
+		for ( ii = 0; ii < num; ++ii )
+		{
+			end = regions[ii].end - (uintptr_t)asap->mem;
+			for ( addr = regions[ii].start - (uintptr_t)asap->mem; addr < end; addr = (addr|(MEM_CHUNK-1))+1 )
+				asap->touched[addr>>MEM_CHUNK_SHIFT] = 1;
+		}
+		arg.start = arg.walk_end;
+	}
+	return 0;
+}
+
+/* The same a page at a time, from pagemap's entries */
+static int readTouched(Asap_t *asap, int fd, uint64_t from, uint64_t to)
+{
+	uint64_t entries[8192], addr;
+	size_t pageSize = getpagesize(), num, ii;
+
+	for ( addr = from; addr < to; addr += num*pageSize )
+	{
+		num = (to-addr)/pageSize;
+		if ( num > sizeof(entries)/sizeof(entries[0]) )
+			num = sizeof(entries)/sizeof(entries[0]);
+		if ( pread(fd,entries,num*sizeof(entries[0]),((uintptr_t)(asap->mem+addr)/pageSize)*sizeof(entries[0]))
+			 != (ssize_t)(num*sizeof(entries[0])) )
+			return 1;
+		for ( ii = 0; ii < num; ++ii )
+		{
+			if ( entries[ii]&(3ULL<<62) )	/* present, swapped */
+				asap->touched[(addr+ii*pageSize)>>MEM_CHUNK_SHIFT] = 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Which of the 4GB has been touched comes from /proc/self/pagemap: a page
+ * that is present or swapped out has been read or written, the rest are
+ * still the zeros the kernel hands out. The image's pages are the file's
+ * until written, so count whether they're in or not. A chunk once touched
+ * stays that way (at worst it's zeros again, and gets looked at for
+ * nothing), so touched[] is kept and only the runs of chunks not touched
+ * yet are looked up again. PAGEMAP_SCAN skips what has no pages in a few
+ * microseconds; reading pagemap's 8MB of entries for the 4GB takes
+ * milliseconds and is only done on kernels without it.
+ */
+const uint8_t *memTouched(Asap_t *asap)
+{
+	uint64_t chunks = asap->memSize>>MEM_CHUNK_SHIFT, ck, end;
+	int fd, sts = 0;
+
+	if ( !asap->wholeSpace )
+		return NULL;
+	if ( !asap->touched )
+	{
+		asap->touched = (uint8_t *)calloc(chunks,1);
+		if ( !asap->touched )
+			return NULL;
+		memset(asap->touched,1,((uint64_t)asap->memLen+MEM_CHUNK-1)>>MEM_CHUNK_SHIFT);
+	}
+	fd = open("/proc/self/pagemap",O_RDONLY);
+	if ( fd < 0 )
+		return NULL;
+	for ( ck = 0; ck < chunks && !sts; ck = end )
+	{
+		if ( asap->touched[ck] )
+		{
+			end = ck+1;
+			continue;
+		}
+		for ( end = ck+1; end < chunks && !asap->touched[end]; ++end )
+			;
+		if ( asap->noPagemapScan || scanTouched(asap,fd,ck<<MEM_CHUNK_SHIFT,end<<MEM_CHUNK_SHIFT) )
+		{
+			asap->noPagemapScan = true;
+			sts = readTouched(asap,fd,ck<<MEM_CHUNK_SHIFT,end<<MEM_CHUNK_SHIFT);
+		}
+	}
+	close(fd);
+	return sts ? NULL : asap->touched;
+}
+
+int asapLoadBuffer(Asap_t *asap, const uint8_t *image, uint32_t len, bool guard)
+{
+	asap->memLen = len;
+	if ( asapAllocMem(asap,guard) )
+		return 1;
+	memcpy(asap->mem,image,len);
+	return timingInit(asap);
+}
+
+void asapDestroy(Asap_t *asap)
+{
+	if ( !asap )
+		return;
+	historyFree(asap);
+	replayClose(asap);
+	freeExecution(asap);
+	if ( asap->guardBase )
+		munmap(asap->guardBase,asap->guardSize);
+	else if ( asap->memMapLen )
+		munmap(asap->mem,asap->memMapLen);
+	free(asap->regions);
+	free(asap->touched);
+	free(asap->ioPages);
+	free(asap->waitPages);
+	free(asap->waitRegions);
+	free(asap->events);
+	free(asap->syms);
+	free(asap->symValues);
+	free(asap->symNames);
+	free(asap->segs);
+	if ( asap->stbFileContents )
+		munmap((void *)asap->stbFileContents,asap->stbFileLen);
+	free(asap);
+}
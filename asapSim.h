@@ -0,0 +1,53 @@
+#ifndef _ASAPSIM_H_
+#define _ASAPSIM_H_
+
+#include "asapExecute.h"
+
+/*
+ * libasapsim: the simulator without main.cpp. Every Asap_t is a CPU of its
+ * own with its own memory, symbols, devices and guest stdin/stdout/stderr
+ * (fin, fout and ferr) so any number of them can be run at once, a thread
+ * each. The usual sequence is
+ *
+ *	asap = asapCreate();
+ *	asap->fout = ...;  timingOption(asap,...);  and so on, as main() does
+ *	asapLoadImage(asap,path,false);
+ *	ioOption(asap,...);  get_stb(asap);  if wanted
+ *	simulateAsap(asap);
+ *	... asap->exitStatus ...
+ *	asapDestroy(asap);
+ *
+ * Interactive mode uses readline and catches SIGINT, which are the
+ * process's, so it is for one context at a time.
+ */
+
+/* A context with nothing loaded and the guest's I/O on stdin, stdout and
+   stderr. NULL if out of memory. */
+extern Asap_t *asapCreate(void);
+
+/* Read the image at path into memory of its own with stackSize bytes of
+   stack above it (or at the start of all 4GB if wholeSpace, -A), with
+   guard pages if guard (-g), and do timingInit(). If path ends in .hex
+   it is the linker's VLDA output instead (see asapVlda.cpp).
+   Returns non-zero, having said why, if it can't. */
+extern int asapLoadImage(Asap_t *asap, const char *path, bool guard);
+
+/* The same with the image open on fd, which is left open (path is for
+   messages and, if it ends in .hex, says what fd has). The file offset isn't used, so any number of contexts,
+   on any threads, can load from the one fd and share its pages. */
+extern int asapLoadFd(Asap_t *asap, int fd, const char *path, bool guard);
+
+/* The same with the image already in memory. It is copied so any number
+   of contexts can be loaded from the one buffer. */
+extern int asapLoadBuffer(Asap_t *asap, const uint8_t *image, uint32_t len, bool guard);
+
+/* Memory for memLen bytes of image with stackSize bytes of stack above it
+   (or all 4GB with wholeSpace), all zeros, and the predecoded instructions
+   to go with it, with pcQue[] at 0. For loaders that fill it themselves.
+   Returns non-zero, having said why, if it can't. */
+extern int asapAllocMem(Asap_t *asap, bool guard);
+
+/* Give back the context and everything hanging off it. Doesn't close fin, fout or ferr. */
+extern void asapDestroy(Asap_t *asap);
+
+#endif	/* _ASAPSIM_H_ */
@@ -0,0 +1,341 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "asapExecute.h"
+#include "asapSnap.h"
+#include "asapEvent.h"
+
+/*
+ * Snapshots (save and restore commands, -r and -w options).
+ *
+ * A snapshot is the registers, pcQue, status, the cycle count and the
+ * timer, the breakpoints and watchpoints, and guest memory. Memory is kept
+ * as SNAP_PAGE sized pages and only those with something other than zeros
+ * in them are written, which leaves out the stack and BSS a program hasn't
+ * got to yet (and with -A, whatever of the 4GB it hasn't touched, which
+ * isn't even looked at). The file is, in host byte order:
+ *
+ *	SnapHeader_t
+ *	SnapBreak_t[numBreaks]
+ *	uint32_t[numPages]		page numbers of the pages that follow
+ *	zeros up to a multiple of SNAP_PAGE
+ *	numPages pages of SNAP_PAGE bytes
+ *
+ * Restoring maps the file rather than reading it. Unless memory has guard
+ * pages (-g) the stored pages are mapped copy-on-write straight over guest
+ * memory, on top of a fresh anonymous map of it all for the zeros between
+ * them, so nothing is copied and a page is only read in once the guest
+ * uses it. Saving replaces the file rather than writing over it for that
+ * reason. Anything about the layout that changes has to change
+ * SNAP_VERSION.
+ */
+
+#define SNAP_MAGIC		"ASAPSNAP"
+#define SNAP_VERSION	(1)
+#define SNAP_PAGE		(4096)
+#define SNAP_MAX_RUNS	(8192)	/* of pages to map, more are copied (each is a mapping) */
+
+typedef struct
+{
+	char magic[8];			/* SNAP_MAGIC */
+	uint32_t version;		/* SNAP_VERSION */
+	uint32_t memLen;		/* has to match what's loaded */
+	uint32_t stackSize;		/* this too, memory above the image (the rest of 4GB with -A) */
+	uint32_t numPages;		/* pages of memory stored */
+	uint32_t numBreaks;
+	uint32_t status;
+	uint32_t registers[32];
+	uint32_t pcQue[3];
+	uint32_t irqLines;
+	uint64_t cycles;
+	uint64_t insns;
+	uint64_t timerDue;		/* next timer interrupt, 0 if none */
+} SnapHeader_t;
+
+typedef struct
+{
+	uint32_t addr;
+	uint32_t end;
+	int32_t num;
+	uint8_t type;
+	uint8_t enabled;
+	uint8_t pad[2];
+} SnapBreak_t;
+
+static bool pageUsed(const uint8_t *page, uint32_t len)
+{
+	const uint8_t *end = page + len;
+
+	for ( ; page < end; ++page )
+	{
+		if ( *page )
+			return true;
+	}
+	return false;
+}
+
+int snapSave(Asap_t *asap, const char *path)
+{
+	SnapHeader_t hdr;
+	SnapBreak_t sb;
+	const uint8_t *touched = memTouched(asap);
+	uint64_t top = asap->memSize, off;
+	uint32_t len, *pages;
+	static const uint8_t zeros[SNAP_PAGE] = { 0 };
+	struct stat st;
+	size_t pos;
+	FILE *fp;
+	int ii, sts;
+
+	pages = (uint32_t *)malloc(((top+SNAP_PAGE-1)/SNAP_PAGE)*sizeof(uint32_t));
+	if ( !pages )
+	{
+		fprintf(asap->fout,"Unable to allocate memory for a snapshot\n");
+		return 1;
+	}
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,SNAP_MAGIC,sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.memLen = asap->memLen;
+	hdr.stackSize = asap->memSize - asap->memLen;
+	hdr.numBreaks = asap->numBreaks;
+	hdr.status = readStatus(asap);
+	memcpy(hdr.registers,asap->registers,sizeof(hdr.registers));
+	memcpy(hdr.pcQue,asap->pcQue,sizeof(hdr.pcQue));
+	hdr.irqLines = asap->irqLines;
+	hdr.cycles = asap->cycles;
+	hdr.insns = asap->insns;
+	hdr.timerDue = timerDue(asap);
+	for ( off = 0; off < top; off += SNAP_PAGE )
+	{
+		if ( touched && !touched[off>>MEM_CHUNK_SHIFT] )
+		{
+			off += MEM_CHUNK - SNAP_PAGE;
+			continue;
+		}
+		len = top - off < SNAP_PAGE ? top - off : SNAP_PAGE;
+		if ( pageUsed(asap->mem + off, len) )
+			pages[hdr.numPages++] = off/SNAP_PAGE;
+	}
+	/* memory may be mapped from the old one, so it mustn't be truncated */
+	if ( !stat(path,&st) && S_ISREG(st.st_mode) )
+		unlink(path);
+	fp = fopen(path,"wb");
+	if ( !fp )
+	{
+		fprintf(asap->fout,"Unable to create '%s': %s\n", path, strerror(errno));
+		free(pages);
+		return 1;
+	}
+	fwrite(&hdr,sizeof(hdr),1,fp);
+	for ( ii = 0; ii < asap->numBreaks; ++ii )
+	{
+		memset(&sb,0,sizeof(sb));
+		sb.addr = asap->breaks[ii].addr;
+		sb.end = asap->breaks[ii].end;
+		sb.num = asap->breaks[ii].num;
+		sb.type = asap->breaks[ii].type;
+		sb.enabled = asap->breaks[ii].enabled;
+		fwrite(&sb,sizeof(sb),1,fp);
+	}
+	fwrite(pages,sizeof(uint32_t),hdr.numPages,fp);
+	pos = sizeof(hdr) + hdr.numBreaks*sizeof(SnapBreak_t) + hdr.numPages*sizeof(uint32_t);
+	if ( pos % SNAP_PAGE )
+		fwrite(zeros,1,SNAP_PAGE - pos%SNAP_PAGE,fp);
+	for ( ii = 0; ii < (int)hdr.numPages; ++ii )
+	{
+		/* the last page of memory may be short */
+		off = (uint64_t)pages[ii]*SNAP_PAGE;
+		len = top - off < SNAP_PAGE ? top - off : SNAP_PAGE;
+		fwrite(asap->mem + off,1,len,fp);
+		if ( len < SNAP_PAGE )
+			fwrite(zeros,1,SNAP_PAGE-len,fp);
+	}
+	free(pages);
+	sts = ferror(fp);
+	if ( fclose(fp) || sts )
+	{
+		fprintf(asap->fout,"Error writing '%s': %s\n", path, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Put the numPages pages at data (pos into fd) in place by mapping them over
+ * a fresh anonymous map of all of memory. Returns -1, having changed
+ * nothing, if memory can't be mapped over, and 1 if it's gone.
+ */
+static int mapPages(Asap_t *asap, int fd, const uint32_t *pages, uint32_t numPages, size_t pos, const uint8_t *data)
+{
+	uint32_t ii, jj, runs = 0;
+	uint64_t off;
+	size_t len;
+
+	if ( !asap->memMapLen || SNAP_PAGE % getpagesize() )
+		return -1;
+	for ( ii = 0; ii < numPages; ++ii )
+	{
+		if ( !ii || pages[ii] != pages[ii-1]+1 )
+			++runs;
+	}
+	if ( runs > SNAP_MAX_RUNS )
+		return -1;
+	if ( mmap(asap->mem,asap->memMapLen,PROT_READ|PROT_WRITE,
+			  MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|(asap->wholeSpace ? MAP_NORESERVE : 0),-1,0) == MAP_FAILED )
+		return 1;
+	for ( ii = 0; ii < numPages; ii = jj )
+	{
+		for ( jj = ii+1; jj < numPages && pages[jj] == pages[jj-1]+1; ++jj )
+			;
+		off = (uint64_t)pages[ii]*SNAP_PAGE;
+		len = (size_t)(jj-ii)*SNAP_PAGE;
+		if ( mmap(asap->mem+off,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,pos+(size_t)ii*SNAP_PAGE) != MAP_FAILED )
+			continue;
+		/* a failed MAP_FIXED can take what was there with it */
+		if ( mmap(asap->mem+off,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED,-1,0) == MAP_FAILED )
+			return 1;
+		memcpy(asap->mem+off,data+(size_t)ii*SNAP_PAGE,len);
+	}
+	return 0;
+}
+
+int snapRestore(Asap_t *asap, const char *path)
+{
+	const SnapHeader_t *hdr;
+	const SnapBreak_t *sb;
+	const uint32_t *pages;
+	const uint8_t *data;
+	BreakPoint_t *breaks = NULL;
+	const uint8_t *touched;
+	uint64_t top = asap->memSize, off;
+	uint32_t len;
+	size_t pos, fileLen;
+	struct stat st;
+	uint8_t *map;
+	int fd, ii, mapped, sts = 1;
+
+	fd = open(path,O_RDONLY);
+	if ( fd < 0 )
+	{
+		fprintf(asap->fout,"Unable to open for read '%s': %s\n", path, strerror(errno));
+		return 1;
+	}
+	if ( fstat(fd,&st) < 0 || (fileLen = st.st_size) < sizeof(SnapHeader_t) )
+	{
+		fprintf(asap->fout,"'%s' is not a snapshot\n", path);
+		close(fd);
+		return 1;
+	}
+	map = (uint8_t *)mmap(NULL,fileLen,PROT_READ,MAP_PRIVATE,fd,0);
+	if ( map == MAP_FAILED )
+	{
+		fprintf(asap->fout,"Unable to map '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	hdr = (const SnapHeader_t *)map;
+	sb = (const SnapBreak_t *)(hdr+1);
+	pages = (const uint32_t *)(sb + hdr->numBreaks);
+	pos = sizeof(*hdr) + (uint64_t)hdr->numBreaks*sizeof(*sb) + (uint64_t)hdr->numPages*sizeof(*pages);
+	pos = (pos + SNAP_PAGE-1) & ~(size_t)(SNAP_PAGE-1);
+	data = map + pos;
+	if ( memcmp(hdr->magic,SNAP_MAGIC,sizeof(hdr->magic)) || hdr->version != SNAP_VERSION )
+	{
+		fprintf(asap->fout,"'%s' is not a version %d snapshot\n", path, SNAP_VERSION);
+		goto done;
+	}
+	if ( hdr->memLen != asap->memLen || hdr->stackSize != (uint32_t)(top - asap->memLen) )
+	{
+		fprintf(asap->fout,"'%s' is of a 0x%X byte image with 0x%X bytes of stack, not 0x%X and 0x%X\n",
+				path, hdr->memLen, hdr->stackSize, asap->memLen, (uint32_t)(top - asap->memLen));
+		goto done;
+	}
+	if ( hdr->numBreaks > 65536 || hdr->numPages > (top+SNAP_PAGE-1)/SNAP_PAGE || pos + (uint64_t)hdr->numPages*SNAP_PAGE != fileLen )
+	{
+		fprintf(asap->fout,"'%s' is the wrong size for what it holds\n", path);
+		goto done;
+	}
+	for ( ii = 0; ii < (int)hdr->numPages; ++ii )
+	{
+		if ( (uint64_t)pages[ii]*SNAP_PAGE >= top || (ii && pages[ii] <= pages[ii-1]) )
+		{
+			fprintf(asap->fout,"'%s' has a bad page number\n", path);
+			goto done;
+		}
+	}
+	if ( hdr->numBreaks )
+	{
+		breaks = (BreakPoint_t *)calloc(hdr->numBreaks,sizeof(BreakPoint_t));
+		if ( !breaks )
+		{
+			fprintf(asap->fout,"Unable to allocate memory for %d breakpoints\n", hdr->numBreaks);
+			goto done;
+		}
+		for ( ii = 0; ii < (int)hdr->numBreaks; ++ii )
+		{
+			breaks[ii].addr = sb[ii].addr;
+			breaks[ii].end = sb[ii].end;
+			breaks[ii].num = sb[ii].num;
+			breaks[ii].type = sb[ii].type;
+			breaks[ii].enabled = sb[ii].enabled != 0;
+		}
+	}
+	if ( replaceBreaks(asap,breaks,hdr->numBreaks) )
+		goto done;
+	touched = memTouched(asap);
+	mapped = mapPages(asap,fd,pages,hdr->numPages,pos,data);
+	if ( mapped > 0 )
+	{
+		fprintf(asap->fout,"Unable to map '%s' into memory: %s\n", path, strerror(errno));
+		asap->cannotContinue = true;
+		goto done;
+	}
+	if ( mapped < 0 )
+	{
+		/* what hasn't been touched is zeros already, and stays out of memory */
+		for ( off = 0; off < top; off += MEM_CHUNK )
+		{
+			if ( !touched || touched[off>>MEM_CHUNK_SHIFT] )
+				memset(asap->mem+off,0,top - off < MEM_CHUNK ? top - off : MEM_CHUNK);
+		}
+		for ( ii = 0; ii < (int)hdr->numPages; ++ii )
+		{
+			off = (uint64_t)pages[ii]*SNAP_PAGE;
+			len = top - off < SNAP_PAGE ? top - off : SNAP_PAGE;
+			memcpy(asap->mem + off, data + (size_t)ii*SNAP_PAGE, len);
+		}
+	}
+	else if ( asap->touched )
+	{
+		/* the mapped pages aren't in memory until used, but they're not zeros */
+		for ( ii = 0; ii < (int)hdr->numPages; ++ii )
+			asap->touched[((uint64_t)pages[ii]*SNAP_PAGE)>>MEM_CHUNK_SHIFT] = 1;
+	}
+	codeWritten(asap,0,asap->memLen);	/* all there are predecoded instructions for */
+	memcpy(asap->registers,hdr->registers,sizeof(asap->registers));
+	memcpy(asap->pcQue,hdr->pcQue,sizeof(asap->pcQue));
+	asap->irqLines = hdr->irqLines;
+	asap->cycles = hdr->cycles;
+	asap->insns = hdr->insns;
+	writeStatus(asap,hdr->status);
+	eventsRestart(asap,hdr->timerDue);
+	asap->cannotContinue = false;
+	asap->errorMsg[0] = 0;
+	asap->watchHit = 0;
+	sts = 0;
+done:
+	free(breaks);
+	munmap(map,fileLen);
+	close(fd);
+	return sts;
+}
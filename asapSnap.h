@@ -0,0 +1,14 @@
+#ifndef _ASAPSNAP_H_
+#define _ASAPSNAP_H_
+
+#include "asapExecute.h"
+
+/* Write the state of the machine to path. Returns non-zero, having said why, if it can't. */
+extern int snapSave(Asap_t *asap, const char *path);
+
+/* Put the machine back the way a snapshot at path has it. The image it
+   was taken with (or one the same size) has to be loaded and the stack the
+   same size. Returns non-zero, having said why and changed nothing, if it can't. */
+extern int snapRestore(Asap_t *asap, const char *path);
+
+#endif	/* _ASAPSNAP_H_ */
@@ -0,0 +1,234 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "asapExecute.h"
+#include "asapTiming.h"
+#include "asapEvent.h"
+
+/*
+ * Cycle counting, for the -t option.
+ *
+ * asap.doc has instructions taking one or two cycles and the chip running
+ * at anything from 4MHz with 200ns ROMs to 20MHz. By default loads, stores,
+ * JSR and exceptions take two cycles and everything else one. Any of that
+ * can be changed and memory can be given wait states:
+ *
+ *	-t clock=MHz			clock to turn cycles into time (default 20)
+ *	-t wait=from-to:n		n wait states on every fetch, load and store
+ *					in from..to (hex, inclusive)
+ *	-t NAME=n			opcode NAME (LD, ADD, Bcc, ILLEGAL ...) takes n cycles
+ *	-t timer=n			interrupt every n cycles (see asapEvent.cpp)
+ *
+ * Wait states are kept for 256 byte pages, so a region should start and end
+ * on a page boundary. Where regions share a page the slowest wins.
+ *
+ * The cost of an instruction including the wait states of fetching it is
+ * worked out when it is decoded and kept in Decode_t.cycles. The block and
+ * JIT engines add up a block's worth at a time. Wait states on data are
+ * added by whichever handler does the access.
+ */
+
+typedef struct WaitRegion_t
+{
+	uint32_t from;
+	uint32_t to;
+	uint8_t waits;
+} WaitRegion_t;
+
+typedef struct
+{
+	const char *name;
+	uint8_t cycles;
+} OpCycles_t;
+
+static const OpCycles_t DefCycles[32] =
+{
+	{ "ILLEGAL", 2 },	/* 0x00 */
+	{ "Bcc",  1 },	/* 0x01 */
+	{ "BSR",  1 },	/* 0x02 */
+	{ "LEA",  1 },	/* 0x03 */
+	{ "LEAS", 1 },	/* 0x04 */
+	{ "SUBR", 1 },	/* 0x05 */
+	{ "XOR",  1 },	/* 0x06 */
+	{ "XORN", 1 },	/* 0x07 */
+	{ "ADD",  1 },	/* 0x08 */
+	{ "SUB",  1 },	/* 0x09 */
+	{ "ADDC", 1 },	/* 0x0A */
+	{ "SUBC", 1 },	/* 0x0B */
+	{ "AND",  1 },	/* 0x0C */
+	{ "ANDN", 1 },	/* 0x0D */
+	{ "OR",   1 },	/* 0x0E */
+	{ "ORN",  1 },	/* 0x0F */
+	{ "LD",   2 },	/* 0x10 */
+	{ "LDS",  2 },	/* 0x11 */
+	{ "LDUS", 2 },	/* 0x12 */
+	{ "STS",  2 },	/* 0x13 */
+	{ "ST",   2 },	/* 0x14 */
+	{ "LDB",  2 },	/* 0x15 */
+	{ "LDUB", 2 },	/* 0x16 */
+	{ "STB",  2 },	/* 0x17 */
+	{ "ASHR", 1 },	/* 0x18 */
+	{ "LSHR", 1 },	/* 0x19 */
+	{ "SHL",  1 },	/* 0x1A */
+	{ "ROTL", 1 },	/* 0x1B */
+	{ "GETPS", 1 },	/* 0x1C */
+	{ "PUTPS", 1 },	/* 0x1D */
+	{ "JSR",  2 },	/* 0x1E */
+	{ "ILLEGAL", 2 }	/* 0x1F */
+};
+
+void timingDefaults(Asap_t *asap)
+{
+	int ii;
+
+	if ( asap->timing )
+		return;
+	for (ii=0; ii < 32; ++ii)
+		asap->opCycles[ii] = DefCycles[ii].cycles;
+	asap->clockMHz = 20.0;
+	asap->timing = true;
+}
+
+int timingOption(Asap_t *asap, const char *spec)
+{
+	const char *val = strchr(spec,'=');
+	char *endp;
+	unsigned long from, to, num;
+	double mhz;
+	WaitRegion_t *wr;
+	int ii;
+
+	timingDefaults(asap);
+	if ( !val || val == spec )
+	{
+		fprintf(asap->ferr,"Invalid timing spec: '%s'. Expected name=value\n", spec);
+		return 1;
+	}
+	++val;
+	if ( !strncasecmp(spec,"clock=",6) )
+	{
+		mhz = strtod(val,&endp);
+		if ( endp == val || *endp || mhz <= 0 )
+		{
+			fprintf(asap->ferr,"Invalid clock: '%s'\n", val);
+			return 1;
+		}
+		asap->clockMHz = mhz;
+		return 0;
+	}
+	if ( !strncasecmp(spec,"timer=",6) )
+	{
+		asap->timerPeriod = strtoull(val,&endp,0);
+		if ( endp == val || *endp || !asap->timerPeriod )
+		{
+			fprintf(asap->ferr,"Invalid timer period: '%s'\n", val);
+			return 1;
+		}
+		return 0;
+	}
+	if ( !strncasecmp(spec,"wait=",5) )
+	{
+		from = strtoul(val,&endp,16);
+		if ( endp == val || *endp != '-' )
+			goto badWait;
+		val = endp+1;
+		to = strtoul(val,&endp,16);
+		if ( endp == val || *endp != ':' || to < from || to > 0xFFFFFFFFUL )
+			goto badWait;
+		val = endp+1;
+		num = strtoul(val,&endp,0);
+		if ( endp == val || *endp || num > 255 )
+			goto badWait;
+		wr = (WaitRegion_t *)realloc(asap->waitRegions,(asap->numWaitRegions+1)*sizeof(WaitRegion_t));
+		if ( !wr )
+		{
+			fprintf(asap->ferr,"Out of memory for wait states\n");
+			return 1;
+		}
+		asap->waitRegions = wr;
+		wr += asap->numWaitRegions++;
+		wr->from = from;
+		wr->to = to;
+		wr->waits = num;
+		return 0;
+badWait:
+		fprintf(asap->ferr,"Invalid wait states: '%s'. Expected wait=from-to:n\n", spec);
+		return 1;
+	}
+	for (ii=0; ii < 32; ++ii)
+	{
+		if ( !strncasecmp(spec,DefCycles[ii].name,val-spec-1) && !DefCycles[ii].name[val-spec-1] )
+			break;
+	}
+	if ( ii >= 32 )
+	{
+		fprintf(asap->ferr,"Unknown timing name: '%.*s'\n", (int)(val-spec-1), spec);
+		return 1;
+	}
+	num = strtoul(val,&endp,0);
+	if ( endp == val || *endp || num < 1 || num > 255 )
+	{
+		fprintf(asap->ferr,"Invalid cycle count: '%s'\n", val);
+		return 1;
+	}
+	asap->opCycles[ii] = num;
+	if ( ii == 0 )
+		asap->opCycles[31] = num;	/* ILLEGAL is both of the unused opcodes */
+	return 0;
+}
+
+int timingInit(Asap_t *asap)
+{
+	uint64_t top = asap->memSize;
+	uint32_t numPages = ((top+3) >> WAIT_SHIFT) + 1;	/* an access at top touches 4 bytes past it */
+	uint32_t page, last;
+	WaitRegion_t *wr;
+	int ii;
+
+	if ( asap->timerPeriod && timerStart(asap) )
+	{
+		fprintf(asap->ferr,"Out of memory for the timer\n");
+		return 1;
+	}
+	if ( !asap->timing || !asap->numWaitRegions )
+		return 0;
+	asap->waitPages = (uint8_t *)calloc(numPages,1);
+	if ( !asap->waitPages )
+	{
+		fprintf(asap->ferr,"Out of memory for wait states\n");
+		return 1;
+	}
+	for (ii=0, wr=asap->waitRegions; ii < asap->numWaitRegions; ++ii, ++wr)
+	{
+		if ( (wr->from >> WAIT_SHIFT) >= numPages )
+			continue;
+		last = wr->to >> WAIT_SHIFT;
+		if ( last >= numPages )
+			last = numPages-1;
+		for (page = wr->from >> WAIT_SHIFT; page <= last; ++page)
+		{
+			if ( asap->waitPages[page] < wr->waits )
+				asap->waitPages[page] = wr->waits;
+		}
+		if ( asap->maxWait < wr->waits )
+			asap->maxWait = wr->waits;
+	}
+	return 0;
+}
+
+void timingReport(Asap_t *asap)
+{
+	if ( !asap->timing )
+		return;
+	fprintf(asap->fout,"%llu instructions in %llu cycles (%.3f CPI), %.6f seconds at %gMHz\n",
+		   (unsigned long long)asap->insns,
+		   (unsigned long long)asap->cycles,
+		   asap->insns ? (double)asap->cycles/asap->insns : 0.0,
+		   asap->cycles/(asap->clockMHz*1e6),
+		   asap->clockMHz);
+}
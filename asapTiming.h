@@ -0,0 +1,18 @@
+#ifndef _ASAPTIMING_H_
+#define _ASAPTIMING_H_
+
+#include "asapExecute.h"
+
+/* Turn timing on with the usual cycle counts, if it isn't already */
+extern void timingDefaults(Asap_t *asap);
+
+/* Take one -t spec. Turns timing on. Returns non-zero if it's no good. */
+extern int timingOption(Asap_t *asap, const char *spec);
+
+/* Make waitPages[] and start the timer once memory is set up. Returns non-zero if it can't. */
+extern int timingInit(Asap_t *asap);
+
+/* Print what has been counted so far */
+extern void timingReport(Asap_t *asap);
+
+#endif	/* _ASAPTIMING_H_ */
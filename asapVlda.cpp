@@ -0,0 +1,246 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "vlda_structs.h"
+#include "segdef.h"
+#include "asapExecute.h"
+#include "asapSim.h"
+#include "asapTiming.h"
+#include "asapVlda.h"
+
+/*
+ * Loading the linker's VLDA output directly, rather than the flat image
+ * mixit makes of it. The file is a run of records, each
+ *
+ *	count			2 bytes, little endian, of what follows
+ *	type			a byte, VLDA_xxx (see vlda_structs.h)
+ *	...				the rest of the record
+ *	pad				a byte if count is odd
+ *
+ * (get_stb.cpp reads the .stb the same way). Of them
+ *
+ *	VLDA_ABS		is an address and the bytes that go there
+ *	VLDA_XFER		is where to start instead of 0
+ *	VLDA_GSD		defines a segment (its base) or a symbol, of which
+ *					only INIT_SP, where root.mac puts the stack, matters
+ *	VLDA_SLEN		is the length of a segment, so BSS that has nothing
+ *					in the file is memory all the same
+ *	VLDA_DBGSEG		is the base and length of a segment too
+ *
+ * and the rest are passed over. VLDA_TXT is relocatable, so a file with
+ * one hasn't been linked. memLen becomes the end of the highest data or
+ * segment and stackSize is made big enough to reach INIT_SP above it.
+ * Only the ABS records' bytes are copied in; everything between them is
+ * the zeros of the fresh mapping memory is (see asapSim.cpp), so there's
+ * no flat, zero filled copy of the image either on disk or in memory.
+ *
+ * Without -A a file that reaches past VLDA_FLAT_MAX is refused. With it
+ * records and segments can be anywhere in the 4GB and memLen, which is
+ * also how much is predecoded, only counts those below VLDA_FLAT_MAX.
+ * Code above that runs, decoded as it goes.
+ */
+
+#define VLDA_FLAT_MAX	((uint64_t)256<<20)
+
+typedef struct
+{
+	uint16_t ident;
+	uint32_t base;
+} VldaSeg_t;
+
+typedef struct
+{
+	uint64_t end;			/* of the highest data or segment */
+	uint64_t flatEnd;		/* and of the highest that's below VLDA_FLAT_MAX */
+	uint32_t xfer;
+	bool haveXfer;
+	uint32_t initSp;		/* 0 if there's no INIT_SP */
+	VldaSeg_t *segs;
+	int numSegs;
+} VldaLayout_t;
+
+static uint16_t getU16(const uint8_t *rcd)
+{
+	return (rcd[1] << 8) | rcd[0];
+}
+
+static uint32_t getU32(const uint8_t *rcd)
+{
+	return (rcd[3] << 24) | (rcd[2] << 16) | (rcd[1] << 8) | rcd[0];
+}
+
+static void extent(VldaLayout_t *lo, uint64_t from, uint64_t len)
+{
+	uint64_t end = from + len;
+
+	if ( end > lo->end )
+		lo->end = end;
+	if ( end <= VLDA_FLAT_MAX && end > lo->flatEnd )
+		lo->flatEnd = end;
+}
+
+static int bad(Asap_t *asap, const char *path, int recNum, const char *why)
+{
+	fprintf(asap->fout,"'%s' record %d %s\n", path, recNum, why);
+	return 1;
+}
+
+/* Check the framing of every record and work out where everything goes */
+static int scan(Asap_t *asap, const char *path, const uint8_t *buf, size_t len, VldaLayout_t *lo)
+{
+	const uint8_t *rcd, *body, *end = buf + len;
+	const char *name;
+	VldaSeg_t *seg;
+	uint32_t cnt;
+	uint16_t flags, noff, ident;
+	int recNum, ii;
+
+	for ( rcd = buf, recNum = 0; rcd < end; rcd += 2 + cnt + (cnt&1), ++recNum )
+	{
+		if ( end - rcd < 3 || !(cnt = getU16(rcd)) || (size_t)(end - rcd - 2) < cnt )
+			return bad(asap,path,recNum,"is cut short");
+		body = rcd + 2;
+		switch (body[0])
+		{
+		case VLDA_ABS:
+			if ( cnt < 5 )
+				return bad(asap,path,recNum,"(ABS) is too short");
+			if ( (uint64_t)getU32(body+1) + cnt-5 > (uint64_t)1<<32 )
+				return bad(asap,path,recNum,"(ABS) goes past 4GB");
+			extent(lo,getU32(body+1),cnt-5);
+			break;
+		case VLDA_XFER:
+			if ( cnt < 5 )
+				return bad(asap,path,recNum,"(XFER) is too short");
+			lo->xfer = getU32(body+1);
+			lo->haveXfer = true;
+			break;
+		case VLDA_TXT:
+			return bad(asap,path,recNum,"is relocatable (TXT). Was it linked?");
+		case VLDA_GSD:
+			if ( cnt < 11 )
+				return bad(asap,path,recNum,"(GSD) is too short");
+			flags = getU16(body+1);
+			noff = getU16(body+3);
+			ident = getU16(body+5);
+			if ( (flags&VSYM_SYM) )
+			{
+				name = (const char *)body + noff;
+				if (    (flags&VSYM_DEF) && noff && noff < cnt
+					 && memchr(name,0,cnt-noff) && !strcmp(name,"INIT_SP") )
+					lo->initSp = getU32(body+7);
+				break;
+			}
+			if ( cnt < 23 )
+				return bad(asap,path,recNum,"(segment) is too short");
+			seg = (VldaSeg_t *)realloc(lo->segs,(lo->numSegs+1)*sizeof(VldaSeg_t));
+			if ( !seg )
+				return bad(asap,path,recNum,"(segment) is one too many for memory");
+			lo->segs = seg;
+			seg += lo->numSegs++;
+			seg->ident = ident;
+			seg->base = getU32(body+11);
+			break;
+		case VLDA_SLEN:
+			if ( cnt < 7 )
+				return bad(asap,path,recNum,"(SLEN) is too short");
+			ident = getU16(body+1);
+			for ( ii = 0; ii < lo->numSegs; ++ii )
+			{
+				if ( lo->segs[ii].ident == ident )
+				{
+					extent(lo,lo->segs[ii].base,getU32(body+3));
+					break;
+				}
+			}
+			break;
+		case VLDA_DBGSEG:
+			if ( cnt < 17 )
+				return bad(asap,path,recNum,"(DBGSEG) is too short");
+			extent(lo,getU32(body+1),getU32(body+5));
+			break;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Copy the ABS records' bytes in. scan() has checked them already. */
+static void place(Asap_t *asap, const uint8_t *buf, size_t len)
+{
+	const uint8_t *rcd, *end = buf + len;
+	uint32_t cnt;
+
+	for ( rcd = buf; rcd < end; rcd += 2 + cnt + (cnt&1) )
+	{
+		cnt = getU16(rcd);
+		if ( rcd[2] == VLDA_ABS )
+			memcpy(asap->mem + getU32(rcd+3),rcd+7,cnt-5);
+	}
+}
+
+int vldaLoad(Asap_t *asap, int fd, const char *path, bool guard)
+{
+	VldaLayout_t lo;
+	struct stat st;
+	uint8_t *map;
+	uint64_t memLen;
+	size_t len;
+	int sts = 1;
+
+	if ( fstat(fd,&st) < 0 || st.st_size <= 0 )
+	{
+		fprintf(asap->fout,"Premature EOF on '%s'\n", path);
+		return 1;
+	}
+	len = st.st_size;
+	map = (uint8_t *)mmap(NULL,len,PROT_READ,MAP_PRIVATE,fd,0);
+	if ( map == MAP_FAILED )
+	{
+		fprintf(asap->fout,"Unable to map '%s': %s\n", path, strerror(errno));
+		return 1;
+	}
+	memset(&lo,0,sizeof(lo));
+	if ( scan(asap,path,map,len,&lo) )
+		goto done;
+	if ( !lo.end )
+	{
+		fprintf(asap->fout,"'%s' has nothing in it to load\n", path);
+		goto done;
+	}
+	if ( lo.end > VLDA_FLAT_MAX && !asap->wholeSpace )
+	{
+		fprintf(asap->fout,"'%s' goes up to %08llX. That needs -A.\n", path, (unsigned long long)lo.end-1);
+		goto done;
+	}
+	memLen = asap->wholeSpace ? lo.flatEnd : lo.end;
+	memLen = memLen ? (memLen+3) & ~(uint64_t)3 : 4;
+	asap->memLen = memLen;
+	if ( lo.initSp > memLen && lo.initSp - memLen <= VLDA_FLAT_MAX && lo.initSp - memLen > (uint64_t)asap->stackSize )
+		asap->stackSize = lo.initSp - memLen;
+	if ( asapAllocMem(asap,guard) )
+		goto done;
+	place(asap,map,len);
+	if ( lo.haveXfer )
+	{
+		asap->pcQue[0] = lo.xfer;
+		asap->pcQue[1] = lo.xfer+4;
+		asap->pcQue[2] = lo.xfer+8;
+	}
+	if ( asap->verbose )
+		fprintf(asap->fout,"Loaded '%s': 0x%X bytes with BSS, 0x%X of stack, starting at %08X\n",
+				path, asap->memLen, asap->stackSize, asap->pcQue[0]);
+	sts = timingInit(asap);
+done:
+	free(lo.segs);
+	munmap(map,len);
+	return sts;
+}
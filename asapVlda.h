@@ -0,0 +1,13 @@
+#ifndef _ASAPVLDA_H_
+#define _ASAPVLDA_H_
+
+#include "asapExecute.h"
+
+/* Load the linker's VLDA output (a .hex from llf) open on fd (path is for
+   messages) instead of a flat image, with guard pages if guard (-g), and do
+   timingInit(). fd is left open and its offset alone. Returns non-zero,
+   having said why, if it can't. asapLoadFd() calls it for any path ending
+   in .hex, so asapLoadImage() and -B's jobs do. */
+extern int vldaLoad(Asap_t *asap, int fd, const char *path, bool guard);
+
+#endif	/* _ASAPVLDA_H_ */
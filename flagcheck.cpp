@@ -0,0 +1,426 @@
+/* MIT license. See LICENSE.md for details */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "asapExecute.h"
+#include "asapSim.h"
+#include "syscalls.h"
+
+/*
+ * make check. A differential test of the condition codes, which are worked
+ * out lazily (see foldStatus() in asapExecute.cpp) and, by the JIT engine,
+ * natively. Built with LAZY_FLAGS_CHECK, so every time the interpreter
+ * makes the status from what a .C instruction left it is compared with the
+ * status kept the eager way by mkStatus(), and so is each of the 16 branch
+ * conditions chkBranch() gets from the two.
+ *
+ * For each flag setting instruction (the ALU ops, shifts, loads, stores,
+ * LEA and LEAS, register and immediate forms) a guest program is made that
+ * runs it on the edge cases of its operands, after each of the Prefixes
+ * (status set outright, or a .C instruction's status still pending, all
+ * of it or just N and Z). After each case all 16 Bcc are tried, and which
+ * weren't taken, GETPS and the result are stored. The program goes round
+ * PASSES times so the JIT engine translates it. It is run with each engine
+ * and the results of the others have to be what the simple engine's are.
+ */
+
+#ifndef LAZY_FLAGS_CHECK
+#error flagcheck has to be built with -DLAZY_FLAGS_CHECK (see the Makefile)
+#endif
+
+#ifndef n_elts
+	#define n_elts(x) (int)(sizeof(x)/sizeof((x)[0]))
+#endif
+
+#define PASSES		(60)	/* more than the JIT engine's JIT_THRESHOLD */
+#define NUM_PREFIXES	(4)
+
+#define OP_BCC		(0x01)
+#define OP_BRA		(0x02)
+#define OP_LEA		(0x03)
+#define OP_LEAS		(0x04)
+#define OP_ADD		(0x08)
+#define OP_SUB		(0x09)
+#define OP_AND		(0x0C)
+#define OP_OR		(0x0E)
+#define OP_LD		(0x10)
+#define OP_LDS		(0x11)
+#define OP_LDUS		(0x12)
+#define OP_STS		(0x13)
+#define OP_ST		(0x14)
+#define OP_LDB		(0x15)
+#define OP_LDUB		(0x16)
+#define OP_STB		(0x17)
+#define OP_ASHR		(0x18)
+#define OP_ROTL		(0x1B)
+#define OP_GETPS	(0x1C)
+#define OP_PUTPS	(0x1D)
+#define OP_SYSCALL	(0x1F)
+#define COND_NE		(12)
+#define REG(n)		(0xFFE0+(n))	/* src2 that's a register */
+
+/* Registers the program uses */
+#define R_A			(1)		/* first operand, or what's stored */
+#define R_B			(2)		/* second operand, if a register */
+#define R_DST		(3)
+#define R_NOTTAKEN	(4)		/* a bit for each Bcc not taken */
+#define R_PS		(5)
+#define R_RESULTS	(6)		/* where this case's results go */
+#define R_SCRATCH	(7)		/* the prefix's result */
+#define R_PASSES	(8)
+#define R_BASE		(9)		/* of loads and stores */
+
+static const char * const OpNames[32] =
+{
+	NULL, NULL, NULL, "LEA", "LEAS", "SUBR", "XOR", "XORN",
+	"ADD", "SUB", "ADDC", "SUBC", "AND", "ANDN", "OR", "ORN",
+	"LD", "LDS", "LDUS", "STS", "ST", "LDB", "LDUB", "STB",
+	"ASHR", "LSHR", "SHL", "ROTL", NULL, NULL, NULL, NULL
+};
+
+static const char * const Prefixes[NUM_PREFIXES] =
+{
+	"PUTPS 0", "PUTPS 0xF", "SUB.C pending", "AND.C pending over PUTPS 0xF"
+};
+
+/* Operands. Data[] is what the loads read, and its first NUM_EDGES are the edge cases of the others */
+static const uint32_t Data[] = { 0, 1, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF, 0x7F, 0x80, 0x7FFF, 0x8000 };
+#define NUM_EDGES	(5)
+static const uint32_t Immediates[] = { 0, 1, 0x7FFF, 0x8000, 0xFFDF };
+
+/* The constants are in the image at CONST_BASE, so "LD reg,%0[n]" gets one */
+#define CONST_BASE	(2)
+#define CONST_PASSES	(CONST_BASE+n_elts(Data))
+#define CONST_RESULTS	(CONST_PASSES+1)
+#define CONST_STORES	(CONST_RESULTS+1)
+
+static bool isLoad(int op)
+{
+	return op == OP_LD || op == OP_LDS || op == OP_LDUS || op == OP_LDB || op == OP_LDUB;
+}
+
+static bool isStore(int op)
+{
+	return op == OP_ST || op == OP_STS || op == OP_STB;
+}
+
+static bool isShift(int op)
+{
+	return op >= OP_ASHR && op <= OP_ROTL;
+}
+
+typedef struct
+{
+	uint8_t op;
+	bool reg;				/* src2 is a register */
+	uint8_t prefix;
+	uint32_t a, b;			/* b is the immediate if !reg */
+} Case_t;
+
+typedef struct
+{
+	uint32_t *words;
+	int numWords;
+	int maxWords;
+	Case_t *cases;
+	int numCases;
+	int maxCases;
+} Prog_t;
+
+static void emit(Prog_t *prog, uint32_t word)
+{
+	if ( prog->numWords >= prog->maxWords )
+	{
+		prog->maxWords = prog->maxWords ? prog->maxWords*2 : 4096;
+		prog->words = (uint32_t *)realloc(prog->words,prog->maxWords*sizeof(uint32_t));
+		if ( !prog->words )
+		{
+			fprintf(stderr,"flagcheck: out of memory\n");
+			exit(1);
+		}
+	}
+	prog->words[prog->numWords++] = word;
+}
+
+static void insn(Prog_t *prog, int op, int dst, bool cc, int src1, uint32_t src2)
+{
+	emit(prog,(op<<27)|(dst<<22)|(cc ? 1<<21 : 0)|(src1<<16)|(src2&0xFFFF));
+}
+
+/* A branch at words[at] to words[to] */
+static uint32_t branch(int op, int cond, int at, int to)
+{
+	return (op<<27)|(cond<<22)|((to-at)&0x3FFFFF);
+}
+
+/* Load reg with Data[idx] */
+static void loadData(Prog_t *prog, int reg, int idx)
+{
+	insn(prog,OP_LD,reg,false,0,CONST_BASE+idx);
+}
+
+static void prefix(Prog_t *prog, int which)
+{
+	switch (which)
+	{
+	case 0:
+		insn(prog,OP_PUTPS,0,false,0,0);
+		break;
+	case 1:
+		insn(prog,OP_PUTPS,0,false,0,0xF);
+		break;
+	case 2:
+		insn(prog,OP_SUB,R_SCRATCH,true,R_B,REG(R_A));
+		break;
+	case 3:
+		insn(prog,OP_PUTPS,0,false,0,0xF);
+		insn(prog,OP_AND,R_SCRATCH,true,R_A,REG(R_B));
+		break;
+	}
+}
+
+/* The instruction under test, with its operands already in R_A, R_B or at R_BASE */
+static void testInsn(Prog_t *prog, const Case_t *cp)
+{
+	/* loads and stores are at R_BASE, offset by 0 or %0 */
+	if ( isLoad(cp->op) )
+		insn(prog,cp->op,R_DST,true,R_BASE,cp->reg ? REG(0) : 0);
+	else if ( isStore(cp->op) )
+		insn(prog,cp->op,R_A,true,R_BASE,cp->reg ? REG(0) : 0);
+	else
+		insn(prog,cp->op,R_DST,true,R_A,cp->reg ? REG(R_B) : cp->b);
+}
+
+/* A case of op on Data[aIdx] and, if reg and not a shift, Data[bIdx], else b */
+static void addCase(Prog_t *prog, int op, bool reg, int pfx, int aIdx, int bIdx, uint32_t b)
+{
+	Case_t *cp;
+	int cond, at;
+
+	if ( prog->numCases >= prog->maxCases )
+	{
+		prog->maxCases = prog->maxCases ? prog->maxCases*2 : 1024;
+		prog->cases = (Case_t *)realloc(prog->cases,prog->maxCases*sizeof(Case_t));
+		if ( !prog->cases )
+		{
+			fprintf(stderr,"flagcheck: out of memory\n");
+			exit(1);
+		}
+	}
+	cp = prog->cases + prog->numCases++;
+	cp->op = op;
+	cp->reg = reg;
+	cp->prefix = pfx;
+	cp->a = Data[aIdx];
+	cp->b = reg && !isShift(op) ? Data[bIdx] : b;
+	insn(prog,OP_OR,R_DST,false,0,0);
+	if ( isLoad(op) )
+		insn(prog,OP_OR,R_BASE,false,0,(CONST_BASE+aIdx)*4);
+	else
+		loadData(prog,R_A,aIdx);
+	if ( reg && isShift(op) )
+		insn(prog,OP_OR,R_B,false,0,b);
+	else if ( reg && !isLoad(op) && !isStore(op) )
+		loadData(prog,R_B,bIdx);
+	prefix(prog,pfx);
+	testInsn(prog,cp);
+	insn(prog,OP_OR,R_NOTTAKEN,false,0,0);
+	for ( cond = 0; cond < 16; ++cond )
+	{
+		at = prog->numWords;
+		emit(prog,branch(OP_BCC,cond,at,at+3));
+		insn(prog,OP_ADD,0,false,0,0);		/* the delay slot */
+		insn(prog,OP_OR,R_NOTTAKEN,false,R_NOTTAKEN,1<<cond);
+	}
+	insn(prog,OP_GETPS,R_PS,false,0,0);
+	insn(prog,OP_ST,R_NOTTAKEN,false,R_RESULTS,0);
+	insn(prog,OP_ST,R_PS,false,R_RESULTS,1);
+	insn(prog,OP_ST,R_DST,false,R_RESULTS,2);
+	insn(prog,OP_ADD,R_RESULTS,false,R_RESULTS,12);
+}
+
+/* All the cases of op. Returns the image, of *len bytes. */
+static uint8_t *makeProgram(Prog_t *prog, int op, uint32_t *len)
+{
+	uint8_t *image;
+	int pfx, ii, jj, loop;
+
+	prog->numWords = 0;
+	prog->numCases = 0;
+	emit(prog,0);
+	insn(prog,OP_ADD,0,false,0,0);
+	for ( ii = 0; ii < n_elts(Data); ++ii )
+		emit(prog,Data[ii]);
+	emit(prog,PASSES);
+	emit(prog,0);			/* CONST_RESULTS, once the code's length is known */
+	emit(prog,0);			/* CONST_STORES */
+	prog->words[0] = branch(OP_BRA,0,0,prog->numWords);
+	loadData(prog,R_PASSES,CONST_PASSES-CONST_BASE);
+	loop = prog->numWords;
+	loadData(prog,R_RESULTS,CONST_RESULTS-CONST_BASE);
+	for ( pfx = 0; pfx < NUM_PREFIXES; ++pfx )
+	{
+		if ( isLoad(op) || isStore(op) )
+		{
+			/* the stores go above the image, where they don't change any code */
+			if ( isStore(op) )
+				loadData(prog,R_BASE,CONST_STORES-CONST_BASE);
+			for ( ii = 0; ii < n_elts(Data); ++ii )
+			{
+				addCase(prog,op,false,pfx,ii,0,0);
+				addCase(prog,op,true,pfx,ii,0,0);
+			}
+		}
+		else if ( isShift(op) )
+		{
+			for ( ii = 0; ii < NUM_EDGES; ++ii )
+			{
+				for ( jj = 0; jj < 32; ++jj )
+				{
+					addCase(prog,op,false,pfx,ii,0,jj);
+					addCase(prog,op,true,pfx,ii,0,jj);
+				}
+			}
+		}
+		else
+		{
+			for ( ii = 0; ii < NUM_EDGES; ++ii )
+			{
+				for ( jj = 0; jj < NUM_EDGES; ++jj )
+					addCase(prog,op,true,pfx,ii,jj,0);
+				for ( jj = 0; jj < n_elts(Immediates); ++jj )
+					addCase(prog,op,false,pfx,ii,0,Immediates[jj]);
+			}
+		}
+	}
+	insn(prog,OP_SUB,R_PASSES,true,R_PASSES,1);
+	emit(prog,branch(OP_BCC,COND_NE,prog->numWords,loop));
+	insn(prog,OP_ADD,0,false,0,0);
+	insn(prog,OP_OR,R_A,false,0,0);
+	insn(prog,OP_SYSCALL,0,false,0,SYSCALL_EXIT);
+	prog->words[CONST_RESULTS] = prog->numWords*4;
+	prog->words[CONST_STORES] = prog->numWords*4 + prog->numCases*12;
+	*len = prog->numWords*4;
+	image = (uint8_t *)malloc(*len);
+	if ( !image )
+	{
+		fprintf(stderr,"flagcheck: out of memory\n");
+		exit(1);
+	}
+	memcpy(image,prog->words,*len);
+	return image;
+}
+
+static FILE *devNull;		/* the guest's output */
+
+/* Run the image with engine. Returns the results, NULL if it went wrong. */
+static uint32_t *run(const char *what, Engine_t engine, const uint8_t *image, uint32_t len, int numCases, int *errors)
+{
+	Asap_t *asap;
+	uint32_t *results = NULL;
+
+	asap = asapCreate();
+	if ( !asap )
+	{
+		fprintf(stderr,"flagcheck: out of memory\n");
+		exit(1);
+	}
+	asap->engine = engine;
+	asap->fout = devNull;		/* SYSCALL_EXIT's message */
+	asap->stackSize = numCases*12 + 4096;
+	if ( asapLoadBuffer(asap,image,len,false) )
+		exit(1);
+	simulateAsap(asap);
+	*errors += asap->lazyFlagsErrors;
+	if ( asap->exitStatus != 0 )
+	{
+		fprintf(stderr,"flagcheck: %s: the program didn't finish\n", what);
+		++*errors;
+	}
+	else
+	{
+		results = (uint32_t *)malloc(numCases*12);
+		if ( !results )
+		{
+			fprintf(stderr,"flagcheck: out of memory\n");
+			exit(1);
+		}
+		memcpy(results,asap->mem+len,numCases*12);
+	}
+	asapDestroy(asap);
+	return results;
+}
+
+static void showCase(const Case_t *cp, const uint32_t *res)
+{
+	fprintf(stderr,"%s.C after %s with %08X and %s%X: not taken %04X, status %02X, result %08X",
+			OpNames[cp->op], Prefixes[cp->prefix], cp->a, cp->reg ? "register " : "#", cp->b,
+			res[0], res[1], res[2]);
+}
+
+int main(void)
+{
+	static const char * const EngineNames[] = { "simple", "threaded", "block", "jit" };
+	static const int Ops[] =
+	{
+		OP_LEA, OP_LEAS, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+		OP_LD, OP_LDS, OP_LDUS, OP_STS, OP_ST, OP_LDB, OP_LDUB, OP_STB,
+		0x18, 0x19, 0x1A, 0x1B
+	};
+	Prog_t prog;
+	uint8_t *image;
+	uint32_t len, *ref, *res;
+	char what[64];
+	int ii, eng, cc, errors = 0, bad, numCases = 0;
+
+	devNull = fopen("/dev/null","w");
+	if ( !devNull )
+	{
+		fprintf(stderr,"flagcheck: can't open /dev/null\n");
+		return 1;
+	}
+	memset(&prog,0,sizeof(prog));
+	for ( ii = 0; ii < n_elts(Ops); ++ii )
+	{
+		image = makeProgram(&prog,Ops[ii],&len);
+		numCases += prog.numCases;
+		snprintf(what,sizeof(what),"%s simple",OpNames[Ops[ii]]);
+		ref = run(what,ENGINE_SIMPLE,image,len,prog.numCases,&errors);
+		for ( eng = ENGINE_THREADED; ref && eng <= ENGINE_JIT; ++eng )
+		{
+			snprintf(what,sizeof(what),"%s %s",OpNames[Ops[ii]],EngineNames[eng]);
+			res = run(what,(Engine_t)eng,image,len,prog.numCases,&errors);
+			for ( cc = bad = 0; res && cc < prog.numCases; ++cc )
+			{
+				if ( memcmp(ref+cc*3,res+cc*3,12) )
+				{
+					if ( ++bad <= 5 )
+					{
+						fprintf(stderr,"flagcheck: %s: ",EngineNames[eng]);
+						showCase(prog.cases+cc,res+cc*3);
+						fprintf(stderr,"\n    simple: ");
+						showCase(prog.cases+cc,ref+cc*3);
+						fprintf(stderr,"\n");
+					}
+				}
+			}
+			errors += bad;
+			free(res);
+		}
+		free(ref);
+		free(image);
+	}
+	free(prog.words);
+	free(prog.cases);
+	fclose(devNull);
+	if ( errors )
+	{
+		fprintf(stderr,"flagcheck: %d errors\n", errors);
+		return 1;
+	}
+	printf("flagcheck: %d cases, 16 conditions each, agree in all %d engines\n", numCases, n_elts(EngineNames));
+	return 0;
+}
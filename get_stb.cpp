@@ -8,6 +8,7 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 
 #include "vlda_structs.h"
@@ -19,68 +20,145 @@
 	#define n_elts(x) (int)(sizeof(x)/sizeof((x)[0]))
 #endif
 
-HashEntry_t *getHashEntry(Asap_t *asap)
+/*
+ * The symbols are kept two ways, made by get_stb() from the one pass it
+ * makes over the mapped .stb, where the names stay (nothing is copied):
+ *
+ *	syms[] in address order, with the values alone in symValues[] so the
+ *	binary search for the nearest symbol at or below an address touches
+ *	as few cache lines as it can. Of symbols with the same value the last
+ *	in the file is the one found, as it always was.
+ *
+ *	symNames[], an open addressed table (linear probing, at most half
+ *	full) of indexes into syms[], hashed on the name without regard to
+ *	case. Of symbols with the same name the lowest is the one found.
+ */
+
+/* A symbol as read, with the hash of its name */
+typedef struct
+{
+	uint32_t value;
+	uint32_t hash;
+	const char *name;
+} StbSym_t;
+
+/* The hash of name, in any case, and its length in *len */
+static uint32_t nameHash(const char *name, int *len)
+{
+	const char *cp;
+	uint32_t hash = 2166136261U;	/* FNV-1a */
+	uint8_t cc;
+
+	for ( cp = name; (cc = *cp); ++cp )
+		hash = (hash ^ (cc >= 'A' && cc <= 'Z' ? cc + ('a'-'A') : cc)) * 16777619U;
+	*len = cp - name;
+	return hash;
+}
+
+/* Make syms[], symValues[] and symNames[] of the num symbols in found[], which is in file order */
+static int makeIndex(Asap_t *asap, StbSym_t *found, int num)
 {
-	HashEntry_t *ret=NULL;
-	if ( !asap->hashesPool )
+	StbSym_t *tmp, *src, *dst, *swap;
+	uint32_t *hashes, size, slot, shift;
+	int counts[256], ii, jj, sum;
+
+	for ( size = 16; size < 2*(uint32_t)num; size <<= 1 )
+		;
+	tmp = (StbSym_t *)malloc(num*sizeof(StbSym_t));
+	hashes = (uint32_t *)malloc(num*sizeof(uint32_t));
+	asap->syms = (HashEntry_t *)malloc(num*sizeof(HashEntry_t));
+	asap->symValues = (uint32_t *)malloc(num*sizeof(uint32_t));
+	asap->symNames = (int *)malloc(size*sizeof(int));
+	if ( !tmp || !hashes || !asap->syms || !asap->symValues || !asap->symNames )
+	{
+		fprintf(asap->ferr,"Failed to allocate memory for %d symbols\n", num);
+		free(tmp);
+		free(hashes);
+		return 1;
+	}
+	/* a byte at a time radix sort on the value. Being stable it leaves equal
+	   values in file order. A byte that's the same in all of them is skipped. */
+	for ( src = found, dst = tmp, shift = 0; shift < 32; shift += 8 )
 	{
-		if ( !asap->numHashes )
-			return ret;
-		asap->hashesPool = (HashEntry_t *)malloc(asap->numHashes*sizeof(HashEntry_t));
-		if ( !asap->hashesPool )
+		memset(counts,0,sizeof(counts));
+		for ( ii = 0; ii < num; ++ii )
+			++counts[(src[ii].value >> shift)&0xFF];
+		if ( counts[(src[0].value >> shift)&0xFF] == num )
+			continue;
+		for ( ii = 0, sum = 0; ii < 256; ++ii )
 		{
-			fprintf(stderr,"Failed to allocate %ld bytes for hash table\n", asap->numHashes*sizeof(HashEntry_t));
-			exit(1);
+			jj = counts[ii];
+			counts[ii] = sum;
+			sum += jj;
 		}
+		for ( ii = 0; ii < num; ++ii )
+			dst[counts[(src[ii].value >> shift)&0xFF]++] = src[ii];
+		swap = src;
+		src = dst;
+		dst = swap;
 	}
-	if ( asap->numUsedHashes < asap->numHashes )
+	for ( ii = 0; ii < num; ++ii )
 	{
-		ret = asap->hashesPool + asap->numUsedHashes;
-		++asap->numUsedHashes;
+		asap->syms[ii].value = asap->symValues[ii] = src[ii].value;
+		asap->syms[ii].name = src[ii].name;
+		hashes[ii] = src[ii].hash;
 	}
-	return ret;
+	free(tmp);
+	memset(asap->symNames,0xFF,size*sizeof(int));
+	asap->symNameMask = size-1;
+	for ( ii = 0; ii < num; ++ii )
+	{
+		for ( slot = hashes[ii]&asap->symNameMask; (jj = asap->symNames[slot]) >= 0; slot = (slot+1)&asap->symNameMask )
+		{
+			if ( hashes[jj] == hashes[ii] && !strcasecmp(asap->syms[jj].name,asap->syms[ii].name) )
+				break;
+		}
+		/* the names are in the mapped file, so the later name is the later symbol */
+		if ( jj < 0
+			 || asap->syms[ii].value%127 < asap->syms[jj].value%127
+			 || (asap->syms[ii].value%127 == asap->syms[jj].value%127 && asap->syms[ii].name > asap->syms[jj].name) )
+			asap->symNames[slot] = ii;
+	}
+	free(hashes);
+	asap->numSyms = num;
+	return 0;
 }
 
-static void insertIntoTable(Asap_t *asap, uint32_t value, const char *name)
+const HashEntry_t *findNearest(Asap_t *asap, uint32_t value)
 {
-	HashEntry_t *hash = getHashEntry(asap);
-	if ( hash )
+	const uint32_t *base = asap->symValues;
+	int num = asap->numSyms, half;
+
+	if ( !num || value < base[0] )
+		return NULL;
+	/* the last one no more than value, with nothing to mispredict but the loop */
+	while ( num > 1 )
 	{
-		hash->value = value;
-		hash->name = name;
-		hash->next = asap->hashTableTop[(value % HASH_TABLE_ENTRIES)];
-		asap->hashTableTop[(value % HASH_TABLE_ENTRIES)] = hash;
+		half = num/2;
+		base = base[half] <= value ? base+half : base;
+		num -= half;
 	}
+	return asap->syms + (base - asap->symValues);
 }
 
 const HashEntry_t *findHash(Asap_t *asap, uint32_t value)
 {
-	const HashEntry_t *res;
-	if ( !asap->numUsedHashes )
-		return NULL;
-	res = asap->hashTableTop[(value % HASH_TABLE_ENTRIES)];
-	while ( res )
-	{
-		if ( res->value == value )
-			break;
-		res = res->next;
-	}
-	return res;
+	const HashEntry_t *he = findNearest(asap,value);
+
+	return he && he->value == value ? he : NULL;
 }
 
 const HashEntry_t *findHashByName(Asap_t *asap, const char *name)
 {
-	int ii;
-	for ( ii = 0; ii < HASH_TABLE_ENTRIES; ++ii )
+	uint32_t slot;
+	int ii, len;
+
+	if ( !asap->numSyms )
+		return NULL;
+	for ( slot = nameHash(name,&len)&asap->symNameMask; (ii = asap->symNames[slot]) >= 0; slot = (slot+1)&asap->symNameMask )
 	{
-		HashEntry_t *he;
-		he = asap->hashTableTop[ii];
-		while ( he )
-		{
-			if ( !strcasecmp(he->name, name) )
-				return he;
-			he = he->next;
-		}
+		if ( !strcasecmp(asap->syms[ii].name,name) )
+			return asap->syms + ii;
 	}
 	return NULL;
 }
@@ -135,109 +213,158 @@ static const char* getObjCode(int code)
 	return "*Undefined*";
 }
 
-int get_stb(Asap_t *asap)
+static int badRecord(Asap_t *asap, int recNum, int typ, const char *why)
 {
-	int fd, sts, recNum;
-	uint8_t *rcdPtr;
-	struct stat st;
-	const char *codeName;
-	uint16_t cnt;
-	uint8_t typ, pad;
-	
-	sts = stat(asap->stbFilename, &st);
-	if ( sts < 0 )
+	fprintf(asap->ferr,"'%s' record %d (%s) %s\n", asap->stbFilename, recNum, getObjCode(typ), why);
+	return 1;
+}
+
+/* The name at noff in the record at body of cnt bytes, NULL if it isn't all in there */
+static const char *recordName(const uint8_t *body, uint32_t cnt, uint16_t noff)
+{
+	if ( !noff || noff >= cnt || !memchr(body+noff,0,cnt-noff) )
+		return NULL;
+	return (const char *)body + noff;
+}
+
+/* One pass over the records, which stay where they're mapped: names point into them */
+static int readRecords(Asap_t *asap, const uint8_t *buf, size_t len)
+{
+	const uint8_t *rcd, *body, *end = buf + len;
+	StbSym_t *found = NULL, *sym;
+	StbSeg_t *seg;
+	const char *name;
+	uint32_t cnt;
+	uint16_t flags, ident;
+	int recNum, num = 0, maxFound = 0, ii, nameLen, sts = 1;
+
+	for ( rcd = buf, recNum = 0; rcd < end; rcd += 2 + cnt + (cnt&1), ++recNum )
 	{
-		printf("Unable to stat '%s': %s\n", asap->stbFilename, strerror(errno));
-		return 1;
+		if ( end - rcd < 3 || !(cnt = getU16(rcd)) || (size_t)(end - rcd - 2) < cnt )
+		{
+			badRecord(asap,recNum,end - rcd < 3 ? -1 : rcd[2],"is cut short");
+			goto done;
+		}
+		body = rcd + 2;
+		if ( body[0] == VLDA_SLEN )
+		{
+			if ( cnt < 7 )
+			{
+				badRecord(asap,recNum,body[0],"is too short");
+				goto done;
+			}
+			/* it comes after its segment, most likely right after */
+			ident = getU16(body+1);
+			for ( ii = asap->numSegs-1; ii >= 0; --ii )
+			{
+				if ( asap->segs[ii].ident == ident )
+				{
+					asap->segs[ii].len = getU32(body+3);
+					break;
+				}
+			}
+			continue;
+		}
+		if ( body[0] != VLDA_GSD )
+			continue;
+		flags = getU16(body+1);
+		if ( cnt < ((flags&VSYM_SYM) ? 11 : 23) )
+		{
+			badRecord(asap,recNum,body[0],"is too short");
+			goto done;
+		}
+		name = recordName(body,cnt,getU16(body+3));
+		if ( !(flags&VSYM_SYM) )
+		{
+			seg = (StbSeg_t *)realloc(asap->segs,(asap->numSegs+1)*sizeof(StbSeg_t));
+			if ( !seg )
+			{
+				fprintf(asap->ferr,"Failed to allocate memory for %d segments\n", asap->numSegs+1);
+				goto done;
+			}
+			asap->segs = seg;
+			seg += asap->numSegs++;
+			seg->name = name ? name : "";
+			seg->base = getU32(body+11);
+			seg->len = 0;
+			seg->flags = flags;
+			seg->ident = getU16(body+5);
+			continue;
+		}
+		if ( !name )
+			continue;
+		if ( num >= maxFound )
+		{
+			maxFound = maxFound ? maxFound*2 : 256;
+			sym = (StbSym_t *)realloc(found,maxFound*sizeof(StbSym_t));
+			if ( !sym )
+			{
+				fprintf(asap->ferr,"Failed to allocate memory for %d symbols\n", maxFound);
+				goto done;
+			}
+			found = sym;
+		}
+		sym = found + num++;
+		sym->value = getU32(body+7);
+		sym->name = name;
+		sym->hash = nameHash(name,&nameLen);
+		if ( nameLen > asap->longestName )
+			asap->longestName = nameLen;
 	}
-	asap->stbFileContents = (uint8_t *)malloc(st.st_size);
-	if ( !asap->stbFileContents )
+	sts = num ? makeIndex(asap,found,num) : 0;
+done:
+	free(found);
+	return sts;
+}
+
+const StbSeg_t *findSegment(Asap_t *asap, uint32_t value)
+{
+	int ii;
+
+	for ( ii = 0; ii < asap->numSegs; ++ii )
 	{
-		printf("Unable to allocate %ld bytes\n", st.st_size);
-		return 1;
+		if ( value - asap->segs[ii].base < asap->segs[ii].len )
+			return asap->segs + ii;
 	}
+	return NULL;
+}
+
+int get_stb(Asap_t *asap)
+{
+	struct stat st;
+	void *map;
+	int fd, ii;
+
 	fd = open(asap->stbFilename, O_RDONLY);
 	if ( fd < 0 )
 	{
-		printf("Unable to open for read '%s': %s\n", asap->stbFilename, strerror(errno));
-		return 1;
-	}
-	sts = read(fd, asap->stbFileContents, st.st_size);
-	if ( sts < 0 )
-	{
-		printf("Error reading '%s': %s\n", asap->stbFilename, strerror(errno));
+		fprintf(asap->fout,"Unable to open for read '%s': %s\n", asap->stbFilename, strerror(errno));
 		return 1;
 	}
-	if ( sts == 0 )
+	if ( fstat(fd, &st) < 0 || st.st_size <= 0 )
 	{
-		printf("Premature EOF on '%s': %s\n", asap->stbFilename, strerror(errno));
+		fprintf(asap->fout,"Premature EOF on '%s'\n", asap->stbFilename);
+		close(fd);
 		return 1;
 	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
-	/* count GSD records */
-	rcdPtr = asap->stbFileContents;
-	recNum = 0;
-	while ( rcdPtr < asap->stbFileContents + st.st_size )
-	{
-		cnt = (rcdPtr[1] << 8) | rcdPtr[0];
-		typ = rcdPtr[2];
-		
-		codeName = getObjCode(typ);
-		pad = (cnt & 1);
-		if ( cnt >= 16384 )
-		{
-			fprintf(stderr,"get_stb(): %3d: 0x%04X%c %02X(%s) Record count >= 16384. Probably out of sync\n", recNum, cnt, pad ? '*' : ' ', typ, codeName);
-			break;
-		}
-		if ( typ == VLDA_GSD )
-			++asap->numHashes;
-		rcdPtr += cnt + 2 + pad;
-		++recNum;
-	}
-	/* Insert GSD records */
-	rcdPtr = asap->stbFileContents;
-	recNum = 0;
-	while ( rcdPtr < asap->stbFileContents + st.st_size )
+	if ( map == MAP_FAILED )
 	{
-		cnt = (rcdPtr[1] << 8) | rcdPtr[0];
-		typ = rcdPtr[2];
-
-		pad = (cnt & 1);
-		if ( typ == VLDA_GSD )
-		{
-			uint16_t flags = getU16(rcdPtr+2+1);
-			int16_t  noff = getU16(rcdPtr+2+3);
-			uint32_t value = getU32(rcdPtr+2+7);
-			if ( (flags & VSYM_SYM) && noff)
-			{
-				const char *name = (const char *)(rcdPtr+2) + noff;
-				int len = strlen(name);
-				if ( len > asap->longestName )
-					asap->longestName = len;
-				insertIntoTable(asap, value, name );
-			}
-		}
-		rcdPtr += cnt + 2 + pad;
+		fprintf(asap->fout,"Unable to map '%s': %s\n", asap->stbFilename, strerror(errno));
+		return 1;
 	}
+	/* kept mapped for as long as the names are used. asapDestroy() unmaps it. */
+	asap->stbFileContents = (const uint8_t *)map;
+	asap->stbFileLen = st.st_size;
+	if ( readRecords(asap, asap->stbFileContents, asap->stbFileLen) )
+		return 1;
+	if ( asap->verbose )
+		fprintf(asap->fout,"Read %d symbols and %d segments from '%s'\n", asap->numSyms, asap->numSegs, asap->stbFilename);
 	if ( 0 && asap->verbose )
 	{
-		for ( fd = 0; fd < HASH_TABLE_ENTRIES; ++fd )
-		{
-			HashEntry_t *he;
-			he = asap->hashTableTop[fd];
-			if ( he )
-			{
-				printf("%08X: '%s'", he->value, he->name);
-				he = he->next;
-				while ( he )
-				{
-					printf(" '%s'", he->name);
-					he = he->next;
-				}
-				printf("\n");
-			}
-		}
+		for ( ii = 0; ii < asap->numSyms; ++ii )
+			fprintf(asap->fout,"%08X: '%s'\n", asap->syms[ii].value, asap->syms[ii].name);
 	}
 	return 0;
 }
-
@@ -4,7 +4,13 @@
 #include "asapExecute.h"
 
 extern int get_stb(Asap_t *asap);
+/* The symbol at value, NULL if none */
 extern const HashEntry_t *findHash(Asap_t *asap, uint32_t value);
+/* The symbol at or nearest below value, NULL if none */
+extern const HashEntry_t *findNearest(Asap_t *asap, uint32_t value);
+/* The symbol called name (in any case), NULL if none */
 extern const HashEntry_t *findHashByName(Asap_t *asap, const char *name);
+/* The segment value is in, NULL if none */
+extern const StbSeg_t *findSegment(Asap_t *asap, uint32_t value);
 
 #endif	/* _GET_STB_H_ */
@@ -4,42 +4,97 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdarg.h>
-#include <fcntl.h>
-#include <sys/stat.h>
 #include <errno.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "asapExecute.h"
+#include "asapSim.h"
 #include "get_stb.h"
-
-static Asap_t asap;
+#include "asapTiming.h"
+#include "asapIo.h"
+#include "asapBatch.h"
+#include "asapSnap.h"
+#include "asapFork.h"
+#include "asapReplay.h"
+#include "asapHistory.h"
 
 static int help_em(const char *us)
 {
-	fprintf(stderr,"Usage: %s [-hiv] [-e ptr] path-to-image\n"
+	fprintf(stderr,"Usage: %s [-Aghiv] [-e ptr] [-E engine] [-H count] [-I log] [-m region] [-n count] [-r snapshot] [-t timing] [-T traps] [-w snapshot] path-to-image\n"
+			"   or: %s -B manifest [-j threads] [-o results] [other options as above]\n"
 			"Where:\n"
+			"path-to-image is a flat image (from mixit) or the linker's .hex, loaded where\n"
+			"          its records say and started at its transfer address (see asapVlda.cpp)\n"
+			"-A      - memory is all 4GB, the image at 0 and the rest zeros, only using\n"
+			"          host memory for the pages that are touched (no stack checks)\n"
+			"-B path - run the jobs listed in path, a line each of: image [input [count]]\n"
+			"          (see asapBatch.cpp), on a pool of threads\n"
 			"-e ptr  - place in sim memory where errno is located. Defaults to 0x1BC\n"
+			"-E name - execution engine: 'simple' (default), 'threaded', 'block' or 'jit'\n"
+			"-F where - run to where (a symbol or hex address) then fork a copy to carry on\n"
+			"          from there for each line of stdin: input output [count]. Replies go\n"
+			"          to stdout, everything else to stderr (see asapFork.cpp)\n"
+			"-g      - guard pages around memory instead of address checks in the faster engines\n"
 			"-h      - this message\n"
+			"-H cnt  - keep a checkpoint every cnt instructions so the interactive\n"
+			"          reverse-step, reverse-continue and last-write commands can go\n"
+			"          back (see asapHistory.cpp). Uses the simple engine\n"
 			"-i      - set interactive mode\n"
+			"-I spec - what the program reads from stdin. spec is one of:\n"
+			"          record=path      is also written to path\n"
+			"          replay=path      is read back from path instead (see asapReplay.cpp)\n"
+			"-j cnt  - threads to run -B's jobs on (default one per core)\n"
+			"-m spec - ROM or a device (repeat as need be). spec is one of:\n"
+			"          rom=from-to      stores to from-to (hex) are ignored\n"
+			"          console=addr     byte stores to addr go to stdout, loads come from stdin\n"
+			"-n cnt  - stop after cnt instructions (the faster engines are only used with -t)\n"
+			"-o path - where -B writes the results (default stdout)\n"
+			"-r path - start from the snapshot in path instead of from 0\n"
 			"-s      - set stack size (default 32768)"
 			"-S path - point to .stb file to get symbols\n"
+			"-t spec - count cycles (repeat as need be). spec is one of:\n"
+			"          clock=MHz        to report the time at (default 20)\n"
+			"          wait=from-to:n   n wait states on memory from-to (hex)\n"
+			"          NAME=n           opcode NAME (LD, ADD, Bcc, ILLEGAL...) takes n cycles\n"
+			"          timer=n          interrupt (vector 0xC0) every n cycles\n"
+			"-T name - what illegal opcodes do: 'hle' (default) does syscalls and ends the run\n"
+			"          on anything else, 'mixed' does syscalls and traps on anything else,\n"
+			"          'exact' traps on everything (to 0x40 or 0x80, as asap.doc says)\n"
 			"-v      - increase verbosity\n"
-			,us);
+			"-w path - write a snapshot to path when the simulation ends\n"
+			,us,us);
 	return 1;
 }
 
 int main(int argc, char *argv[])
 {
-	struct stat st;
-	int opt, sts, fd, errnoPtrSet=0;
+	Asap_t *asap;
+	int opt, errnoPtrSet=0, guard=0, numIoSpecs=0, ii;
+	const char *ioSpecs[32], *timingSpecs[32];
+	int numTimingSpecs=0, threads=0;
+	uint64_t historyEvery=0;
 	uint32_t errnoPtr=0;
-	const char *imageName;
+	const char *imageName, *manifest=NULL, *results=NULL, *restore=NULL, *save=NULL, *forkWhere=NULL, *inputSpec=NULL;
+	BatchOpts_t batch;
 	char *endp;
+	FILE *replies=NULL;
 	
-	while ( (opt = getopt(argc, argv, "e:his:S:v")) != -1 )
+	asap = asapCreate();
+	if ( !asap )
+	{
+		fprintf(stderr,"Out of memory\n");
+		return 1;
+	}
+	while ( (opt = getopt(argc, argv, "AB:e:E:F:ghH:iI:j:m:n:o:r:s:S:t:T:vw:")) != -1 )
 	{
 		switch (opt)
 		{
+		case 'A':
+			asap->wholeSpace = true;
+			break;
+		case 'B':
+			manifest = optarg;
+			break;
 		case 'e':
 			endp = NULL;
 			errnoPtr = strtol(optarg,&endp,0);
@@ -50,87 +105,252 @@ int main(int argc, char *argv[])
 			}
 			errnoPtrSet = 1;
 			break;
+		case 'E':
+			if ( !strcasecmp(optarg,"simple") )
+				asap->engine = ENGINE_SIMPLE;
+			else if ( !strcasecmp(optarg,"threaded") )
+				asap->engine = ENGINE_THREADED;
+			else if ( !strcasecmp(optarg,"block") )
+				asap->engine = ENGINE_BLOCK;
+			else if ( !strcasecmp(optarg,"jit") )
+				asap->engine = ENGINE_JIT;
+			else
+			{
+				fprintf(stderr,"Unknown engine: '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'F':
+			forkWhere = optarg;
+			break;
+		case 'g':
+			guard = 1;
+			break;
 		case 'v':
-			++asap.verbose;
+			++asap->verbose;
 			break;
 		case 'i':
-			asap.interactive = true;
+			asap->interactive = true;
+			break;
+		case 'H':
+			endp = NULL;
+			historyEvery = strtoull(optarg,&endp,0);
+			if ( !endp || *endp || !historyEvery )
+			{
+				fprintf(stderr,"Invalid checkpoint interval: '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'I':
+			inputSpec = optarg;		/* once timing is known */
+			break;
+		case 'j':
+			endp = NULL;
+			threads = strtol(optarg,&endp,0);
+			if ( !endp || *endp || threads < 1 )
+			{
+				fprintf(stderr,"Invalid thread count: '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			if ( numIoSpecs >= (int)(sizeof(ioSpecs)/sizeof(ioSpecs[0])) )
+			{
+				fprintf(stderr,"Too many -m options\n");
+				return 1;
+			}
+			ioSpecs[numIoSpecs++] = optarg;	/* once there's memory */
+			break;
+		case 'n':
+			endp = NULL;
+			asap->insnLeft = strtoull(optarg,&endp,0);
+			if ( !endp || *endp )
+			{
+				fprintf(stderr,"Invalid instruction count: '%s'\n", optarg);
+				return 1;
+			}
+			asap->insnLimited = true;
+			break;
+		case 'o':
+			results = optarg;
+			break;
+		case 'r':
+			restore = optarg;
 			break;
 		case 's':
 			endp = NULL;
-			asap.stackSize = strtol(optarg,&endp,0);
-			if ( !endp || *endp || asap.stackSize <= 0 || asap.stackSize > 1024 )
+			asap->stackSize = strtol(optarg,&endp,0);
+			if ( !endp || *endp || asap->stackSize <= 0 || asap->stackSize > 1024 )
 			{
 				fprintf(stderr,"Invalid stack size: '%s'\n", optarg);
 				return 1;
 			}
 			break;
 		case 'S':
-			asap.stbFilename = optarg;
+			asap->stbFilename = optarg;
+			break;
+		case 't':
+			if ( numTimingSpecs >= (int)(sizeof(timingSpecs)/sizeof(timingSpecs[0])) )
+			{
+				fprintf(stderr,"Too many -t options\n");
+				return 1;
+			}
+			if ( timingOption(asap,optarg) )
+				return 1;
+			timingSpecs[numTimingSpecs++] = optarg;	/* for -B's jobs */
+			break;
+		case 'T':
+			if ( !strcasecmp(optarg,"hle") )
+				asap->traps = TRAPS_HLE;
+			else if ( !strcasecmp(optarg,"mixed") )
+				asap->traps = TRAPS_MIXED;
+			else if ( !strcasecmp(optarg,"exact") )
+				asap->traps = TRAPS_EXACT;
+			else
+			{
+				fprintf(stderr,"Unknown trap mode: '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'w':
+			save = optarg;
 			break;
 		case 'h':
 		default: /* '?' */
 			return help_em(argv[0]);
 		}
 	}
-	if ( !asap.stackSize )
-		asap.stackSize = 32768;
+	if ( manifest )
+	{
+		if ( optind < argc )
+		{
+			fprintf(stderr, "No image expected after options with -B\n");
+			return help_em(argv[0]);
+		}
+		if ( asap->interactive )
+			printf("WARNING: -i is ignored with -B\n");
+		if ( inputSpec )
+			printf("WARNING: -I is ignored with -B\n");
+		if ( historyEvery )
+			printf("WARNING: -H is ignored with -B\n");
+		if ( guard )
+			printf("WARNING: -g is ignored with -B\n");
+		if ( save )
+			printf("WARNING: -w is ignored with -B\n");
+		if ( forkWhere )
+			printf("WARNING: -F is ignored with -B\n");
+		batch.proto = asap;
+		batch.timingSpecs = timingSpecs;
+		batch.numTimingSpecs = numTimingSpecs;
+		batch.ioSpecs = ioSpecs;
+		batch.numIoSpecs = numIoSpecs;
+		batch.errnoPtr = errnoPtrSet ? errnoPtr : 0;
+		batch.threads = threads;
+		batch.snapshot = restore;
+		opt = runBatch(manifest,results,&batch);
+		asapDestroy(asap);
+		return opt;
+	}
 	if ( optind >= argc )
 	{
 		fprintf(stderr, "Expected path to image after options\n");
 		return help_em(argv[0]);
 	}
 	imageName = argv[optind];
-	sts = stat(imageName, &st);
-	if ( sts < 0 )
+	if ( forkWhere )
 	{
-		printf("Unable to stat '%s': %s\n", imageName, strerror(errno));
-		return 1;
+		/* the replies have stdout to themselves. Everything else, the
+		   program's output getting to where included, goes to stderr */
+		fflush(stdout);
+		opt = dup(1);
+		replies = opt >= 0 ? fdopen(opt,"w") : NULL;
+		if ( !replies || dup2(2,1) < 0 )
+		{
+			fprintf(stderr,"Unable to keep stdout for the replies: %s\n", strerror(errno));
+			return 1;
+		}
+		if ( asap->interactive )
+			printf("WARNING: -i is ignored with -F\n");
+		if ( inputSpec )
+			printf("WARNING: -I is ignored with -F\n");
+		if ( historyEvery )
+			printf("WARNING: -H is ignored with -F\n");
+		asap->interactive = false;
+		inputSpec = NULL;
+		historyEvery = 0;
+		timingDefaults(asap);		/* for the instruction count */
 	}
-	asap.memLen = st.st_size;
-	asap.mem = (uint8_t *)calloc(asap.memLen+asap.stackSize,1);
-	if ( !asap.mem )
+	if ( historyEvery )
 	{
-		printf("Unable to allocate %d bytes\n", asap.memLen+asap.stackSize);
-		return 1;
+		/* going back is running on again, and that has to go the same
+		   way: instructions counted and interrupts taken between them */
+		if ( asap->engine == ENGINE_BLOCK || asap->engine == ENGINE_JIT )
+			printf("WARNING: -E is ignored with -H\n");
+		asap->engine = ENGINE_SIMPLE;
+		timingDefaults(asap);
 	}
-	fd = open(imageName, O_RDONLY);
-	if ( fd < 0 )
+	if ( guard && asap->timing )
 	{
-		printf("Unable to open for read '%s': %s\n", imageName, strerror(errno));
-		return 1;
+		/* the engines need the address checks to count wait states */
+		printf("WARNING: -g is ignored with -t\n");
+		guard = 0;
 	}
-	sts = read(fd, asap.mem, st.st_size);
-	if ( sts < 0 )
+	if ( guard && numIoSpecs )
 	{
-		printf("Error reading '%s': %s\n", imageName, strerror(errno));
-		return 1;
+		/* and to find ROM and devices */
+		printf("WARNING: -g is ignored with -m\n");
+		guard = 0;
 	}
-	if ( sts == 0 )
+	if ( guard && asap->wholeSpace )
 	{
-		printf("Premature EOF on '%s': %s\n", imageName, strerror(errno));
+		/* there's nothing past the top of 4GB to put them in */
+		printf("WARNING: -g is ignored with -A\n");
+		guard = 0;
+	}
+	if ( asapLoadImage(asap,imageName,guard) )
 		return 1;
+	for ( ii = 0; ii < numIoSpecs; ++ii )
+	{
+		if ( ioOption(asap,ioSpecs[ii]) )
+			return 1;
 	}
-	close(fd);
-	if ( asap.stbFilename )
+	if ( asap->stbFilename )
 	{
-		if ( get_stb(&asap) )
+		if ( get_stb(asap) )
 			return 1;
 	}
 	if ( !errnoPtrSet && !errnoPtr )
 		errnoPtr = 0x1BC;
-	if ( errnoPtr >= asap.memLen )
+	if ( errnoPtr >= asap->memLen && !asap->wholeSpace )
 	{
-		if ( errnoPtr >= asap.memLen + asap.stackSize )
-			printf("WARNING: errno (%08X) is completely outside image 0x00000000-0x%08X. Not set.\n",
-				   errnoPtr, asap.memLen + asap.stackSize -1);
+		if ( errnoPtr >= asap->memSize )
+			printf("WARNING: errno (%08X) is completely outside image 0x00000000-0x%08llX. Not set.\n",
+				   errnoPtr, (unsigned long long)asap->memSize -1);
 		else
 			printf("WARNING: errno (0x%08X) is outside image and into stack space 0x00000000-0x%08X. Not set.\n",
-				   errnoPtr, asap.memLen-1);
+				   errnoPtr, asap->memLen-1);
 	}
 	else if ( errnoPtrSet && errnoPtr )
-		asap.errnoPtr = (int *)(asap.mem + errnoPtr);
-	simulateAsap(&asap);
+		asap->errnoPtr = (int *)(asap->mem + errnoPtr);
+	if ( restore && snapRestore(asap,restore) )
+		return 1;
+	if ( inputSpec && replayOption(asap,inputSpec) )
+		return 1;
+	if ( historyEvery && historyStart(asap,historyEvery) )
+		return 1;
+	if ( forkWhere )
+	{
+		opt = forkServer(asap,forkWhere,stdin,replies);
+		fclose(replies);
+		asapDestroy(asap);
+		return opt;
+	}
+	simulateAsap(asap);
+	timingReport(asap);
+	historyReport(asap);
+	if ( save && snapSave(asap,save) )
+		return 1;
+	asapDestroy(asap);
 	return 0;
 }
 
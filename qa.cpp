@@ -3,8 +3,8 @@
 
 #include "lclreadline.h"
 
-int _qaval_;    /* global cell for returned value (guaranteed to match) */
-int _qacnt_;    /* global cell for number of characters read */
+__thread int _qaval_;    /* per thread cell for returned value (guaranteed to match) */
+__thread int _qacnt_;    /* per thread cell for number of characters read */
 int _qaflg_ = 1;    /* flag for these routines to bypass prompt */
 
 /*==========================================================================*/
@@ -11,8 +11,8 @@
 extern int qa5(FILE *fin, FILE *fout, const char *prompt, int bufsiz, char *buf);
 extern void purge_qa2(FILE *fin, FILE *fout);
 extern void purgeHistory(void);
-extern int _qaval_; /* global cell for (guaranteed) returned value */
-extern int _qacnt_; /* global cell for number of characters read */
+extern __thread int _qaval_; /* per thread cell for (guaranteed) returned value */
+extern __thread int _qacnt_; /* per thread cell for number of characters read */
 
 #define qa( prompt, bufsiz, buf ) qa5( stdin, stdout, prompt, bufsiz, buf )
 #define purge_qa() purge_qa2( stdin, stdout )